@@ -0,0 +1,216 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  AttackContext.cc
+ *
+ *    Description:  Saved per cryptosystem values for the attacks.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <gmp.h>
+#include "include/types.h"
+#include "include/elgamal.h"
+#include "include/dlog.h"
+#include "include/montgomery.h"
+#include "include/CipherTextContainer.h"
+#include "MpzList.h"
+#include "ElgamalAttack.h"
+#include "AttackContext.h"
+
+char *AttackContext::fileNameFor (const char *cryptosystemFileName) {
+    char *fileName = (char *) malloc (strlen (cryptosystemFileName)
+                                      + strlen (ATTACK_CONTEXT_SUFFIX) + 1);
+    if (fileName != NULL) {
+        strcpy (fileName, cryptosystemFileName);
+        strcat (fileName, ATTACK_CONTEXT_SUFFIX);
+    }
+    return fileName;
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/*
+ * FNV-1a over the 64-bit words of f from offset to the end, the last one
+ * padded with zeros. Byte at a time it would cost more than loading the
+ * context saves, so the words go round four lanes whose multiplications
+ * overlap. f is left at offset. False on a read error.
+ */
+static bool hashFrom (FILE *f, long offset, uint64_t *hash) {
+    uint64_t buffer[1 << 13];
+    uint64_t lanes[4];
+    for (int k=0; k < 4; k++)
+        lanes[k] = FNV_OFFSET_BASIS + k;
+    uint64_t total = 0;
+    size_t length;
+    if (fseek (f, offset, SEEK_SET) != 0)
+        return false;
+    // fread only comes up short at the end, so the words stay aligned
+    while ((length = fread (buffer, 1, sizeof (buffer), f)) > 0) {
+        total += length;
+        size_t words = (length + 7) / 8;
+        memset ((char *) buffer + length, 0, words * 8 - length);
+        size_t i = 0;
+        for (; i + 4 <= words; i += 4) {
+            lanes[0] = (lanes[0] ^ buffer[i]) * FNV_PRIME;
+            lanes[1] = (lanes[1] ^ buffer[i+1]) * FNV_PRIME;
+            lanes[2] = (lanes[2] ^ buffer[i+2]) * FNV_PRIME;
+            lanes[3] = (lanes[3] ^ buffer[i+3]) * FNV_PRIME;
+        }
+        for (; i < words; i++)
+            lanes[i & 3] = (lanes[i & 3] ^ buffer[i]) * FNV_PRIME;
+    }
+    if (ferror (f) || fseek (f, offset, SEEK_SET) != 0)
+        return false;
+
+    uint64_t h = FNV_OFFSET_BASIS;
+    for (int k=0; k < 4; k++)
+        h = (h ^ lanes[k]) * FNV_PRIME;
+    *hash = (h ^ total) * FNV_PRIME;
+    return true;
+}
+
+AttackContext::AttackContext (const char *fileName, ElgamalCryptosystem *e) {
+    error = true;
+    this->e = e;
+    deltaPowers = NULL;
+    deltaCount = 0;
+    limbs = 0;
+    phOffset = 0;
+
+    file = fopen (fileName, "r");
+    if (file == NULL) {
+        perror (fileName);
+        return;
+    }
+
+    AttackContextHeader h;
+    if (fread (&h, sizeof (h), 1, file) != 1
+            || memcmp (h.magic, ATTACK_CONTEXT_MAGIC, sizeof (h.magic)) != 0
+            || h.byteOrder != ATTACK_CONTEXT_BYTE_ORDER
+            || h.limbBits != GMP_LIMB_BITS) {
+        fprintf (stderr, "%s: not an attack context for this machine\n", fileName);
+        return;
+    }
+
+    uint64_t hash;
+    if (!hashFrom (file, sizeof (h), &hash) || hash != h.payloadHash) {
+        fprintf (stderr, "%s: attack context is damaged\n", fileName);
+        return;
+    }
+
+    mpz_t sGenerator, s;
+    mpz_init (sGenerator); mpz_init (s);
+    bool same = h.fingerprint == elgamalFingerprint (e)
+                && h.limbs == mpz_size (e->prime)
+                && mpz_inp_raw (sGenerator, file) != 0
+                && mpz_inp_raw (s, file) != 0
+                && mpz_cmp (sGenerator, e->sGenerator) == 0
+                && mpz_cmp (s, e->s->value) == 0;
+    mpz_clear (sGenerator); mpz_clear (s);
+    if (!same) {
+        fprintf (stderr, "%s: attack context is for a different cryptosystem\n", fileName);
+        return;
+    }
+
+    limbs = h.limbs;
+    deltaPowers = (mp_limb_t *) malloc (h.deltaCount * limbs * sizeof (mp_limb_t));
+    if (deltaPowers == NULL) {
+        fprintf (stderr, "%s: not enough memory for the attack context\n", fileName);
+        return;
+    }
+    if (fread (deltaPowers, sizeof (mp_limb_t), h.deltaCount * limbs, file)
+            != h.deltaCount * limbs) {
+        fprintf (stderr, "%s: truncated attack context\n", fileName);
+        return;
+    }
+    deltaCount = h.deltaCount;
+    phOffset = ftell (file);
+
+    error = false;
+}
+
+AttackContext::~AttackContext () {
+    if (deltaPowers != NULL)
+        free (deltaPowers);
+    if (file != NULL)
+        fclose (file);
+}
+
+PohligHellmanContext *AttackContext::newPohligHellman () {
+    // anything which cannot be read is computed by the constructor
+    FILE *saved = (!error && fseek (file, phOffset, SEEK_SET) == 0) ? file : NULL;
+    return new PohligHellmanContext (e->sGenerator, e->prime, e->s,
+                                     PH_TABLE_MAX_BABY_STEPS, saved);
+}
+
+bool AttackContext::write (const char *fileName, ElgamalCryptosystem *e) {
+    DeltaPowerStream powers (e, MIM_DELTA_SIEVE_LIMIT);
+    PohligHellmanContext ph (e->sGenerator, e->prime, e->s);
+    if (powers.hasMallocError () || ph.hasMallocError ()) {
+        fprintf (stderr, "%s: not enough memory for the attack context\n", fileName);
+        return false;
+    }
+
+    // a run reading the context while it is written, or a crash, must not
+    // see half a file
+    char *tmpFileName = (char *) malloc (strlen (fileName) + 32);
+    if (tmpFileName == NULL) {
+        fprintf (stderr, "%s: not enough memory for the attack context\n", fileName);
+        return false;
+    }
+    sprintf (tmpFileName, "%s.%ld", fileName, (long) getpid ());
+    FILE *f = fopen (tmpFileName, "w+");
+    if (f == NULL) {
+        perror (tmpFileName);
+        free (tmpFileName);
+        return false;
+    }
+
+    AttackContextHeader h;
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, ATTACK_CONTEXT_MAGIC, sizeof (h.magic));
+    h.byteOrder = ATTACK_CONTEXT_BYTE_ORDER;
+    h.limbBits = GMP_LIMB_BITS;
+    h.limbs = powers.getContext ()->n;
+    h.fingerprint = elgamalFingerprint (e);
+    h.deltaCount = MIM_DELTA_SIEVE_LIMIT;
+
+    bool ok = fwrite (&h, sizeof (h), 1, f) == 1
+              && mpz_out_raw (f, e->sGenerator) != 0
+              && mpz_out_raw (f, e->s->value) != 0;
+
+    unsigned long first;
+    size_t length;
+    const mp_limb_t *chunk;
+    while (ok && (chunk = powers.nextChunk (&first, &length)) != NULL)
+        ok = fwrite (chunk, sizeof (mp_limb_t), length * h.limbs, f) == length * h.limbs;
+
+    ok = ok && ph.write (f) && fflush (f) == 0
+         && hashFrom (f, sizeof (h), &h.payloadHash)
+         && fseek (f, 0, SEEK_SET) == 0
+         && fwrite (&h, sizeof (h), 1, f) == 1
+         && fflush (f) == 0 && fsync (fileno (f)) == 0;
+    if (fclose (f) != 0)
+        ok = false;
+    if (ok && rename (tmpFileName, fileName) != 0) {
+        perror (fileName);
+        ok = false;
+    } else if (!ok) {
+        perror (tmpFileName);
+    }
+    if (!ok)
+        unlink (tmpFileName);
+    free (tmpFileName);
+    return ok;
+}
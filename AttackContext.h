@@ -0,0 +1,89 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  AttackContext.h
+ *
+ *    Description:  Values the attacks derive from the cryptosystem alone,
+ *                  saved next to the cryptosystem file so that each run
+ *                  loads them instead of computing them again.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _AttackContext_h
+#define _AttackContext_h
+
+#define ATTACK_CONTEXT_MAGIC "ELGACX2"
+#define ATTACK_CONTEXT_BYTE_ORDER 0x01020304u
+
+// appended to the cryptosystem file name
+#define ATTACK_CONTEXT_SUFFIX ".ctx"
+
+/*
+ * The file starts with this header, in the byte order of the machine which
+ * wrote it. Then follow sGenerator and the value of s with mpz_out_raw,
+ * which the fingerprint does not cover, deltaCount powers delta^q mod p
+ * for delta = 1, 2, ... in Montgomery form as limbs limbs each, and the
+ * Pohlig-Hellman constants for logs base sGenerator, see
+ * PohligHellmanContext::write. payloadHash is an FNV-1a hash of all that
+ * (see hashFrom), so a damaged file is refused rather than making the
+ * attacks miss messages.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t limbBits;
+    uint64_t limbs;          // per power, the size of the prime
+    uint64_t fingerprint;    // of the cryptosystem, see elgamalFingerprint
+    uint64_t deltaCount;
+    uint64_t payloadHash;    // of everything after the header
+    uint64_t reserved[2];
+} AttackContextHeader;
+
+class PohligHellmanContext;
+
+/*
+ * The sieve of DeltaPowerStream and the setup of PohligHellmanContext take
+ * a few thousand exponentiations, which dominate short runs of mimattack
+ * with small messages. mimattack -x writes them once per cryptosystem, and
+ * later runs load them if the file is there and matches.
+ */
+class AttackContext {
+    private:
+        bool error;
+        FILE *file;
+        long phOffset;           // of the Pohlig-Hellman constants in file
+        ElgamalCryptosystem *e;
+        mp_limb_t *deltaPowers;
+
+    public:
+        uint64_t deltaCount;
+        size_t limbs;
+
+        // load the context for e from fileName
+        AttackContext (const char *fileName, ElgamalCryptosystem *e);
+        ~AttackContext ();
+
+        // false if the file could not be read, is damaged, or was written
+        // for another cryptosystem, limb size or byte order
+        bool hasError () { return error; }
+
+        // delta^q in Montgomery form for delta = 1 to deltaCount, at delta - 1
+        const mp_limb_t *getDeltaPowers () { return deltaPowers; }
+
+        // A context for logs base sGenerator in the subgroup of order s,
+        // set up from the saved constants, to free with delete.
+        PohligHellmanContext *newPohligHellman ();
+
+        // Compute the context of e and write it, false on error. The file
+        // is written under another name and renamed into place.
+        static bool write (const char *fileName, ElgamalCryptosystem *e);
+
+        // cryptosystemFileName with ATTACK_CONTEXT_SUFFIX, free with free ()
+        static char *fileNameFor (const char *cryptosystemFileName);
+};
+#endif
@@ -0,0 +1,469 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  AttackDaemon.cc
+ *
+ *    Description:  Serves crack requests over a Unix domain socket from
+ *                  attacks whose tables stay in memory.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <gmp.h>
+#include "include/types.h"
+#include "include/elgamal.h"
+#include "include/CipherTextContainer.h"
+#include "MpzList.h"
+#include "ElgamalAttack.h"
+#include "AttackDaemon.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop (int signal) {
+    stopRequested = 1;
+}
+
+static DaemonRequest *newRequests (size_t count) {
+    DaemonRequest *requests = (DaemonRequest *) malloc (count * sizeof (DaemonRequest));
+    if (requests == NULL)
+        return NULL;
+    for (size_t i=0; i < count; i++) {
+        mpz_init (requests[i].ct.gk);
+        mpz_init (requests[i].ct.myk);
+        requests[i].sent = new MpzList (4, 4);
+    }
+    return requests;
+}
+
+static void freeRequests (DaemonRequest *requests, size_t count) {
+    if (requests == NULL)
+        return;
+    for (size_t i=0; i < count; i++) {
+        mpz_clear (requests[i].ct.gk);
+        mpz_clear (requests[i].ct.myk);
+        delete requests[i].sent;
+    }
+    free (requests);
+}
+
+// the structs own their mpz limbs and lists, so requests move by swapping
+static void swapRequests (DaemonRequest *a, DaemonRequest *b) {
+    DaemonRequest t = *a;
+    *a = *b;
+    *b = t;
+}
+
+AttackDaemon::AttackDaemon (const char *socketPath) {
+    error = true;
+    listenFd = -1;
+    servedCount = 0;
+    pendingCount = 0;
+    for (unsigned int i=0; i < ATTACK_DAEMON_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+        clients[i].generation = 0;
+        clients[i].line = NULL;
+    }
+    this->socketPath = NULL;
+    pending = newRequests (ATTACK_DAEMON_MAX_PENDING);
+    batch = newRequests (ATTACK_DAEMON_MAX_BATCH);
+    if (pending == NULL || batch == NULL) {
+        fprintf (stderr, "%s: not enough memory for the daemon\n", socketPath);
+        return;
+    }
+
+    struct sockaddr_un address;
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    if (strlen (socketPath) >= sizeof (address.sun_path)) {
+        fprintf (stderr, "%s: socket path too long\n", socketPath);
+        return;
+    }
+    strcpy (address.sun_path, socketPath);
+
+    listenFd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        perror ("socket");
+        return;
+    }
+
+    // A socket left by a daemon which did not shut down cleanly refuses
+    // connections; one which accepts them belongs to a running daemon.
+    struct stat st;
+    if (stat (socketPath, &st) == 0) {
+        if (!S_ISSOCK (st.st_mode)) {
+            fprintf (stderr, "%s: exists and is not a socket\n", socketPath);
+            return;
+        }
+        if (connect (listenFd, (struct sockaddr *) &address, sizeof (address)) == 0) {
+            fprintf (stderr, "%s: another daemon is listening there\n", socketPath);
+            return;
+        }
+        if (errno != ECONNREFUSED) {
+            perror (socketPath);
+            return;
+        }
+        unlink (socketPath);
+    }
+    if (bind (listenFd, (struct sockaddr *) &address, sizeof (address)) != 0
+            || listen (listenFd, ATTACK_DAEMON_MAX_CLIENTS) != 0) {
+        perror (socketPath);
+        return;
+    }
+    this->socketPath = strdup (socketPath);
+    error = (this->socketPath == NULL);
+}
+
+AttackDaemon::~AttackDaemon () {
+    for (unsigned int i=0; i < ATTACK_DAEMON_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            closeClient (i);
+    }
+    if (listenFd >= 0)
+        close (listenFd);
+    if (socketPath != NULL) {
+        unlink (socketPath);
+        free (socketPath);
+    }
+    freeRequests (pending, ATTACK_DAEMON_MAX_PENDING);
+    freeRequests (batch, ATTACK_DAEMON_MAX_BATCH);
+}
+
+bool AttackDaemon::add (const char *name, ElgamalCryptosystem *e, ElgamalAttack *attack) {
+    if (servedCount == ATTACK_DAEMON_MAX_SERVED)
+        return false;
+    served[servedCount].name = name;
+    served[servedCount].e = e;
+    served[servedCount].attack = attack;
+    served[servedCount].fingerprint = elgamalFingerprint (e);
+    servedCount++;
+    return true;
+}
+
+// by name, or else by fingerprint in hex; -1 if neither matches
+int AttackDaemon::findServed (const char *name) {
+    for (unsigned int i=0; i < servedCount; i++) {
+        if (strcmp (served[i].name, name) == 0)
+            return i;
+    }
+    char *endptr;
+    uint64_t fingerprint = strtoull (name, &endptr, 16);
+    if (*name == '\0' || *endptr != '\0')
+        return -1;
+    for (unsigned int i=0; i < servedCount; i++) {
+        if (served[i].fingerprint == fingerprint)
+            return i;
+    }
+    return -1;
+}
+
+// Write line and a newline to client, closing it if that fails. A client
+// which stops reading holds up the daemon for ATTACK_DAEMON_SEND_TIMEOUT.
+bool AttackDaemon::sendLine (unsigned int client, const char *line) {
+    if (clients[client].fd < 0)
+        return false;
+    size_t length = strlen (line);
+    for (int part=0; part < 2; part++) {
+        const char *p = (part == 0) ? line : "\n";
+        size_t left = (part == 0) ? length : 1;
+        while (left > 0) {
+            ssize_t n = send (clients[client].fd, p, left, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                closeClient (client);
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+    return true;
+}
+
+void AttackDaemon::acceptClient () {
+    int fd = accept (listenFd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    // a send blocked this long fails, and the client is closed
+    struct timeval timeout;
+    timeout.tv_sec = ATTACK_DAEMON_SEND_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+
+    for (unsigned int i=0; i < ATTACK_DAEMON_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            continue;
+        clients[i].line = (char *) malloc (ATTACK_DAEMON_MAX_LINE);
+        if (clients[i].line == NULL)
+            break;
+        clients[i].fd = fd;
+        clients[i].generation++;
+        clients[i].used = 0;
+        return;
+    }
+    const char *busy = "error too many clients\n";
+    send (fd, busy, strlen (busy), MSG_NOSIGNAL);
+    close (fd);
+}
+
+// close the connection and drop the requests still waiting for it
+void AttackDaemon::closeClient (unsigned int client) {
+    close (clients[client].fd);
+    clients[client].fd = -1;
+    free (clients[client].line);
+    clients[client].line = NULL;
+
+    size_t kept = 0;
+    for (size_t i=0; i < pendingCount; i++) {
+        if (pending[i].client == client)
+            continue;
+        if (kept != i)
+            swapRequests (&pending[i], &pending[kept]);
+        kept++;
+    }
+    pendingCount = kept;
+}
+
+void AttackDaemon::readClient (unsigned int client) {
+    DaemonClient *c = &clients[client];
+    ssize_t n = read (c->fd, c->line + c->used, ATTACK_DAEMON_MAX_LINE - c->used);
+    if (n < 0 && errno == EINTR)
+        return;
+    if (n <= 0) {
+        closeClient (client);
+        return;
+    }
+    c->used += n;
+
+    char *start = c->line;
+    char *end;
+    while ((end = (char *) memchr (start, '\n', c->used - (start - c->line))) != NULL) {
+        *end = '\0';
+        if (end > start && end[-1] == '\r')
+            end[-1] = '\0';
+        handleLine (client, start);
+        if (c->fd < 0)
+            return;
+        start = end + 1;
+    }
+    c->used -= start - c->line;
+    memmove (c->line, start, c->used);
+    if (c->used == ATTACK_DAEMON_MAX_LINE) {
+        sendLine (client, "error line too long");
+        if (c->fd >= 0)
+            closeClient (client);
+    }
+}
+
+void AttackDaemon::handleLine (unsigned int client, char *line) {
+    char *args;
+    char *command = strtok_r (line, " \t", &args);
+    if (command == NULL)
+        return;
+
+    if (strcmp (command, "crack") == 0) {
+        queueCrack (client, args);
+    } else if (strcmp (command, "list") == 0) {
+        char reply[ATTACK_DAEMON_MAX_LINE];
+        for (unsigned int i=0; i < servedCount; i++) {
+            snprintf (reply, sizeof (reply), "cryptosystem %s %016llx %s", served[i].name,
+                      (unsigned long long) served[i].fingerprint,
+                      served[i].attack->getAttackName ());
+            if (!sendLine (client, reply))
+                return;
+        }
+        sendLine (client, "end");
+    } else {
+        sendLine (client, "error unknown command");
+    }
+}
+
+void AttackDaemon::queueCrack (unsigned int client, char *args) {
+    char *id = strtok_r (NULL, " \t", &args);
+    char *name = strtok_r (NULL, " \t", &args);
+    char *gk = strtok_r (NULL, " \t", &args);
+    char *myk = strtok_r (NULL, " \t", &args);
+    if (id == NULL || strlen (id) > ATTACK_DAEMON_MAX_ID) {
+        sendLine (client, "error expected crack <id> <cryptosystem> <g^k> <m*y^k>");
+        return;
+    }
+
+    char reply[ATTACK_DAEMON_MAX_ID + 64];
+    const char *reason = NULL;
+    int s = -1;
+    DaemonRequest *request = &pending[pendingCount];
+    if (myk == NULL || strtok_r (NULL, " \t", &args) != NULL) {
+        reason = "expected crack <id> <cryptosystem> <g^k> <m*y^k>";
+    } else if ((s = findServed (name)) < 0) {
+        reason = "unknown cryptosystem";
+    } else if (pendingCount == ATTACK_DAEMON_MAX_PENDING) {
+        reason = "busy";
+    } else if (mpz_set_str (request->ct.gk, gk, 10) != 0
+               || mpz_set_str (request->ct.myk, myk, 10) != 0) {
+        reason = "not a decimal number";
+    } else if (mpz_sgn (request->ct.gk) <= 0 || mpz_sgn (request->ct.myk) <= 0
+               || mpz_cmp (request->ct.gk, served[s].e->prime) >= 0
+               || mpz_cmp (request->ct.myk, served[s].e->prime) >= 0) {
+        reason = "not a residue mod p";
+    }
+    if (reason != NULL) {
+        snprintf (reply, sizeof (reply), "%s error %s", id, reason);
+        sendLine (client, reply);
+        return;
+    }
+
+    request->client = client;
+    request->generation = clients[client].generation;
+    request->served = s;
+    strcpy (request->id, id);
+    request->sent->clear ();
+    pendingCount++;
+}
+
+// false once the client of request has gone, even if its slot is in use again
+bool AttackDaemon::requestAlive (const DaemonRequest *request) {
+    const DaemonClient *c = &clients[request->client];
+    return c->fd >= 0 && c->generation == request->generation;
+}
+
+/*
+ * The callback of crackMessages. Results are written once each; with no
+ * result, the clients are served in the meantime. Ends the sweep when the
+ * daemon is asked to stop.
+ */
+bool AttackDaemon::reportResult (void *arg, size_t index, mpz_t result) {
+    AttackDaemon *daemon = (AttackDaemon *) arg;
+    if (result == NULL)
+        return daemon->serviceClients (0) && !stopRequested;
+
+    DaemonRequest *request = &daemon->batch[index];
+    if (request->sent->find (NULL, result))
+        return !stopRequested;
+    request->sent->append (result);
+    if (!daemon->requestAlive (request))
+        return !stopRequested;
+    char *reply = (char *) malloc (strlen (request->id) + mpz_sizeinbase (result, 10) + 16);
+    if (reply != NULL) {
+        gmp_sprintf (reply, "%s result %Zd", request->id, result);
+        daemon->sendLine (request->client, reply);
+        free (reply);
+    }
+    return !stopRequested;
+}
+
+/*
+ * Crack the oldest waiting request together with the others for its
+ * cryptosystem, leaving the rest waiting in order.
+ */
+void AttackDaemon::crackBatch (gmp_randstate_t rstate) {
+    unsigned int s = pending[0].served;
+    size_t count = 0, kept = 0;
+    for (size_t i=0; i < pendingCount; i++) {
+        if (pending[i].served == s && count < ATTACK_DAEMON_MAX_BATCH) {
+            swapRequests (&pending[i], &batch[count++]);
+        } else {
+            if (kept != i)
+                swapRequests (&pending[i], &pending[kept]);
+            kept++;
+        }
+    }
+    pendingCount = kept;
+
+    ElgamalCipherText cts[ATTACK_DAEMON_MAX_BATCH];
+    for (size_t i=0; i < count; i++)
+        cts[i] = batch[i].ct;
+
+    time_t start = time (NULL);
+    served[s].attack->crackMessages (cts, count, rstate, reportResult, this);
+    char reply[ATTACK_DAEMON_MAX_ID + 64];
+    size_t resultCount = 0;
+    for (size_t i=0; i < count; i++) {
+        if (stopRequested)
+            snprintf (reply, sizeof (reply), "%s error daemon stopping", batch[i].id);
+        else
+            snprintf (reply, sizeof (reply), "%s done %zu", batch[i].id,
+                      batch[i].sent->getSize ());
+        if (requestAlive (&batch[i]))
+            sendLine (batch[i].client, reply);
+        resultCount += batch[i].sent->getSize ();
+    }
+    printf ("INFO: cracked %zu requests for '%s' with %zu results in %lds\n", count,
+            served[s].name, resultCount, (long) difftime (time (NULL), start));
+    fflush (stdout);
+}
+
+/*
+ * Wait up to timeout milliseconds, -1 for ever, then accept connections
+ * and read requests. False if poll fails.
+ */
+bool AttackDaemon::serviceClients (int timeout) {
+    struct pollfd fds[1 + ATTACK_DAEMON_MAX_CLIENTS];
+    unsigned int fdClient[1 + ATTACK_DAEMON_MAX_CLIENTS];
+
+    nfds_t n = 0;
+    fds[n].fd = listenFd;
+    fds[n].events = POLLIN;
+    n++;
+    for (unsigned int i=0; i < ATTACK_DAEMON_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0)
+            continue;
+        fds[n].fd = clients[i].fd;
+        fds[n].events = POLLIN;
+        fdClient[n] = i;
+        n++;
+    }
+
+    if (poll (fds, n, timeout) < 0) {
+        if (errno == EINTR)
+            return true;
+        perror ("poll");
+        return false;
+    }
+    for (nfds_t k=1; k < n; k++) {
+        if (fds[k].revents != 0 && clients[fdClient[k]].fd >= 0)
+            readClient (fdClient[k]);
+    }
+    if (fds[0].revents & POLLIN)
+        acceptClient ();
+    return true;
+}
+
+void AttackDaemon::run (gmp_randstate_t rstate) {
+    struct sigaction action;
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = requestStop;
+    // no SA_RESTART, so that poll returns
+    sigaction (SIGINT, &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+
+    printf ("INFO: listening on '%s'\n", socketPath);
+    fflush (stdout);
+    while (!stopRequested) {
+        // With requests waiting only take in what has already arrived, so
+        // that requests sent during a sweep join the next one together.
+        if (!serviceClients ((pendingCount > 0) ? 0 : -1))
+            break;
+        if (pendingCount > 0 && !stopRequested)
+            crackBatch (rstate);
+    }
+    printf ("INFO: stopping\n");
+}
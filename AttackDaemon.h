@@ -0,0 +1,129 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  AttackDaemon.h
+ *
+ *    Description:  Serves crack requests over a Unix domain socket from
+ *                  attacks whose tables stay in memory.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _AttackDaemon_h
+#define _AttackDaemon_h
+
+#define ATTACK_DAEMON_MAX_SERVED 16
+#define ATTACK_DAEMON_MAX_CLIENTS 64
+
+// requests waiting for a sweep; more are answered with an error
+#define ATTACK_DAEMON_MAX_PENDING 1024
+
+// Ciphertexts cracked in one sweep. Each adds a multiplication and a table
+// lookup per delta2, so a request arriving during a long batch waits for
+// at most this many others.
+#define ATTACK_DAEMON_MAX_BATCH 64
+
+// a request line carries two residues in decimal, 620 digits at 1024 bits
+#define ATTACK_DAEMON_MAX_LINE 8192
+#define ATTACK_DAEMON_MAX_ID 64
+
+// seconds a client may leave a reply unread before it is dropped
+#define ATTACK_DAEMON_SEND_TIMEOUT 10
+
+typedef struct {
+    const char *name;            // as given to add
+    ElgamalCryptosystem *e;
+    ElgamalAttack *attack;
+    uint64_t fingerprint;
+} ServedCryptosystem;
+
+typedef struct {
+    int fd;                      // -1 for a free slot
+    unsigned int generation;     // counts the connections in this slot
+    char *line;                  // ATTACK_DAEMON_MAX_LINE bytes
+    size_t used;
+} DaemonClient;
+
+typedef struct {
+    unsigned int client;
+    unsigned int generation;     // of the client, which may have gone since
+    unsigned int served;
+    char id[ATTACK_DAEMON_MAX_ID + 1];
+    ElgamalCipherText ct;
+    MpzList *sent;               // results written so far
+} DaemonRequest;
+
+/*
+ * Clients connect to the socket and write one request per line:
+ *
+ *   crack <id> <cryptosystem> <g^k> <m*y^k>
+ *   list
+ *
+ * where id is any word the client chooses, cryptosystem is a name given to
+ * add or the fingerprint of the cryptosystem in hex, and the residues are
+ * in decimal. For a crack request the daemon writes
+ *
+ *   <id> result <m>        for each result, as soon as it is found
+ *   <id> done <count>      once the sweep is over, count the results
+ *   <id> error <reason>    instead, if the request was not accepted or
+ *                          the daemon stopped during its sweep
+ *
+ * and for list one line "cryptosystem <name> <fingerprint> <attack>" per
+ * cryptosystem, then "end". Results are checked against u^q before they
+ * are written, and each is written once, however many splits lead to it;
+ * as with mimattack several may be found, of which the message is one.
+ *
+ * Requests are cracked in arrival order. All waiting requests for the same
+ * cryptosystem, up to ATTACK_DAEMON_MAX_BATCH, go into one call of
+ * ElgamalAttack::crackMessages, so those attacks which share the delta2
+ * sweep pay for it once per batch rather than once per request. During a
+ * sweep the daemon keeps accepting connections and reading requests, which
+ * join a later batch, and a client which leaves replies unread for
+ * ATTACK_DAEMON_SEND_TIMEOUT seconds is dropped.
+ */
+class AttackDaemon {
+    private:
+        bool error;
+        char *socketPath;
+        int listenFd;
+        ServedCryptosystem served[ATTACK_DAEMON_MAX_SERVED];
+        unsigned int servedCount;
+        DaemonClient clients[ATTACK_DAEMON_MAX_CLIENTS];
+        DaemonRequest *pending;      // ATTACK_DAEMON_MAX_PENDING of them
+        size_t pendingCount;
+        DaemonRequest *batch;        // ATTACK_DAEMON_MAX_BATCH of them
+
+        bool serviceClients (int timeout);
+        bool requestAlive (const DaemonRequest *request);
+        void acceptClient ();
+        void closeClient (unsigned int client);
+        void readClient (unsigned int client);
+        void handleLine (unsigned int client, char *line);
+        void queueCrack (unsigned int client, char *args);
+        bool sendLine (unsigned int client, const char *line);
+        int findServed (const char *name);
+        void crackBatch (gmp_randstate_t rstate);
+
+        static bool reportResult (void *arg, size_t index, mpz_t result);
+
+    public:
+        // Listen on socketPath, replacing a socket left there by a daemon
+        // which is no longer running.
+        AttackDaemon (const char *socketPath);
+        ~AttackDaemon ();
+
+        bool hasError () { return error; }
+
+        // Serve e under name with attack, whose table must be built. All
+        // three must outlive the daemon. False if there are too many.
+        bool add (const char *name, ElgamalCryptosystem *e, ElgamalAttack *attack);
+
+        // Serve requests until SIGINT or SIGTERM. The socket goes with the
+        // daemon.
+        void run (gmp_randstate_t rstate);
+};
+#endif
@@ -50,6 +50,7 @@ DiskMimAttack::DiskMimAttack (ElgamalCryptosystem *elg, char *fileName, unsigned
     bits2 = b2;
     e = elg;
     this->fileName = fileName;
+    reused = false;
     bdb = tcbdbnew();
     //int64_t bnum = (2 << bits1); // suggested 1 to 4 times # pages to be stored, default 32749
     //tcbdbtune (bdb, 512, 1024, bnum, -1, -1, BDBTLARGE);
@@ -91,7 +92,8 @@ bool DiskMimAttack::buildTable (gmp_randstate_t rstate) {
             fprintf (stderr, "open error: %s\n", tcbdberrmsg(ecode));
         } else {
             printf ("Using existing table.\n");
-            return false;
+            reused = true;
+            return true;
         }
     }
 #endif
@@ -113,12 +115,12 @@ bool DiskMimAttack::buildTable (gmp_randstate_t rstate) {
 
     size_t max = (1l << bits1);
 
+    DeltaPowerStream powers (e, max, NULL, 0, context);
     // as i goes from 0 to 2^bits1 - 1, delta1 goes from 1 to 2^bits1
     for (size_t i = 0; i < max; i++) {
-        mpz_add_ui (delta1, delta1, 1);
+        powers.next (delta1, tmp);
 
         value = (UIntType) mpz_get_ui (delta1);
-        mpz_powm (tmp, delta1, e->baseOrder, e->prime);
         key = hash (tmp);
 
         /* store records */
@@ -180,13 +182,8 @@ size_t DiskMimAttack::crackMessage (MpzList *results, const ElgamalCipherText ct
     bool found = false;
     int i, size, max;
     TCLIST *list;
-    while (mpz_cmp_ui (delta2, end) < 0) {
-        mpz_add_ui (delta2, delta2, 1);
-        //gmp_printf ("delta2 = %Zd\n", delta2);
-        mpz_powm (target, delta2, e->baseOrder, e->prime);
-        mpz_invert (target, target, e->prime);
-        mpz_mul (target, target, uq);
-        mpz_mod (target, target, e->prime);
+    MimTargetStream targets (e, uq, end, NULL, 0, context);
+    while (targets.next (delta2, target)) {
         targetHash = hash (target);
 
         list = tcbdbget4 (bdb, &targetHash, sizeof (targetHash));
@@ -34,11 +34,13 @@ class DiskMimAttack : public ElgamalAttack {
     private:
         TCBDB *bdb;
         char *fileName;
+        bool reused;
 
     public:
         DiskMimAttack (ElgamalCryptosystem *c, char *fileName, unsigned int bits1, unsigned int bits2);
         ~DiskMimAttack ();
         bool buildTable (gmp_randstate_t rstate);
+        bool reusedTable () { return reused; }
         size_t crackMessage (MpzList *results, const ElgamalCipherText ct,
                              gmp_randstate_t rstate, size_t maxResults=0);
         const char* getAttackName () const { return "diskmim"; }
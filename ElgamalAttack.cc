@@ -16,11 +16,16 @@
  * =====================================================================================
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <gmp.h>
 #include "include/types.h"
 #include "include/elgamal.h"
+#include "include/montgomery.h"
+#include "include/batchpowm.h"
 #include "MpzList.h"
 #include "ElgamalAttack.h"
+#include "AttackContext.h"
 
 int mpzTableEntryCompare (const void *a, const void *b) {
     return mpz_cmp (((MpzTableEntry *)a)->key, ((MpzTableEntry *)b)->key);
@@ -41,6 +46,288 @@ size_t ElgamalAttack::crackMessage (MpzList *results, const ElgamalCipherText ct
     return 0;
 }
 
+/*
+ * Sieve for the smallest prime factor of every integer up to n. Primes are
+ * marked with 0, since their smallest prime factor may not fit in 16 bits.
+ */
+uint16_t *smallestPrimeFactors (size_t n) {
+    uint16_t *spf = (uint16_t *) calloc (n + 1, sizeof (uint16_t));
+    if (spf == NULL)
+        return NULL;
+
+    for (size_t p=2; p * p <= n; p++) {
+        if (spf[p] != 0)
+            continue;
+        for (size_t j=p*p; j <= n; j += p) {
+            if (spf[j] == 0)
+                spf[j] = (uint16_t) p;
+        }
+    }
+    return spf;
+}
+
+DeltaPowerStream::DeltaPowerStream (ElgamalCryptosystem *e, unsigned long last,
+                                    FILE *cache, unsigned long cacheMax,
+                                    AttackContext *context) {
+    mallocError = false;
+    this->e = e;
+    this->last = last;
+    this->cache = cache;
+    this->cacheMax = (cache != NULL) ? cacheMax : 0;
+    first = 1;
+    length = 0;
+    position = 0;
+    chunk = NULL;
+    sieved = NULL;
+    spf = NULL;
+    sieveLimit = 0;
+    preloaded = NULL;
+    preloadedMax = 0;
+
+    mont = new MontgomeryContext (e->prime);
+    batch = new BatchPowm (e->prime, e->baseOrder);
+    powers = mont->allocResidues (MIM_DELTA_CHUNK);
+    bases = (unsigned long *) malloc (MIM_DELTA_CHUNK * sizeof (*bases));
+    results = (mpz_t *) malloc (MIM_DELTA_CHUNK * sizeof (*results));
+    if (results != NULL) {
+        for (size_t k=0; k < MIM_DELTA_CHUNK; k++)
+            mpz_init (results[k]);
+    }
+    if (mont->hasMallocError () || batch->hasMallocError () || powers == NULL
+        || bases == NULL || results == NULL) {
+        mallocError = true;
+        return;
+    }
+
+    // without the sieve every power is an exponentiation, which is slower
+    // but still correct
+    unsigned long limit = (last < MIM_DELTA_SIEVE_LIMIT) ? last : MIM_DELTA_SIEVE_LIMIT;
+    if (context != NULL && context->limbs == (size_t) mont->n && context->deltaCount >= limit) {
+        preloaded = context->getDeltaPowers ();
+        preloadedMax = limit;
+    } else if (limit > 0) {
+        sieved = mont->allocResidues (limit);
+        spf = smallestPrimeFactors (limit);
+        if (sieved != NULL && spf != NULL)
+            sieveLimit = limit;
+    }
+}
+
+DeltaPowerStream::~DeltaPowerStream () {
+    if (powers != NULL)
+        free (powers);
+    if (sieved != NULL)
+        free (sieved);
+    if (spf != NULL)
+        free (spf);
+    if (bases != NULL)
+        free (bases);
+    if (results != NULL) {
+        for (size_t k=0; k < MIM_DELTA_CHUNK; k++)
+            mpz_clear (results[k]);
+        free (results);
+    }
+    delete batch;
+    delete mont;
+}
+
+/*
+ * Compute the chunk starting at delta = first. A chunk is either entirely
+ * at or below sieveLimit or entirely above it. The exponentiations are done
+ * first, so that the composites of the chunk can use the primes in it.
+ */
+void DeltaPowerStream::fill () {
+    length = MIM_DELTA_CHUNK;
+    if (last - first + 1 < length)
+        length = last - first + 1;
+
+    if (first <= preloadedMax) {
+        // keep the cache in step for the deltas after the preloaded ones
+        for (unsigned long delta = first; delta <= cacheMax && delta < first + length; delta++) {
+            if (mpz_inp_raw (results[0], cache) == 0) {
+                fprintf (stderr, "Unable to read from cache at %lu\n", delta);
+                cacheMax = 0;
+            }
+        }
+        chunk = preloaded + (first - 1) * mont->n;
+        position = 0;
+        return;
+    }
+
+    mp_limb_t *out = powers;
+    if (first <= sieveLimit)
+        out = sieved + (first - 1) * mont->n;
+
+    size_t count = 0;
+    for (size_t k=0; k < length; k++) {
+        unsigned long delta = first + k;
+        if (delta <= cacheMax) {
+            if (mpz_inp_raw (results[0], cache)) {
+                mont->toMont (out + k * mont->n, results[0]);
+                continue;
+            }
+            fprintf (stderr, "Unable to read from cache at %lu\n", delta);
+            cacheMax = 0;
+        }
+        if (delta > sieveLimit || spf[delta] == 0)
+            bases[count++] = delta;
+    }
+
+    batch->powm (results, bases, count);
+    for (size_t i=0; i < count; i++)
+        mont->toMont (out + (bases[i] - first) * mont->n, results[i]);
+
+    for (size_t k=0; k < length; k++) {
+        unsigned long delta = first + k;
+        if (delta > cacheMax && delta <= sieveLimit && spf[delta] != 0) {
+            unsigned long f = spf[delta];
+            mont->mul (out + k * mont->n, sieved + (f - 1) * mont->n,
+                       sieved + (delta / f - 1) * mont->n);
+        }
+    }
+
+    chunk = out;
+    position = 0;
+}
+
+const mp_limb_t *DeltaPowerStream::nextChunk (unsigned long *first, size_t *length) {
+    if (mallocError)
+        return NULL;
+    this->first += this->length;
+    if (this->first > last || this->first == 0)
+        return NULL;
+    fill ();
+    // the whole chunk is handed out
+    position = this->length;
+    *first = this->first;
+    *length = this->length;
+    return chunk;
+}
+
+bool DeltaPowerStream::next (mpz_t delta, mpz_t power) {
+    if (mallocError) {
+        if (first > last || first == 0)
+            return false;
+        mpz_set_ui (delta, first++);
+        mpz_powm (power, delta, e->baseOrder, e->prime);
+        return true;
+    }
+    if (position == length) {
+        first += length;
+        if (first > last || first == 0)
+            return false;
+        fill ();
+    }
+    mont->fromMont (power, chunk + position * mont->n);
+    mpz_set_ui (delta, first + position);
+    position++;
+    return true;
+}
+
+MimTargetStream::MimTargetStream (ElgamalCryptosystem *e, mpz_t uq, unsigned long last,
+                                  FILE *cache, unsigned long cacheMax,
+                                  AttackContext *context)
+    : powers (e, last, cache, cacheMax, context) {
+    this->e = e;
+    init (uq, 1);
+}
+
+MimTargetStream::MimTargetStream (ElgamalCryptosystem *e, const mpz_t *uqs, size_t count,
+                                  unsigned long last, AttackContext *context)
+    : powers (e, last, NULL, 0, context) {
+    this->e = e;
+    init (uqs[0], count);
+}
+
+void MimTargetStream::init (mpz_srcptr uqs, size_t count) {
+    uqValues = uqs;
+    this->count = count;
+    length = 0;
+    position = 0;
+    current = NULL;
+    mpz_init (inverse);
+    mont = powers.getContext ();
+    uq = NULL;
+    if (!powers.hasMallocError ())
+        uq = mont->allocResidues (count + 2 * MIM_DELTA_CHUNK);
+    if (uq == NULL)
+        return;
+    inverses = uq + count * mont->n;
+    scratch = inverses + MIM_DELTA_CHUNK * mont->n;
+    for (size_t i=0; i < count; i++)
+        mont->toMont (uq + i * mont->n, uqs + i);
+}
+
+MimTargetStream::~MimTargetStream () {
+    if (uq != NULL)
+        free (uq);
+    mpz_clear (inverse);
+}
+
+bool MimTargetStream::next (mpz_t delta2) {
+    if (uq == NULL) {
+        // out of memory, fall back to one inversion per delta2
+        if (!powers.next (delta2, inverse))
+            return false;
+        mpz_invert (inverse, inverse, e->prime);
+        return true;
+    }
+    if (position == length) {
+        const mp_limb_t *chunk = powers.nextChunk (&first, &length);
+        if (chunk == NULL)
+            return false;
+        mont->batchInvert (inverses, chunk, length, scratch);
+        position = 0;
+    }
+    current = inverses + position * mont->n;
+    mpz_set_ui (delta2, first + position);
+    position++;
+    return true;
+}
+
+void MimTargetStream::target (mpz_t target, size_t i) {
+    if (uq == NULL) {
+        mpz_mul (target, inverse, uqValues + i);
+        mpz_mod (target, target, e->prime);
+        return;
+    }
+    // scratch is free once the chunk is inverted
+    mont->mul (scratch, current, uq + i * mont->n);
+    mont->fromMont (target, scratch);
+}
+
+bool MimTargetStream::next (mpz_t delta2, mpz_t target) {
+    if (!next (delta2))
+        return false;
+    this->target (target, 0);
+    return true;
+}
+
+size_t ElgamalAttack::crackMessages (const ElgamalCipherText *cts, size_t count,
+                                     gmp_randstate_t rstate,
+                                     CrackResultCallback found, void *arg) {
+    MpzList results (20, 20);
+    mpz_t uq, check;
+    mpz_init (uq); mpz_init (check);
+    size_t total = 0;
+    bool going = true;
+    for (size_t i=0; going && i < count; i++) {
+        going = found (arg, i, NULL);
+        mpz_powm (uq, cts[i].myk, e->baseOrder, e->prime);
+        size_t resultCount = going ? crackMessage (&results, cts[i], rstate) : 0;
+        for (size_t j=0; going && j < resultCount; j++) {
+            mpz_powm (check, results[j], e->baseOrder, e->prime);
+            if (mpz_cmp (check, uq) == 0) {
+                going = found (arg, i, results[j]);
+                total++;
+            }
+        }
+        results.clear ();
+    }
+    mpz_clear (uq); mpz_clear (check);
+    return total;
+}
+
 /*
 char * ElgamalAttack::tableFileName () {
 
@@ -15,19 +15,163 @@ typedef struct {
 int mpzTableEntryCompare (const void *a, const void *b);
 int mpzTableEntryReverseCompare (const void *a, const void *b);
 
+// smallest prime factor of every integer up to n, 0 for primes
+uint16_t *smallestPrimeFactors (size_t n);
+
+class MontgomeryContext;
+class BatchPowm;
+class AttackContext;
+
+// number of deltas DeltaPowerStream computes at a time
+#define MIM_DELTA_CHUNK 256
+
+// DeltaPowerStream keeps delta^q for delta up to this limit, which must be
+// a multiple of MIM_DELTA_CHUNK
+#define MIM_DELTA_SIEVE_LIMIT (1ul << 16)
+
+/*
+ * Produces delta^q mod p for delta = 1 to last in order, a chunk at a time,
+ * for the table builds and the online phase of the meet in the middle
+ * attacks. Since (ab)^q = a^q b^q, for composite delta up to
+ * MIM_DELTA_SIEVE_LIMIT delta^q is the product of two earlier powers, found
+ * with a smallest prime factor sieve. The remaining powers are computed
+ * together with BatchPowm.
+ *
+ * If cache is given, delta^q for delta <= cacheMax is read from it with
+ * mpz_inp_raw instead, as written by the table builds that cache it. If
+ * context is given, the powers it holds are used as they are, which saves
+ * the sieve.
+ *
+ * If memory runs out every power is computed with mpz_powm, so next always
+ * works.
+ */
+class DeltaPowerStream {
+    private:
+        bool mallocError;
+        ElgamalCryptosystem *e;
+        MontgomeryContext *mont;
+        BatchPowm *batch;
+        mp_limb_t *powers;      // the current chunk, if it is above sieveLimit
+        mp_limb_t *sieved;      // delta^q for delta <= sieveLimit, at delta - 1
+        uint16_t *spf;
+        unsigned long sieveLimit;
+        const mp_limb_t *preloaded;   // delta^q for delta <= preloadedMax, at delta - 1
+        unsigned long preloadedMax;
+        unsigned long *bases;   // deltas of the chunk which need powm
+        mpz_t *results;
+        const mp_limb_t *chunk;
+        unsigned long first;    // delta for chunk[0]
+        size_t length, position;
+        unsigned long last;
+        FILE *cache;
+        unsigned long cacheMax;
+
+        void fill ();
+
+    public:
+        DeltaPowerStream (ElgamalCryptosystem *e, unsigned long last,
+                          FILE *cache=NULL, unsigned long cacheMax=0,
+                          AttackContext *context=NULL);
+        ~DeltaPowerStream ();
+
+        bool hasMallocError () { return mallocError; }
+        MontgomeryContext *getContext () { return mont; }
+
+        // The next chunk of powers in Montgomery form, for deltas *first to
+        // *first + *length - 1. Returns NULL after last, or on a malloc
+        // error.
+        const mp_limb_t *nextChunk (unsigned long *first, size_t *length);
+
+        // Sets delta and power = delta^q for the next delta, returns false
+        // after delta = last.
+        bool next (mpz_t delta, mpz_t power);
+};
+
+/*
+ * The online phase of the meet in the middle attacks looks for
+ * target = u^q / delta2^q mod p in the table, for delta2 = 1 to 2^bits2.
+ * This produces the targets in order from a DeltaPowerStream, and inverts
+ * each chunk with a single modular inversion.
+ *
+ * Given several u^q the stream serves them all from one sweep: the powers
+ * and the inversion are shared, and each target costs one multiplication.
+ */
+class MimTargetStream {
+    private:
+        DeltaPowerStream powers;
+        ElgamalCryptosystem *e;
+        MontgomeryContext *mont;
+        mpz_srcptr uqValues;    // count of them
+        size_t count;
+        mp_limb_t *uq;          // u^q in Montgomery form, count of them
+        mp_limb_t *inverses;
+        mp_limb_t *scratch;
+        const mp_limb_t *current;   // inverse of delta2^q for the current delta2
+        mpz_t inverse;          // the same, if memory ran out
+        unsigned long first;
+        size_t length, position;
+
+        void init (mpz_srcptr uqs, size_t count);
+
+    public:
+        MimTargetStream (ElgamalCryptosystem *e, mpz_t uq, unsigned long last,
+                         FILE *cache=NULL, unsigned long cacheMax=0,
+                         AttackContext *context=NULL);
+        // for uqs[0] to uqs[count - 1]
+        MimTargetStream (ElgamalCryptosystem *e, const mpz_t *uqs, size_t count,
+                         unsigned long last, AttackContext *context=NULL);
+        ~MimTargetStream ();
+
+        // Sets delta2 and target for the next delta2, returns false after
+        // delta2 = last.
+        bool next (mpz_t delta2, mpz_t target);
+
+        // Moves to the next delta2 and sets it, returns false after
+        // delta2 = last. Then target gives the target of uqs[i].
+        bool next (mpz_t delta2);
+        void target (mpz_t target, size_t i);
+};
+
+/*
+ * crackMessages calls this for each result as soon as it is found, with
+ * the index of the ciphertext in cts and arg as given. The same result may
+ * come more than once, from different splits. In between it calls it with
+ * result NULL every MIM_DELTA_CHUNK deltas or so, so that the caller can
+ * do other work. Returning false ends the sweep early.
+ */
+typedef bool (*CrackResultCallback) (void *arg, size_t index, mpz_t result);
+
 class ElgamalAttack {
     protected:
         unsigned int bits1, bits2;
         ElgamalCryptosystem *e;
+        AttackContext *context;     // may be NULL
 
     public:
+        ElgamalAttack () { context = NULL; }
         virtual ~ElgamalAttack () {}
 
+        // Saved values for e to use instead of computing them, which must
+        // be set before buildTable and outlive the attack.
+        void setContext (AttackContext *context) { this->context = context; }
+
         // return false if the table build failed, e.g. not enough memory
         virtual bool buildTable (gmp_randstate_t rstate) = 0;
 
+        // true if buildTable opened a table left by an earlier run instead
+        virtual bool reusedTable () { return false; }
+
         virtual bool crackMessage (mpz_t result, const ElgamalCipherText ct, gmp_randstate_t rstate);
         virtual size_t crackMessage (MpzList *results, const ElgamalCipherText ct,
                                      gmp_randstate_t rstate, size_t maxResults=0);
+
+        // Crack cts[0] to cts[count - 1], passing every result which checks
+        // against u^q to found, and return how many there were. This cracks
+        // one ciphertext after the other, checking in with found between
+        // them; the attacks which sweep delta2 over a table in memory share
+        // one sweep between them all.
+        virtual size_t crackMessages (const ElgamalCipherText *cts, size_t count,
+                                      gmp_randstate_t rstate,
+                                      CrackResultCallback found, void *arg);
         virtual const char* getAttackName () const = 0; 
 };
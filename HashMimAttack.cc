@@ -71,12 +71,12 @@ static inline UIntType hash (mpz_t n) {
  */
 bool HashMimAttack::buildTable (gmp_randstate_t rstate) {
 
-    if (bits1 > sizeof (UIntType)) {
+    if (bits1 > sizeof (UIntType) * 8) {
         return false;
     }
 
     table.length = (1l << bits1); // table will contain range 1 to 2^bits1 as values
-    if (bits1 == sizeof (UIntType)) {
+    if (bits1 == sizeof (UIntType) * 8) {
         // Avoid overflow of the last element. This very slightly reduces the search space
         // and success propability.
         table.length--;
@@ -94,14 +94,13 @@ bool HashMimAttack::buildTable (gmp_randstate_t rstate) {
     mpz_init (tmp);
 
     printf ("Generating table...\n");
+    DeltaPowerStream powers (e, table.length, NULL, 0, context);
     // as i goes from 0 to 2^bits1 - 1, delta1 goes from 1 to 2^bits1
     for (size_t i = 0; i < table.length; i++) {
-        mpz_add_ui (delta1, delta1, 1);
+        powers.next (delta1, tmp);
 
         table.entries[i].value = (UIntType) mpz_get_ui (delta1);
 
-        mpz_powm (tmp, delta1, e->baseOrder, e->prime);
-
         table.entries[i].key = hash (tmp);
     }
     printf (" done generating table.\n");
@@ -154,6 +153,48 @@ static bool uintTableBinarySearch (size_t *index, UIntTable *table, unsigned lon
     return false;
 }
 
+/*
+ * Look for target among the table entries with its hash. Those are only
+ * candidates, since different targets can share a hash, so each is checked
+ * with a powm, working out from the one the search found to its neighbors.
+ */
+bool HashMimAttack::findDelta1 (UIntType *delta1, mpz_t target, mpz_t candidate,
+                                size_t *matchCount) {
+    unsigned long targetHash = hash (target);
+    size_t startIndex, currentIndex;
+    if (!uintTableBinarySearch (&startIndex, &table, targetHash))
+        return false;
+
+    currentIndex = startIndex;
+    int increment = -1; // search left first
+    while (1) {
+        if (table.entries[currentIndex].key != targetHash) {
+            // If we've been search lefting, start searching right.
+            if (currentIndex < startIndex) {
+                currentIndex = startIndex + 1;
+                increment = 1;
+                if (currentIndex >= table.length)
+                    return false;
+            } else { // We already searched left and right, give up.
+                return false;
+            }
+        } else {
+            (*matchCount)++;
+            mpz_set_ui (candidate, table.entries[currentIndex].value);
+            mpz_powm (candidate, candidate, e->baseOrder, e->prime);
+            if (mpz_cmp (target, candidate) == 0) {
+                *delta1 = table.entries[currentIndex].value;
+                return true;
+            }
+            if (currentIndex == 0 && increment < 0)
+                return false;
+            currentIndex += increment;
+            if (currentIndex >= table.length)
+                return false;
+        }
+    }
+}
+
 /*
  * Note: This assumes that the message decomposition is unique. In reality,
  * we could sanity check the result and keep checking if necessary,
@@ -179,63 +220,17 @@ size_t HashMimAttack::crackMessage (MpzList *results, const ElgamalCipherText ct
     size_t max = (1l << bits2);
 
     size_t matchCount = 0;
-    unsigned long targetHash, candidateHash;
-    size_t startIndex, currentIndex;
-    bool found;
-    while (mpz_cmp_ui (delta2, max) < 0) {
-        mpz_add_ui (delta2, delta2, 1);
-        //gmp_printf ("delta2 = %Zd\n", delta2);
-        mpz_powm (target, delta2, e->baseOrder, e->prime);
-        mpz_invert (target, target, e->prime);
-        mpz_mul (target, target, uq);
-        mpz_mod (target, target, e->prime);
-        targetHash = hash (target);
-
-        //gmp_printf (" ...looking for %Zd\n", target.key);
-
-        // If an entry is found, it's only a candidate, since we are using hashes.
-        // Check to see if it really matches, and check neighbors if that fails.
-        if (uintTableBinarySearch (&startIndex, &table, targetHash)) {
-            currentIndex = startIndex;
-            int increment = -1; // search left first
-            found = false;
-            while (1) {
-                candidateHash = table.entries[currentIndex].key;
-                if (candidateHash != targetHash) {
-                    // If we've been search lefting, start searching right.
-                    if (currentIndex < startIndex) {
-                        currentIndex = startIndex + 1;
-                        increment = 1;
-                        if (currentIndex >= table.length)
-                            break;
-                    } else { // We already searched left and right, give up.
-                        break;
-                    }
-                } else {
-                    matchCount++;
-                    mpz_set_ui (candidate, table.entries[currentIndex].value);
-                    mpz_powm (candidate, candidate, e->baseOrder, e->prime);
-                    if (mpz_cmp (target, candidate) == 0) {
-                        found = true;
-                        break;
-                    }
-                    if (currentIndex == 0 && increment < 0)
-                        break;
-                    currentIndex += increment;
-                    if (currentIndex >= table.length)
-                        break;
-                }
-            }
-
-            if (found) {
-                mpz_mul_ui (delta, delta2, table.entries[currentIndex].value);
-                //gmp_printf ("DEBUG: results[%zu] = %u * %Zd\n", resultCount,
-                //            table.entries[currentIndex].value, delta2);
-                results->append (delta);
-                resultCount++;
-                if (maxResults > 0 && resultCount >= maxResults)
-                    break;
-            }
+    UIntType delta1;
+    MimTargetStream targets (e, uq, max, NULL, 0, context);
+    while (targets.next (delta2, target)) {
+        if (findDelta1 (&delta1, target, candidate, &matchCount)) {
+            mpz_mul_ui (delta, delta2, delta1);
+            //gmp_printf ("DEBUG: results[%zu] = %u * %Zd\n", resultCount,
+            //            delta1, delta2);
+            results->append (delta);
+            resultCount++;
+            if (maxResults > 0 && resultCount >= maxResults)
+                break;
         }
     }
 
@@ -250,3 +245,53 @@ size_t HashMimAttack::crackMessage (MpzList *results, const ElgamalCipherText ct
     return resultCount;
 
 }
+
+// one sweep over delta2 for all of cts, see ElgamalAttack::crackMessages
+size_t HashMimAttack::crackMessages (const ElgamalCipherText *cts, size_t count,
+                                     gmp_randstate_t rstate,
+                                     CrackResultCallback found, void *arg) {
+    if (count == 0)
+        return 0;
+
+    mpz_t *uqs = (mpz_t *) malloc (count * sizeof (mpz_t));
+    if (uqs == NULL)
+        return ElgamalAttack::crackMessages (cts, count, rstate, found, arg);
+    for (size_t i=0; i < count; i++) {
+        mpz_init (uqs[i]);
+        mpz_powm (uqs[i], cts[i].myk, e->baseOrder, e->prime);
+    }
+
+    mpz_t delta2, target, candidate, delta;
+    mpz_init (delta2);
+    mpz_init (target);
+    mpz_init (candidate);
+    mpz_init (delta);
+
+    size_t resultCount = 0;
+    size_t matchCount = 0;
+    bool going = true;
+    UIntType delta1;
+    MimTargetStream targets (e, uqs, count, (1ul << bits2), context);
+    for (unsigned long d=1; going && targets.next (delta2); d++) {
+        for (size_t i=0; going && i < count; i++) {
+            targets.target (target, i);
+            if (findDelta1 (&delta1, target, candidate, &matchCount)) {
+                mpz_mul_ui (delta, delta2, delta1);
+                going = found (arg, i, delta);
+                resultCount++;
+            }
+        }
+        if (going && d % MIM_DELTA_CHUNK == 0)
+            going = found (arg, 0, NULL);
+    }
+
+    mpz_clear (target);
+    mpz_clear (candidate);
+    mpz_clear (delta);
+    mpz_clear (delta2);
+    for (size_t i=0; i < count; i++)
+        mpz_clear (uqs[i]);
+    free (uqs);
+
+    return resultCount;
+}
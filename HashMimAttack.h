@@ -22,11 +22,16 @@ class HashMimAttack : public ElgamalAttack {
     private:
         UIntTable table;
 
+        bool findDelta1 (UIntType *delta1, mpz_t target, mpz_t candidate, size_t *matchCount);
+
     public:
         HashMimAttack (ElgamalCryptosystem *c, unsigned int bits1, unsigned int bits2);
         ~HashMimAttack ();
         bool buildTable (gmp_randstate_t rstate);
         size_t crackMessage (MpzList *results, ElgamalCipherText ct, gmp_randstate_t rstate, size_t maxResults=0);
+        size_t crackMessages (const ElgamalCipherText *cts, size_t count,
+                              gmp_randstate_t rstate,
+                              CrackResultCallback found, void *arg);
         const char* getAttackName () const { return "hashmim"; }
         
 };
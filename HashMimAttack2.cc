@@ -58,7 +58,7 @@ static inline UIntType hash (mpz_t n) {
  */
 bool HashMimAttack2::buildTable (gmp_randstate_t rstate) {
 
-    if (bits1 > sizeof (UIntType)) {
+    if (bits1 > sizeof (UIntType) * 8) {
         return false;
     }
 
@@ -69,7 +69,7 @@ bool HashMimAttack2::buildTable (gmp_randstate_t rstate) {
     }
 
     table.length = (1l << bits1); // table will contain range 1 to 2^bits1 as values
-    if (bits1 == sizeof (UIntType)) {
+    if (bits1 == sizeof (UIntType) * 8) {
         // Avoid overflow of the last element. This very slightly reduces the search space
         // and success propability.
         table.length--;
@@ -88,14 +88,13 @@ bool HashMimAttack2::buildTable (gmp_randstate_t rstate) {
     mpz_init (tmp);
 
     printf ("Generating table...\n");
+    DeltaPowerStream powers (e, table.length, NULL, 0, context);
     // as i goes from 0 to 2^bits1 - 1, delta1 goes from 1 to 2^bits1
     for (size_t i = 0; i < table.length; i++) {
-        mpz_add_ui (delta1, delta1, 1);
+        powers.next (delta1, tmp);
 
         table.entries[i].value = (UIntType) mpz_get_ui (delta1);
 
-        mpz_powm (tmp, delta1, e->baseOrder, e->prime);
-
         if (!mpz_out_raw (cache, tmp)) {
             fprintf (stderr, "Write failed at %zu\n", i);
         }
@@ -192,20 +191,8 @@ size_t HashMimAttack2::crackMessage (MpzList *results, const ElgamalCipherText c
     unsigned long targetHash, candidateHash;
     size_t startIndex, currentIndex;
     bool found;
-    while (mpz_cmp_ui (delta2, max) < 0) {
-        mpz_add_ui (delta2, delta2, 1);
-        //gmp_printf ("delta2 = %Zd\n", delta2);
-        if (mpz_cmp_ui (delta2, maxTable) <= 0) {
-            if (!mpz_inp_raw (target, cache)) {
-                gmp_fprintf (stderr, "Unable to read from cache at %Zd\n", delta2);
-                mpz_powm (target, delta2, e->baseOrder, e->prime);
-            }
-        } else {
-            mpz_powm (target, delta2, e->baseOrder, e->prime);
-        }
-        mpz_invert (target, target, e->prime);
-        mpz_mul (target, target, uq);
-        mpz_mod (target, target, e->prime);
+    MimTargetStream targets (e, uq, max, cache, maxTable, context);
+    while (targets.next (delta2, target)) {
         targetHash = hash (target);
 
         //gmp_printf (" ...looking for %Zd\n", target.key);
@@ -73,11 +73,10 @@ bool HashMimAttack4::buildTable (gmp_randstate_t rstate) {
 
     UIntType keyHash;
     UIntType index;
+    DeltaPowerStream powers (e, table.length, NULL, 0, context);
     // as i goes from 0 to 2^bits1 - 1, delta1 goes from 1 to 2^bits1
     for (size_t i = 0; i < table.length; i++) {
-        mpz_add_ui (delta1, delta1, 1);
-
-        mpz_powm (tmp, delta1, e->baseOrder, e->prime);
+        powers.next (delta1, tmp);
         keyHash = hash (tmp); // range 0 to 2^sizeof(UIntType)-1
         index = (keyHash & indexMask) + 1; // range 1 to 2^bits1
                                            //     = 1 to table.length-1
@@ -157,20 +156,8 @@ size_t HashMimAttack4::crackMessage (MpzList *results, const ElgamalCipherText c
     unsigned long targetHash;
     bool found;
     UIntType index;
-    while (mpz_cmp_ui (delta2, max) < 0) {
-        mpz_add_ui (delta2, delta2, 1);
-        //gmp_printf ("delta2 = %Zd\n", delta2);
-        if (mpz_cmp_ui (delta2, maxTable) <= 0) {
-            if (!mpz_inp_raw (target, cache)) {
-                gmp_fprintf (stderr, "Unable to read from cache at %Zd\n", delta2);
-                mpz_powm (target, delta2, e->baseOrder, e->prime);
-            }
-        } else {
-            mpz_powm (target, delta2, e->baseOrder, e->prime);
-        }
-        mpz_invert (target, target, e->prime);
-        mpz_mul (target, target, uq);
-        mpz_mod (target, target, e->prime);
+    MimTargetStream targets (e, uq, max, cache, maxTable, context);
+    while (targets.next (delta2, target)) {
         targetHash = hash (target); // range 0 to 2^sizeof(UIntType)-1
 
         // If an entry is found, it's only a candidate, since we are using hashes.
@@ -0,0 +1,427 @@
+/*
+ * Modification to HashMimAttack which replaces the sorted array with a
+ * minimal perfect hash function (BBHash style, see "Fast and scalable
+ * minimal perfect hashing for massive key sets" by Limasset, Rizk,
+ * Chikhi and Peterlongo).
+ *
+ * The table is static, so after the build it only has to answer
+ * queries. Each level of the function is a bit array; a key is placed on
+ * the first level where it does not collide with any other remaining
+ * key, and the rank of its bit is the index of its slot. Slots store only
+ * delta1 - 1 (bits1 bits) and a short fingerprint, which together with
+ * the function take roughly half the memory of the sorted (key, value)
+ * array used by HashMimAttack.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+#include <math.h>
+#include <time.h>
+
+#include "include/types.h"
+#include "include/randomhelpers.h"
+#include "include/elgamal.h"
+
+#include "MpzList.h"
+#include "ElgamalAttack.h"
+#include "HashMimAttack5.h"
+
+// Bits allocated per remaining key on each level. 1 gives about 3 bits per
+// key in total, larger values trade memory for fewer levels.
+#define MPHF_GAMMA 1.0
+
+// Set bits are counted in blocks of this many 64-bit words.
+#define MPHF_RANK_BLOCK_WORDS 8
+
+#define MPHF_FINGERPRINT_SEED 0x5bd1e9955bd1e995ull
+
+HashMimAttack5::HashMimAttack5 (ElgamalCryptosystem *elg, unsigned int b1, unsigned int b2) {
+    bits1 = b1;
+    bits2 = b2;
+    e = elg;
+    memset (&table, 0, sizeof (table));
+}
+
+HashMimAttack5::~HashMimAttack5 () {
+    if (table.bits != NULL)
+        free (table.bits);
+    if (table.ranks != NULL)
+        free (table.ranks);
+    if (table.slots != NULL)
+        free (table.slots);
+    if (table.fallback != NULL)
+        free (table.fallback);
+}
+
+/*
+ * Unlike the other hash attacks we use the low 64 bits of the residue,
+ * since keys have to be distinct for the perfect hash function.
+ */
+static inline uint64_t hash (mpz_t n) {
+#if GMP_LIMB_BITS >= 64
+    return (uint64_t) mpz_getlimbn (n, 0);
+#else
+    return ((uint64_t) mpz_getlimbn (n, 1) << 32) | mpz_getlimbn (n, 0);
+#endif
+}
+
+// splitmix64 finalizer
+static inline uint64_t mix (uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline size_t levelPosition (uint64_t key, unsigned int level, size_t size) {
+    return mix (key + (level + 1) * 0x9e3779b97f4a7c15ull) % size;
+}
+
+static inline UIntType fingerprint (uint64_t key) {
+    return (UIntType) (mix (key ^ MPHF_FINGERPRINT_SEED) >> (64 - MPHF_FINGERPRINT_BITS));
+}
+
+static inline bool testBit (const uint64_t *bits, size_t i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void setBit (uint64_t *bits, size_t i) {
+    bits[i >> 6] |= (1ull << (i & 63));
+}
+
+static inline size_t rank (const UIntPerfectHashTable *t, size_t i) {
+    size_t word = i >> 6;
+    size_t r = t->ranks[word / MPHF_RANK_BLOCK_WORDS];
+    for (size_t w = word - (word % MPHF_RANK_BLOCK_WORDS); w < word; w++) {
+        r += __builtin_popcountll (t->bits[w]);
+    }
+    return r + __builtin_popcountll (t->bits[word] & ((1ull << (i & 63)) - 1));
+}
+
+/*
+ * Slots are packed back to back and may straddle two words.
+ */
+static inline uint64_t getSlot (const UIntPerfectHashTable *t, size_t i) {
+    size_t bit = i * t->slotBits;
+    size_t word = bit >> 6;
+    unsigned int shift = bit & 63;
+    uint64_t v = t->slots[word] >> shift;
+    if (shift + t->slotBits > 64) {
+        v |= t->slots[word + 1] << (64 - shift);
+    }
+    return v & ((1ull << t->slotBits) - 1);
+}
+
+static inline void setSlot (UIntPerfectHashTable *t, size_t i, uint64_t v) {
+    size_t bit = i * t->slotBits;
+    size_t word = bit >> 6;
+    unsigned int shift = bit & 63;
+    t->slots[word] |= v << shift;
+    if (shift + t->slotBits > 64) {
+        t->slots[word + 1] |= v >> (64 - shift);
+    }
+}
+
+/*
+ * Return true and set slot if key was placed on some level. Keys which are
+ * not in the table either land on an arbitrary slot or fall through to the
+ * fallback array.
+ */
+static inline bool perfectHashLookup (size_t *slot, const UIntPerfectHashTable *t, uint64_t key) {
+    size_t pos;
+    for (unsigned int level = 0; level < t->nLevels; level++) {
+        pos = t->levelOffset[level] + levelPosition (key, level, t->levelSize[level]);
+        if (testBit (t->bits, pos)) {
+            *slot = rank (t, pos);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int uint64TableEntryCompare (const void *a, const void *b) {
+    uint64_t au = ((UInt64TableEntry *)a)->key;
+    uint64_t bu = ((UInt64TableEntry *)b)->key;
+    if (au < bu)
+        return -1;
+    if (au > bu)
+        return 1;
+    return 0;
+}
+
+/*
+ * Build the levels of the perfect hash function over keys. Keys which
+ * collide on every level are returned in remaining/nRemaining.
+ */
+static bool buildLevels (UIntPerfectHashTable *t, const uint64_t *keys,
+                         uint32_t *remaining, size_t *nRemaining) {
+
+    uint32_t *next = (uint32_t *) malloc (*nRemaining * sizeof (*next));
+    if (next == NULL) {
+        return false;
+    }
+
+    size_t totalWords = 0;
+    size_t n = *nRemaining;
+    t->nLevels = 0;
+    t->levelOffset[0] = 0;
+    while (n > 0 && t->nLevels < MPHF_MAX_LEVELS) {
+        unsigned int level = t->nLevels;
+        size_t words = ((size_t) ceil (MPHF_GAMMA * n) + 63) / 64;
+        size_t size = words * 64;
+
+        uint64_t *newBits = (uint64_t *) realloc (t->bits, (totalWords + words) * sizeof (*newBits));
+        uint64_t *collisions = (uint64_t *) calloc (words, sizeof (*collisions));
+        if (newBits == NULL || collisions == NULL) {
+            if (newBits != NULL)
+                t->bits = newBits;
+            free (collisions);
+            free (next);
+            return false;
+        }
+        t->bits = newBits;
+        uint64_t *bits = t->bits + totalWords;
+        memset (bits, 0, words * sizeof (*bits));
+
+        size_t pos;
+        for (size_t i = 0; i < n; i++) {
+            pos = levelPosition (keys[remaining[i]], level, size);
+            if (testBit (bits, pos))
+                setBit (collisions, pos);
+            else
+                setBit (bits, pos);
+        }
+        for (size_t w = 0; w < words; w++) {
+            bits[w] &= ~collisions[w];
+        }
+
+        // keys which collided move on to the next level
+        size_t nNext = 0;
+        for (size_t i = 0; i < n; i++) {
+            pos = levelPosition (keys[remaining[i]], level, size);
+            if (testBit (collisions, pos))
+                next[nNext++] = remaining[i];
+        }
+        free (collisions);
+
+        memcpy (remaining, next, nNext * sizeof (*remaining));
+        n = nNext;
+
+        t->levelSize[level] = size;
+        totalWords += words;
+        t->nLevels++;
+        t->levelOffset[t->nLevels] = totalWords * 64;
+    }
+    free (next);
+
+    // one extra block so rank never reads past the end
+    size_t nBlocks = totalWords / MPHF_RANK_BLOCK_WORDS + 1;
+    t->ranks = (uint64_t *) malloc (nBlocks * sizeof (*(t->ranks)));
+    if (t->ranks == NULL) {
+        return false;
+    }
+    uint64_t count = 0;
+    for (size_t w = 0; w < totalWords; w++) {
+        if (w % MPHF_RANK_BLOCK_WORDS == 0)
+            t->ranks[w / MPHF_RANK_BLOCK_WORDS] = count;
+        count += __builtin_popcountll (t->bits[w]);
+    }
+    if (totalWords % MPHF_RANK_BLOCK_WORDS == 0)
+        t->ranks[totalWords / MPHF_RANK_BLOCK_WORDS] = count;
+    t->slotCount = count;
+
+    *nRemaining = n;
+    return true;
+}
+
+/*
+ * Build a minimal perfect hash function over key = hash (delta1^q mod p),
+ * and store delta1 in the slot for its key.
+ */
+bool HashMimAttack5::buildTable (gmp_randstate_t rstate) {
+
+    if (bits1 > sizeof (UIntType) * 8) {
+        return false;
+    }
+
+    table.length = (1l << bits1); // table will contain range 1 to 2^bits1 as values
+    if (bits1 == sizeof (UIntType) * 8) {
+        // Avoid overflow of the last element. This very slightly reduces the search space
+        // and success propability.
+        table.length--;
+    }
+    table.slotBits = bits1 + MPHF_FINGERPRINT_BITS;
+
+    uint64_t *keys = (uint64_t *) malloc (table.length * sizeof (*keys));
+    uint32_t *remaining = (uint32_t *) malloc (table.length * sizeof (*remaining));
+    if (keys == NULL || remaining == NULL) {
+        free (keys);
+        free (remaining);
+        return false;
+    }
+
+    mpz_t delta1;
+    mpz_t tmp;
+
+    mpz_init_set_ui (delta1, 0);
+    mpz_init (tmp);
+
+    printf ("Generating table...\n");
+    DeltaPowerStream powers (e, table.length, NULL, 0, context);
+    // as i goes from 0 to 2^bits1 - 1, delta1 goes from 1 to 2^bits1
+    for (size_t i = 0; i < table.length; i++) {
+        powers.next (delta1, tmp);
+        keys[i] = hash (tmp);
+        remaining[i] = i;
+    }
+    printf (" done generating table.\n");
+
+    mpz_clear (tmp);
+    mpz_clear (delta1);
+
+    time_t start = time (NULL);
+
+    size_t nRemaining = table.length;
+    bool success = buildLevels (&table, keys, remaining, &nRemaining);
+
+    if (success) {
+        table.slots = (uint64_t *) calloc ((table.slotCount * table.slotBits) / 64 + 1,
+                                           sizeof (*(table.slots)));
+        table.fallbackLength = nRemaining;
+        table.fallback = (UInt64TableEntry *) malloc ((nRemaining + 1) * sizeof (UInt64TableEntry));
+        success = (table.slots != NULL && table.fallback != NULL);
+    }
+
+    if (success) {
+        for (size_t i = 0; i < nRemaining; i++) {
+            table.fallback[i].key = keys[remaining[i]];
+            table.fallback[i].value = (UIntType) (remaining[i] + 1);
+        }
+        qsort (table.fallback, table.fallbackLength, sizeof (*(table.fallback)),
+               uint64TableEntryCompare);
+
+        size_t slot;
+        for (size_t i = 0; i < table.length; i++) {
+            if (perfectHashLookup (&slot, &table, keys[i])) {
+                setSlot (&table, slot, ((uint64_t) fingerprint (keys[i]) << bits1) | i);
+            }
+        }
+    }
+
+    free (keys);
+    free (remaining);
+
+    double diff = difftime (time (NULL), start);
+
+    if (success) {
+        size_t bytes = (table.levelOffset[table.nLevels] / 8)
+                     + (table.levelOffset[table.nLevels] / (64 * MPHF_RANK_BLOCK_WORDS) + 1) * 8
+                     + ((table.slotCount * table.slotBits) / 64 + 1) * 8
+                     + table.fallbackLength * sizeof (UInt64TableEntry);
+        printf ("perfect hash build time: %dm %ds : %ld\n", (int) floor (diff / 60),
+                                                            ((int)diff) % 60, (long)diff);
+        printf ("perfect hash: %u levels, %zu fallback keys, %.2f bits/key\n",
+                table.nLevels, table.fallbackLength, (bytes * 8.0) / table.length);
+    }
+
+    return success;
+
+}
+
+/*
+ * Check a candidate delta1 from the table against the target, returning true
+ * if delta1^q mod p == target.
+ */
+static inline bool verifyCandidate (mpz_t candidate, UIntType delta1, mpz_t target,
+                                    ElgamalCryptosystem *e) {
+    mpz_set_ui (candidate, delta1);
+    mpz_powm (candidate, candidate, e->baseOrder, e->prime);
+    return (mpz_cmp (target, candidate) == 0);
+}
+
+/*
+ * Every split whose delta1 passes the fingerprint and the exponentiation
+ * check is a result, up to maxResults.
+ */
+size_t HashMimAttack5::crackMessage (MpzList *results, const ElgamalCipherText ct,
+                                     gmp_randstate_t rstate, size_t maxResults) {
+
+    if (table.slots == NULL) {
+        return 0;
+    }
+
+    size_t resultCount = 0;
+
+    mpz_t delta2, uq, target, candidate, delta;
+    mpz_init_set_ui (delta2, 0);
+    mpz_init_set (uq, ct.myk);
+
+    mpz_powm (uq, uq, e->baseOrder, e->prime);
+
+    mpz_init (target);
+    mpz_init (candidate);
+    mpz_init (delta);
+    size_t max = (1l << bits2);
+
+    uint64_t targetHash, entry;
+    UIntType delta1 = 0;
+    UInt64TableEntry fallbackTarget;
+    UInt64TableEntry *fallbackEntry;
+    size_t slot;
+    bool found;
+    MimTargetStream targets (e, uq, max, NULL, 0, context);
+    while (targets.next (delta2, target)) {
+        targetHash = hash (target);
+
+        // The slot (or fallback entry) is only a candidate, since keys are not
+        // stored. Check the fingerprint first, then the real value.
+        found = false;
+        if (perfectHashLookup (&slot, &table, targetHash)) {
+            entry = getSlot (&table, slot);
+            if ((entry >> bits1) == fingerprint (targetHash)) {
+                delta1 = (UIntType) (entry & ((1ull << bits1) - 1)) + 1;
+                found = verifyCandidate (candidate, delta1, target, e);
+            }
+        } else if (table.fallbackLength > 0) {
+            fallbackTarget.key = targetHash;
+            fallbackEntry = (UInt64TableEntry *) bsearch (&fallbackTarget, table.fallback,
+                                                          table.fallbackLength,
+                                                          sizeof (*(table.fallback)),
+                                                          uint64TableEntryCompare);
+            if (fallbackEntry != NULL) {
+                // duplicate keys are adjacent, back up to the first one
+                while (fallbackEntry > table.fallback && (fallbackEntry - 1)->key == targetHash)
+                    fallbackEntry--;
+                while (fallbackEntry < table.fallback + table.fallbackLength
+                       && fallbackEntry->key == targetHash) {
+                    delta1 = fallbackEntry->value;
+                    if (verifyCandidate (candidate, delta1, target, e)) {
+                        found = true;
+                        break;
+                    }
+                    fallbackEntry++;
+                }
+            }
+        }
+
+        if (found) {
+            mpz_mul_ui (delta, delta2, delta1);
+            results->append (delta);
+            resultCount++;
+            if (maxResults > 0 && resultCount >= maxResults)
+                break;
+        }
+    }
+
+    mpz_clear (target);
+    mpz_clear (candidate);
+    mpz_clear (delta);
+    mpz_clear (delta2);
+    mpz_clear (uq);
+
+    return resultCount;
+
+}
@@ -0,0 +1,49 @@
+/*
+ * Modification to HashMimAttack which replaces the sorted array with
+ * a minimal perfect hash function over the table keys.
+ */
+#include "include/types.h"
+
+// Keys which still collide after the last level are kept in a small sorted
+// fallback array.
+#define MPHF_MAX_LEVELS 32
+
+// The slots do not store keys, so a few bits of a second hash are kept to
+// reject most lookups of keys which are not in the table without having to
+// compute an exponentiation.
+#define MPHF_FINGERPRINT_BITS 8
+
+typedef struct {
+    uint64_t key;
+    UIntType value;
+} UInt64TableEntry;
+
+typedef struct {
+    size_t length;              // number of keys the function was built over
+    unsigned int nLevels;
+    size_t levelOffset[MPHF_MAX_LEVELS + 1]; // first bit of each level in bits
+    size_t levelSize[MPHF_MAX_LEVELS];       // number of bits in each level
+    uint64_t *bits;             // concatenated level bit arrays
+    uint64_t *ranks;            // number of set bits before each rank block
+
+    unsigned int slotBits;      // bits per slot, delta1 - 1 plus a fingerprint
+    size_t slotCount;
+    uint64_t *slots;            // packed slot array, indexed by rank
+
+    size_t fallbackLength;      // keys that collided on every level
+    UInt64TableEntry *fallback; // sorted on key
+} UIntPerfectHashTable;
+
+class HashMimAttack5 : public ElgamalAttack {
+
+    private:
+        UIntPerfectHashTable table;
+
+    public:
+        HashMimAttack5 (ElgamalCryptosystem *c, unsigned int bits1, unsigned int bits2);
+        ~HashMimAttack5 ();
+        bool buildTable (gmp_randstate_t rstate);
+        size_t crackMessage (MpzList *results, ElgamalCipherText ct, gmp_randstate_t rstate, size_t maxResults=0);
+        const char* getAttackName () const { return "hashmim5"; }
+
+};
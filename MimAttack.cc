@@ -75,12 +75,11 @@ bool MimAttack::buildTable (gmp_randstate_t rstate) {
     mpz_init (tmp);
 
     //printf ("Generating table...\n");
+    DeltaPowerStream powers (e, table->length, NULL, 0, context);
     for (size_t i = 0; i < table->length; i++) {
-        mpz_add_ui (delta1, delta1, 1);
         mpz_init (table->entries[i].key);
+        powers.next (delta1, table->entries[i].key);
         mpz_init_set (table->entries[i].value, delta1);
-
-        mpz_powm (table->entries[i].key, delta1, e->baseOrder, e->prime);
     }
     //printf (" done generating table.\n");
 
@@ -126,13 +125,8 @@ size_t MimAttack::crackMessage (MpzList *results, const ElgamalCipherText ct,
     //printTable (table);
 
     MpzTableEntry *entry = NULL;
-    while (mpz_cmp_ui (delta2, max) < 0) {
-        mpz_add_ui (delta2, delta2, 1);
-        //gmp_printf ("delta2 = %Zd\n", delta2);
-        mpz_powm (target.key, delta2, e->baseOrder, e->prime);
-        mpz_invert (target.key, target.key, e->prime);
-        mpz_mul (target.key, target.key, uq);
-        mpz_mod (target.key, target.key, e->prime);
+    MimTargetStream targets (e, uq, max, NULL, 0, context);
+    while (targets.next (delta2, target.key)) {
 
         //gmp_printf (" ...looking for %Zd\n", target.key);
 
@@ -155,3 +149,54 @@ size_t MimAttack::crackMessage (MpzList *results, const ElgamalCipherText ct,
 
     return resultCount;
 }
+
+// one sweep over delta2 for all of cts, see ElgamalAttack::crackMessages
+size_t MimAttack::crackMessages (const ElgamalCipherText *cts, size_t count,
+                                 gmp_randstate_t rstate,
+                                 CrackResultCallback found, void *arg) {
+    if (table == NULL || count == 0)
+        return 0;
+
+    mpz_t *uqs = (mpz_t *) malloc (count * sizeof (mpz_t));
+    if (uqs == NULL)
+        return ElgamalAttack::crackMessages (cts, count, rstate, found, arg);
+    for (size_t i=0; i < count; i++) {
+        mpz_init (uqs[i]);
+        mpz_powm (uqs[i], cts[i].myk, e->baseOrder, e->prime);
+    }
+
+    mpz_t delta2, result;
+    mpz_init (delta2);
+    mpz_init (result);
+    MpzTableEntry target;
+    mpz_init (target.key);
+
+    // the keys are the full delta1^q, so every hit is a result
+    size_t resultCount = 0;
+    bool going = true;
+    MpzTableEntry *entry;
+    MimTargetStream targets (e, uqs, count, (1ul << bits2), context);
+    for (unsigned long d=1; going && targets.next (delta2); d++) {
+        for (size_t i=0; going && i < count; i++) {
+            targets.target (target.key, i);
+            entry = (MpzTableEntry *)bsearch (&target, table->entries, table->length,
+                                              sizeof(*(table->entries)), mpzTableEntryCompare);
+            if (entry != NULL) {
+                mpz_mul (result, entry->value, delta2);
+                going = found (arg, i, result);
+                resultCount++;
+            }
+        }
+        if (going && d % MIM_DELTA_CHUNK == 0)
+            going = found (arg, 0, NULL);
+    }
+
+    mpz_clear (target.key);
+    mpz_clear (delta2);
+    mpz_clear (result);
+    for (size_t i=0; i < count; i++)
+        mpz_clear (uqs[i]);
+    free (uqs);
+
+    return resultCount;
+}
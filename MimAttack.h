@@ -26,6 +26,9 @@ class MimAttack : public ElgamalAttack {
         bool buildTable (gmp_randstate_t rstate);
         size_t crackMessage (MpzList *results, const ElgamalCipherText ct,
                              gmp_randstate_t rstate, size_t maxResults=0);
+        size_t crackMessages (const ElgamalCipherText *cts, size_t count,
+                              gmp_randstate_t rstate,
+                              CrackResultCallback found, void *arg);
         const char* getAttackName () const { return "mim"; } 
 
 };
@@ -18,9 +18,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <gmp.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "include/types.h"
 #include "include/randomhelpers.h"
@@ -30,6 +33,7 @@
 #include "MpzList.h"
 #include "ElgamalAttack.h"
 #include "TwoTableAttack.h"
+#include "AttackContext.h"
 
 static inline size_t circularIncrement (size_t i, int inc, size_t n) {
     if (i == 0 && inc < 0) {
@@ -40,16 +44,149 @@ static inline size_t circularIncrement (size_t i, int inc, size_t n) {
     return i + inc;
 }
 
+/*
+ * LSD radix sort of the keys of table in increasing order, moving the values
+ * along with them. Only the low keyBits bits of the keys are looked at.
+ */
+static bool radixSortUInt64Table (UInt64Table *table, unsigned int keyBits) {
+    size_t n = table->length;
+    uint64_t *keys = (uint64_t *) malloc (n * sizeof (uint64_t));
+    UIntType *values = (UIntType *) malloc (n * sizeof (UIntType));
+    if (keys == NULL || values == NULL) {
+        if (keys != NULL)
+            free (keys);
+        if (values != NULL)
+            free (values);
+        return false;
+    }
+
+    uint64_t *srcKeys = table->keys, *dstKeys = keys;
+    UIntType *srcValues = table->values, *dstValues = values;
+    size_t counts[256];
+
+    for (unsigned int shift=0; shift < keyBits; shift += 8) {
+        for (unsigned int d=0; d < 256; d++)
+            counts[d] = 0;
+        for (size_t i=0; i < n; i++)
+            counts[(srcKeys[i] >> shift) & 0xff]++;
+
+        // skip digits which are the same for every key
+        if (counts[(srcKeys[0] >> shift) & 0xff] == n)
+            continue;
+
+        size_t sum = 0;
+        for (unsigned int d=0; d < 256; d++) {
+            size_t c = counts[d];
+            counts[d] = sum;
+            sum += c;
+        }
+        for (size_t i=0; i < n; i++) {
+            size_t j = counts[(srcKeys[i] >> shift) & 0xff]++;
+            dstKeys[j] = srcKeys[i];
+            dstValues[j] = srcValues[i];
+        }
+
+        uint64_t *tk = srcKeys; srcKeys = dstKeys; dstKeys = tk;
+        UIntType *tv = srcValues; srcValues = dstValues; dstValues = tv;
+    }
+
+    // whichever pair of arrays is not holding the result is freed
+    table->keys = srcKeys;
+    table->values = srcValues;
+    free (dstKeys);
+    free (dstValues);
+    return true;
+}
+
+/*
+ * Index of the first key in table (sorted ASC) which is greater than value,
+ * or table.length if there is none.
+ */
+static size_t uint64TableUpperBound (UInt64Table table, uint64_t value) {
+    size_t m = 0, M = table.length;
+    while (m < M) {
+        size_t i = m + (M - m) / 2;
+        if (table.keys[i] <= value)
+            m = i + 1;
+        else
+            M = i;
+    }
+    return m;
+}
+
+/*
+ * Prime deltas waiting for their logs, with gammas[k] = deltas[k]^z.
+ */
+typedef struct {
+    size_t count;
+    size_t deltas[TWOTABLE_LOG_BATCH];
+    mpz_t gammas[TWOTABLE_LOG_BATCH];
+    mpz_t logs[TWOTABLE_LOG_BATCH];
+} DeltaLogBatch;
+
+static void initDeltaLogBatch (DeltaLogBatch *batch, mpz_t prime) {
+    batch->count = 0;
+    for (size_t k=0; k < TWOTABLE_LOG_BATCH; k++) {
+        mpz_init2 (batch->gammas[k], mpz_sizeinbase (prime, 2));
+        mpz_init (batch->logs[k]);
+    }
+}
+
+static void clearDeltaLogBatch (DeltaLogBatch *batch) {
+    for (size_t k=0; k < TWOTABLE_LOG_BATCH; k++) {
+        mpz_clear (batch->gammas[k]);
+        mpz_clear (batch->logs[k]);
+    }
+}
+
+static inline void addDelta (DeltaLogBatch *batch, size_t d, mpz_t z, mpz_t prime) {
+    size_t k = batch->count++;
+    batch->deltas[k] = d;
+    mpz_set_ui (batch->gammas[k], d);
+    mpz_powm (batch->gammas[k], batch->gammas[k], z, prime);
+}
+
 TwoTableAttack::TwoTableAttack (ElgamalCryptosystem *elg, unsigned int b1,
-                                unsigned int b2) {
+                                unsigned int b2, unsigned int nThreads) {
     bits1 = b1;
     bits2 = b2;
     e = elg;
 
+    if (nThreads == 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        nThreads = (online > 0) ? online : 1;
+    }
+    threads = nThreads;
+
     oneTable = (bits1 == bits2);
 
     t1.length = (1l << bits1);
     t2.length = (1l << bits2);
+    t1.entries = NULL;
+    t2.entries = NULL;
+
+    // deltas are stored in a UIntType
+    nativeKeys = (mpz_sizeinbase (e->s->value, 2) <= 64
+                  && bits1 < 32 && bits2 < 32);
+    n1.length = t1.length;
+    n2.length = t2.length;
+    n1.keys = n2.keys = NULL;
+    n1.values = n2.values = NULL;
+    built = false;
+
+    // left until buildTable, so that a context set after the constructor
+    // can provide it
+    ph = NULL;
+}
+
+PohligHellmanContext *TwoTableAttack::usePH () {
+    if (ph == NULL) {
+        if (context != NULL)
+            ph = context->newPohligHellman ();
+        else
+            ph = new PohligHellmanContext (e->sGenerator, e->prime, e->s);
+    }
+    return ph;
 }
 
 
@@ -63,14 +200,43 @@ static void deleteTableEntries (MpzTable table) {
     }
 }
 
+static void deleteNativeTable (UInt64Table table) {
+    if (table.keys != NULL)
+        free (table.keys);
+    if (table.values != NULL)
+        free (table.values);
+}
+
 TwoTableAttack::~TwoTableAttack () {
     deleteTableEntries (t1);   
     if (!oneTable)
         deleteTableEntries (t2);   
+    deleteNativeTable (n1);
+    if (!oneTable)
+        deleteNativeTable (n2);
+    delete ph;
 }
 
 bool TwoTableAttack::buildTable (gmp_randstate_t rstate) {
 
+    if (usePH ()->hasMallocError ())
+        return false;
+
+    if (nativeKeys) {
+        built = buildNativeTables (rstate);
+        return built;
+    }
+
+    size_t tMaxLen = (bits1 > bits2) ? t1.length : t2.length;
+
+    // Only deltas up to 2^32 are supported, so that the smallest prime factor
+    // of every composite fits in 16 bits.
+    if (tMaxLen > (1ul << 32))
+        return false;
+    uint16_t *spf = smallestPrimeFactors (tMaxLen);
+    if (spf == NULL)
+        return false;
+
     t1.entries = (MpzTableEntry *) malloc (t1.length * sizeof(MpzTableEntry));
     if (oneTable) {
         t2.entries = t1.entries;
@@ -78,42 +244,91 @@ bool TwoTableAttack::buildTable (gmp_randstate_t rstate) {
     } else {
         t2.entries = (MpzTableEntry *) malloc (t2.length * sizeof(MpzTableEntry));
     }
+    if (t1.entries == NULL || t2.entries == NULL) {
+        free (t1.entries);
+        if (!oneTable)
+            free (t2.entries);
+        t1.entries = t2.entries = NULL;
+        free (spf);
+        return false;
+    }
 
-    mpz_t z, delta, gamma, key;
-    mpz_init (z); mpz_init (delta); mpz_init (gamma); mpz_init (key);
+    mpz_t z, delta, key;
+    mpz_init (z); mpz_init (delta); mpz_init (key);
 
     // compute z = r * baseOrder, so that p-1 = z * s
     mpz_mul (z, e->baseOrder, e->r);
 
-    size_t tMaxLen = (bits1 > bits2) ? t1.length : t2.length;
-
-    DECLARE_PH_LOCALS
-    INIT_PH_LOCALS(e->prime)
-
     MpzTableEntry *entries1 = t1.entries;
     MpzTableEntry *entries2 = t2.entries;
-    mpz_set_ui (delta, 0);
-    size_t i = 0;
-    do {
-        mpz_add_ui (delta, delta, 1);
-        mpz_powm (gamma, delta, z, e->prime);
-        pohlig_hellman (key, e->sGenerator, e->prime, e->s, gamma, rstate, LIST_PH_LOCALS);
+
+    // the larger table has every delta, entries[d-1] is the entry for delta = d
+    MpzTableEntry *entries = (t1.length >= t2.length) ? entries1 : entries2;
+
+    // first the logs of the prime deltas, a batch at a time
+    DeltaLogBatch batch;
+    initDeltaLogBatch (&batch, e->prime);
+    size_t logged = 1;              // the prime keys up to here are set
+    for (size_t d=2; d <= tMaxLen + 1; d++) {
+        if (d <= tMaxLen && spf[d] == 0)
+            addDelta (&batch, d, z, e->prime);
+        if (batch.count == TWOTABLE_LOG_BATCH || (d > tMaxLen && batch.count > 0)) {
+            if (!ph->logBatch (batch.logs, batch.gammas, batch.count, rstate)) {
+                // no other entry is initialised yet, so the destructor must
+                // not see these
+                for (size_t p=2; p <= logged; p++) {
+                    if (spf[p] == 0)
+                        mpz_clear (entries[p-1].key);
+                }
+                free (t1.entries);
+                if (!oneTable)
+                    free (t2.entries);
+                t1.entries = t2.entries = NULL;
+                clearDeltaLogBatch (&batch);
+                mpz_clear (z); mpz_clear (delta); mpz_clear (key);
+                free (spf);
+                return false;
+            }
+            for (size_t k=0; k < batch.count; k++)
+                mpz_init_set (entries[batch.deltas[k]-1].key, batch.logs[k]);
+            batch.count = 0;
+            logged = (d < tMaxLen) ? d : tMaxLen;
+        }
+    }
+    clearDeltaLogBatch (&batch);
+
+    for (size_t i=0; i < tMaxLen; i++) {
+        size_t d = i + 1;
+        mpz_set_ui (delta, d);
+
+        bool prime = (d > 1 && spf[d] == 0);
+        if (d == 1) {
+            mpz_set_ui (key, 0);
+        } else if (prime) {
+            mpz_set (key, entries[i].key);
+        } else {
+            // log (q * d/q) = log (q) + log (d/q) mod s, and both are
+            // already in the table
+            size_t q = spf[d];
+            mpz_add (key, entries[q-1].key, entries[d/q-1].key);
+            if (mpz_cmp (key, e->s->value) >= 0)
+                mpz_sub (key, key, e->s->value);
+        }
+
+        // prime keys in the larger table are already set
         if (i < t1.length) {
             mpz_init_set (entries1[i].value, delta);
-            mpz_init_set (entries1[i].key, key);
-            /*
-            if (mpz_size (entries1[i].value) > 3)
-                printf ("value mpz_size > 3: %zu\n", mpz_size (entries1[i].value));
-            if (mpz_size (entries1[i].key) > 3)
-                printf ("key mpz_size > 3: %zu\n", mpz_size (entries1[i].key));
-                */
+            if (!prime || entries1 != entries)
+                mpz_init_set (entries1[i].key, key);
         }
         if (!oneTable && i < t2.length) {
             mpz_init_set (entries2[i].value, delta);
-            mpz_init_set (entries2[i].key, key);
+            if (!prime || entries2 != entries)
+                mpz_init_set (entries2[i].key, key);
         }
-        i++;
-    } while (i < tMaxLen);
+    }
+
+    free (spf);
 
 /*
     // wait for enter, so we can check pre-sort memory usage
@@ -139,25 +354,6 @@ bool TwoTableAttack::buildTable (gmp_randstate_t rstate) {
     printf ("sort time: %dm %ds : %ld\n", (int) floor (diff / 60),
                                           ((int)diff) % 60, (long)diff);
  
-//#define LIST_PH_LOCALS xi, q, qj, lj, ndivq, alphaBar, betaBar, betaStripped, alphaStrip, x, a, b, x1, a1, b1
-
-/*
-    printf ("xi: %zu\n", mpz_size (xi));
-    printf ("q: %zu\n", mpz_size (q));
-    printf ("qj: %zu\n", mpz_size (qj));
-    printf ("lj: %zu\n", mpz_size (lj));
-    printf ("ndivq: %zu\n", mpz_size (ndivq));
-    printf ("alphaBar: %zu\n", mpz_size (alphaBar));
-    printf ("betaBar: %zu\n", mpz_size (betaBar));
-    printf ("betaStripped: %zu\n", mpz_size (betaStripped));
-    printf ("alphaStrip: %zu\n", mpz_size (alphaStrip));
-    printf ("x: %zu\n", mpz_size (x));
-    printf ("a: %zu\n", mpz_size (a));
-    printf ("b: %zu\n", mpz_size (b));
-    printf ("x1: %zu\n", mpz_size (x1));
-    printf ("a1: %zu\n", mpz_size (a1));
-    printf ("b1: %zu\n", mpz_size (b1));
-    */
 /*
     entries = t2.entries;
     mpz_set_ui (delta, 0);
@@ -167,7 +363,7 @@ bool TwoTableAttack::buildTable (gmp_randstate_t rstate) {
         mpz_powm (gamma, delta, z, e->prime);
         mpz_init_set (entries[i].value, delta);
         mpz_init (entries[i].key);
-        pohlig_hellman (entries[i].key, e->sGenerator, e->prime, e->s, gamma, rstate, LIST_PH_LOCALS);
+        ph->log (entries[i].key, gamma, rstate);
         i++;
     } while (i < t2.length);
     // sort desc
@@ -180,9 +376,9 @@ bool TwoTableAttack::buildTable (gmp_randstate_t rstate) {
     }
     */
 
-    mpz_clear (z); mpz_clear (gamma); mpz_clear (delta); mpz_clear (key);
-    CLEAR_PH_LOCALS
+    mpz_clear (z); mpz_clear (delta); mpz_clear (key);
 
+    built = true;
     return true;
 }
 
@@ -261,21 +457,28 @@ static bool mpzTableBinaryIndexSearch (size_t *index, MpzTable table, mpz_t valu
 size_t TwoTableAttack::crackMessage (MpzList *results, const ElgamalCipherText ct,
                                      gmp_randstate_t rstate, size_t maxResults) {
 
+    if (!built)
+        return 0;
+    usePH ();
+    if (nativeKeys)
+        return crackMessageNative (results, ct, rstate, maxResults);
+
     mpz_t z, n, delta, gamma;
     mpz_init (z); mpz_init (n); mpz_init (delta); mpz_init (gamma);
 
     size_t resultCount = 0;
 
-    DECLARE_PH_LOCALS
-    INIT_PH_LOCALS(e->prime)
-
     // compute z = r * baseOrder, so that p-1 = z * s
     mpz_mul (z, e->baseOrder, e->r);
 
     // compute target n = log (myk^z) [base sGenerator]
     //printf ("Computing target...\n");
     mpz_powm (gamma, ct.myk, z, e->prime);
-    pohlig_hellman (n, e->sGenerator, e->prime, e->s, gamma, rstate, LIST_PH_LOCALS);
+    ph->log (n, gamma, rstate);
+    if (ph->hasMallocError ()) {
+        mpz_clear (z); mpz_clear (n); mpz_clear (delta); mpz_clear (gamma);
+        return 0;
+    }
     //gmp_printf ("target = %Zd\n", n);
 
     // search for n+1 in t2, since the elements surrounding n+1 will be the end and start
@@ -343,13 +546,297 @@ size_t TwoTableAttack::crackMessage (MpzList *results, const ElgamalCipherText c
             i2 = circularIncrement (i2, inc2, t2.length);
             if (i2 == i2start)
                 break;
+            mpz_sub (gamma, n, t2.entries[i2].key);
+            if (mpz_sgn (gamma) < 0) { // compute mod s
+                mpz_add (gamma, gamma, e->s->value);
+            }
         }
     } while (i1 < t1.length);
 
-    CLEAR_PH_LOCALS
     mpz_clear (z); mpz_clear (n); mpz_clear (delta); mpz_clear (gamma);
 
     return resultCount;
 
 }
 
+/*
+ * Same as buildTable, with keys in uint64_t. Keys are first computed in
+ * delta order in the larger table, where the sieve can find them.
+ */
+bool TwoTableAttack::buildNativeTables (gmp_randstate_t rstate) {
+
+    UInt64Table *big = (n1.length >= n2.length) ? &n1 : &n2;
+    UInt64Table *small = (big == &n1) ? &n2 : &n1;
+    size_t tMaxLen = big->length;
+
+    uint16_t *spf = smallestPrimeFactors (tMaxLen);
+    if (spf == NULL)
+        return false;
+
+    big->keys = (uint64_t *) malloc (big->length * sizeof (uint64_t));
+    big->values = (UIntType *) malloc (big->length * sizeof (UIntType));
+    if (big->keys == NULL || big->values == NULL) {
+        free (spf);
+        return false;
+    }
+
+    mpz_t z;
+    mpz_init (z);
+
+    // compute z = r * baseOrder, so that p-1 = z * s
+    mpz_mul (z, e->baseOrder, e->r);
+
+    uint64_t s = mpzGetUInt64 (e->s->value);
+    uint64_t *keys = big->keys;
+
+    // first the logs of the prime deltas, a batch at a time
+    DeltaLogBatch batch;
+    initDeltaLogBatch (&batch, e->prime);
+    for (size_t d=2; d <= tMaxLen + 1; d++) {
+        if (d <= tMaxLen && spf[d] == 0)
+            addDelta (&batch, d, z, e->prime);
+        if (batch.count == TWOTABLE_LOG_BATCH || (d > tMaxLen && batch.count > 0)) {
+            if (!ph->logBatch (batch.logs, batch.gammas, batch.count, rstate)) {
+                clearDeltaLogBatch (&batch);
+                mpz_clear (z);
+                free (spf);
+                return false;
+            }
+            for (size_t k=0; k < batch.count; k++)
+                keys[batch.deltas[k]-1] = mpzGetUInt64 (batch.logs[k]);
+            batch.count = 0;
+        }
+    }
+    clearDeltaLogBatch (&batch);
+
+    for (size_t i=0; i < tMaxLen; i++) {
+        size_t d = i + 1;
+        big->values[i] = (UIntType) d;
+
+        if (d == 1) {
+            keys[i] = 0;
+        } else if (spf[d] != 0) {
+            // both keys are < s, so the sum overflows 64 bits only if it is >= s
+            size_t q = spf[d];
+            uint64_t k = keys[q-1] + keys[d/q-1];
+            if (k < keys[q-1] || k >= s)
+                k -= s;
+            keys[i] = k;
+        }
+    }
+
+    free (spf);
+    mpz_clear (z);
+
+    if (oneTable) {
+        printf ("INFO: bits1 == bits2, using one table for memory savings.\n");
+    } else {
+        small->keys = (uint64_t *) malloc (small->length * sizeof (uint64_t));
+        small->values = (UIntType *) malloc (small->length * sizeof (UIntType));
+        if (small->keys == NULL || small->values == NULL)
+            return false;
+        memcpy (small->keys, big->keys, small->length * sizeof (uint64_t));
+        memcpy (small->values, big->values, small->length * sizeof (UIntType));
+    }
+
+    time_t start = time (NULL);
+
+    unsigned int sBits = mpz_sizeinbase (e->s->value, 2);
+    if (!radixSortUInt64Table (big, sBits))
+        return false;
+    if (oneTable) {
+        *small = *big;
+    } else if (!radixSortUInt64Table (small, sBits)) {
+        return false;
+    }
+
+    double diff = difftime (time (NULL), start);
+
+    printf ("sort time: %dm %ds : %ld\n", (int) floor (diff / 60),
+                                          ((int)diff) % 60, (long)diff);
+
+    return true;
+}
+
+/*
+ * One piece of the merge-join of the native tables. Position k of the
+ * virtual table is n - n2[i2] mod s with i2 = i2start - k, walking n2
+ * backwards around the circle, which is increasing in k.
+ */
+typedef struct {
+    const UInt64Table *t1, *t2;
+    uint64_t n, s;
+    size_t i2start;
+
+    size_t i1Begin, i1End;
+    size_t kBegin, kEnd;
+
+    size_t maxResults;
+    MpzList *results;
+    size_t resultCount;
+    pthread_t thread;
+} NativeJoin;
+
+static inline uint64_t virtualKey (const NativeJoin *j, size_t k) {
+    size_t i2 = (j->i2start >= k) ? j->i2start - k : j->i2start + j->t2->length - k;
+    uint64_t key = j->t2->keys[i2];
+    return (key <= j->n) ? j->n - key : j->n + (j->s - key);
+}
+
+static inline UIntType virtualValue (const NativeJoin *j, size_t k) {
+    size_t i2 = (j->i2start >= k) ? j->i2start - k : j->i2start + j->t2->length - k;
+    return j->t2->values[i2];
+}
+
+/*
+ * Smallest k in [0, t2.length] such that virtualKey (k) >= value.
+ */
+static size_t virtualLowerBound (const NativeJoin *j, uint64_t value) {
+    size_t m = 0, M = j->t2->length;
+    while (m < M) {
+        size_t k = m + (M - m) / 2;
+        if (virtualKey (j, k) < value)
+            m = k + 1;
+        else
+            M = k;
+    }
+    return m;
+}
+
+static void *nativeJoin (void *arg) {
+    NativeJoin *j = (NativeJoin *) arg;
+    const uint64_t *keys1 = j->t1->keys;
+
+    mpz_t z;
+    mpz_init (z);
+
+    size_t i1 = j->i1Begin, k = j->kBegin;
+    uint64_t c = (k < j->kEnd) ? virtualKey (j, k) : 0;
+    j->resultCount = 0;
+    while (i1 < j->i1End && k < j->kEnd) {
+        if (keys1[i1] < c) {
+            i1++;
+        } else if (keys1[i1] > c) {
+            k++;
+            if (k < j->kEnd)
+                c = virtualKey (j, k);
+        } else {
+            mpzSetUInt64 (z, (uint64_t) j->t1->values[i1] * virtualValue (j, k));
+            j->results->append (z);
+            j->resultCount++;
+            if (j->maxResults > 0 && j->resultCount >= j->maxResults)
+                break;
+            i1++;
+            k++;
+            if (k < j->kEnd)
+                c = virtualKey (j, k);
+        }
+    }
+
+    mpz_clear (z);
+    return NULL;
+}
+
+/*
+ * Same as crackMessage, using the integer tables. n2 is sorted ASC, so it is
+ * walked backwards to get n - n2[i2] mod s in increasing order.
+ *
+ * With more than one thread, n1 is cut into one range per thread, moving
+ * each cut past any run of equal keys, and the matching start of each range
+ * in the virtual table is found by binary search. The results of the ranges
+ * are concatenated in order, so they are the same as for one thread.
+ */
+size_t TwoTableAttack::crackMessageNative (MpzList *results, const ElgamalCipherText ct,
+                                           gmp_randstate_t rstate, size_t maxResults) {
+
+    mpz_t z, gamma;
+    mpz_init (z); mpz_init (gamma);
+
+    // compute z = r * baseOrder, so that p-1 = z * s
+    mpz_mul (z, e->baseOrder, e->r);
+
+    // compute target n = log (myk^z) [base sGenerator]
+    mpz_powm (gamma, ct.myk, z, e->prime);
+    ph->log (z, gamma, rstate);
+    if (ph->hasMallocError ()) {
+        mpz_clear (z); mpz_clear (gamma);
+        return 0;
+    }
+
+    NativeJoin join;
+    join.t1 = &n1;
+    join.t2 = &n2;
+    join.n = mpzGetUInt64 (z);
+    join.s = mpzGetUInt64 (e->s->value);
+    join.maxResults = maxResults;
+
+    // start at the largest key <= n, which gives the smallest n - key
+    size_t pivot = uint64TableUpperBound (n2, join.n);
+    join.i2start = (pivot == 0) ? n2.length - 1 : pivot - 1;
+
+    mpz_clear (z); mpz_clear (gamma);
+
+    unsigned int nJoins = threads;
+    if (n1.length < nJoins * TWOTABLE_MIN_JOIN_LENGTH)
+        nJoins = 1;
+
+    if (nJoins <= 1) {
+        join.i1Begin = 0; join.i1End = n1.length;
+        join.kBegin = 0; join.kEnd = n2.length;
+        join.results = results;
+        nativeJoin (&join);
+        return join.resultCount;
+    }
+
+    NativeJoin *joins = (NativeJoin *) malloc (nJoins * sizeof (NativeJoin));
+    if (joins == NULL)
+        return 0;
+
+    size_t i1 = 0, k = 0;
+    for (unsigned int t=0; t < nJoins; t++) {
+        joins[t] = join;
+        joins[t].i1Begin = i1;
+        joins[t].kBegin = k;
+        if (t == nJoins - 1) {
+            i1 = n1.length;
+            k = n2.length;
+        } else {
+            size_t cut = (t + 1) * (n1.length / nJoins);
+            if (cut < i1)
+                cut = i1;
+            while (cut > 0 && cut < n1.length && n1.keys[cut] == n1.keys[cut-1])
+                cut++;
+            i1 = cut;
+            k = (i1 < n1.length) ? virtualLowerBound (&join, n1.keys[i1]) : n2.length;
+        }
+        joins[t].i1End = i1;
+        joins[t].kEnd = k;
+        joins[t].results = new MpzList (20, 20);
+    }
+
+    unsigned int started = 0;
+    for (unsigned int t=0; t < nJoins; t++) {
+        if (pthread_create (&joins[t].thread, NULL, nativeJoin, &joins[t]) != 0)
+            break;
+        started++;
+    }
+    // if a thread could not be created, do the rest here
+    for (unsigned int t=started; t < nJoins; t++)
+        nativeJoin (&joins[t]);
+
+    size_t resultCount = 0;
+    for (unsigned int t=0; t < nJoins; t++) {
+        if (t < started)
+            pthread_join (joins[t].thread, NULL);
+        for (size_t i=0; i < joins[t].resultCount; i++) {
+            if (maxResults > 0 && resultCount >= maxResults)
+                break;
+            results->append ((*joins[t].results)[i]);
+            resultCount++;
+        }
+        delete joins[t].results;
+    }
+    free (joins);
+
+    return resultCount;
+}
@@ -16,15 +16,39 @@
  * =====================================================================================
  */
 
+// Number of prime deltas whose logs are computed together in buildTable.
+#define TWOTABLE_LOG_BATCH 1024
+
+// Don't bother splitting the merge-join into pieces shorter than this.
+#define TWOTABLE_MIN_JOIN_LENGTH (1ul << 14)
 
 class TwoTableAttack : public ElgamalAttack {
     private:
         MpzTable t1;
         MpzTable t2;
         bool oneTable;
+        PohligHellmanContext *ph;   // set up by usePH, from the context if there is one
+        unsigned int threads;
+
+        // When s fits in 64 bits, keys are stored as integers in these
+        // tables instead of t1 and t2. Both are sorted ASC.
+        bool nativeKeys;
+        UInt64Table n1;
+        UInt64Table n2;
+
+        // false until a buildTable succeeds; a failed build may leave the
+        // tables partly filled
+        bool built;
+
+        PohligHellmanContext *usePH ();
+        bool buildNativeTables (gmp_randstate_t rstate);
+        size_t crackMessageNative (MpzList *results, const ElgamalCipherText ct,
+                                   gmp_randstate_t rstate, size_t maxResults);
 
     public:
-        TwoTableAttack (ElgamalCryptosystem *e, unsigned int bits1, unsigned int bits2);
+        // threads == 0 uses one thread per online processor for crackMessage
+        TwoTableAttack (ElgamalCryptosystem *e, unsigned int bits1, unsigned int bits2,
+                        unsigned int threads=0);
         ~TwoTableAttack ();
         bool buildTable (gmp_randstate_t rstate);
         size_t crackMessage (MpzList *results, const ElgamalCipherText ct,
@@ -109,6 +109,10 @@ sub tableMemoryBitsUsed ($$) {
 }
 
 print "attacks: ", join (", ", @attacks), "\n";
+
+# save what the attacks derive from the cryptosystem alone once, instead of
+# in every mimattack run
+system ("mimattack -x -c '$csFilePath'") unless -f "$csFilePath.ctx";
 my $printHeaders = (! -f "$csDirPath/tableTime.dat");
 
 open (CRACKCSV, ">>$csDirPath/crackTime.csv");
@@ -261,4 +265,7 @@ B<attack.pl> is a driver script to run mimattack with different parameters
 and save the results to log and data files. Cryptosystems and messages
 should be created first using elgamalmgr.
 
+Before the first run on a cryptosystem it saves the attack context with
+mimattack -x next to the cryptosystem file, for the later runs to load.
+
 =cut
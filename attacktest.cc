@@ -0,0 +1,226 @@
+/*
+ * Command line program to test the attacks against known messages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "include/types.h"
+#include "include/elgamal.h"
+#include "include/dlog.h"
+
+#include "MpzList.h"
+#include "ElgamalAttack.h"
+#include "MimAttack.h"
+#include "HashMimAttack.h"
+#include "HashMimAttack5.h"
+
+void usage () {
+    printf ("Usage: attacktest -b messageBits cryptosystemFilePath message1Path [message2Path...]\n");
+    printf ("  cracks the messages with each in memory attack, one at a time and all\n");
+    printf ("  together with crackMessages, and checks that both find the same results\n");
+}
+
+// the crackMessages callback, collecting the distinct results of each ciphertext
+static bool collect (void *arg, size_t index, mpz_t result) {
+    if (result != NULL) {
+        MpzList *results = ((MpzList **) arg)[index];
+        if (!results->find (NULL, result))
+            results->append (result);
+    }
+    return true;
+}
+
+static bool sameResults (MpzList *a, MpzList *b) {
+    if (a->getSize () != b->getSize ())
+        return false;
+    for (size_t i=0; i < a->getSize (); i++) {
+        if (!b->find (NULL, (*a)[i]))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The targets of one stream over all u^q must be those of a stream for
+ * each, across the chunk boundaries.
+ */
+bool testTargetStream (ElgamalCryptosystem *e, ElgamalCipherText *cts, size_t count) {
+    unsigned long last = 2 * MIM_DELTA_CHUNK + 17;
+    mpz_t *uqs = (mpz_t *) malloc (count * sizeof (mpz_t));
+    MimTargetStream **singles = (MimTargetStream **) malloc (count * sizeof (MimTargetStream *));
+    if (uqs == NULL || singles == NULL) {
+        free (uqs);
+        free (singles);
+        return false;
+    }
+    for (size_t i=0; i < count; i++) {
+        mpz_init (uqs[i]);
+        mpz_powm (uqs[i], cts[i].myk, e->baseOrder, e->prime);
+        singles[i] = new MimTargetStream (e, uqs[i], last);
+    }
+
+    mpz_t delta2, delta2Single, target, targetSingle;
+    mpz_init (delta2); mpz_init (delta2Single);
+    mpz_init (target); mpz_init (targetSingle);
+
+    bool ok = true;
+    unsigned long n = 0;
+    MimTargetStream targets (e, uqs, count, last);
+    while (ok && targets.next (delta2)) {
+        n++;
+        for (size_t i=0; ok && i < count; i++) {
+            targets.target (target, i);
+            ok = singles[i]->next (delta2Single, targetSingle)
+                 && mpz_cmp (delta2, delta2Single) == 0
+                 && mpz_cmp (target, targetSingle) == 0;
+        }
+    }
+    if (ok && n != last)
+        ok = false;
+    if (!ok)
+        printf ("ERR: shared target stream differs at delta2 = %lu\n", n);
+
+    mpz_clear (delta2); mpz_clear (delta2Single);
+    mpz_clear (target); mpz_clear (targetSingle);
+    for (size_t i=0; i < count; i++) {
+        delete singles[i];
+        mpz_clear (uqs[i]);
+    }
+    free (singles);
+    free (uqs);
+    return ok;
+}
+
+/*
+ * Build the table of attack, crack each message with crackMessage and all
+ * of them with crackMessages, and compare the distinct results, which
+ * must include the message.
+ */
+bool testAttack (ElgamalAttack *attack, ElgamalCipherText *cts, mpz_t *ms,
+                 size_t count, gmp_randstate_t rstate) {
+    if (!attack->buildTable (rstate)) {
+        printf ("ERR: %s: table build failed\n", attack->getAttackName ());
+        return false;
+    }
+
+    MpzList **batched = (MpzList **) malloc (count * sizeof (MpzList *));
+    if (batched == NULL)
+        return false;
+    for (size_t i=0; i < count; i++)
+        batched[i] = new MpzList (4, 4);
+    attack->crackMessages (cts, count, rstate, collect, batched);
+
+    bool ok = true;
+    MpzList results (20, 20);
+    MpzList unique (4, 4);
+    for (size_t i=0; i < count; i++) {
+        size_t resultCount = attack->crackMessage (&results, cts[i], rstate);
+        for (size_t j=0; j < resultCount; j++) {
+            if (!unique.find (NULL, results[j]))
+                unique.append (results[j]);
+        }
+        if (!sameResults (&unique, batched[i]) || !sameResults (batched[i], &unique)) {
+            printf ("ERR: %s: message %zu: %zu results one at a time, %zu batched\n",
+                    attack->getAttackName (), i, unique.getSize (), batched[i]->getSize ());
+            ok = false;
+        } else if (!unique.find (NULL, ms[i])) {
+            printf ("ERR: %s: message %zu not found\n", attack->getAttackName (), i);
+            ok = false;
+        }
+        results.clear ();
+        unique.clear ();
+        delete batched[i];
+    }
+    free (batched);
+    return ok;
+}
+
+int main (int argc, char **argv) {
+    unsigned int messageBits = 0;
+    char *endptr;
+    int opt;
+    while ((opt = getopt (argc, argv, "b:")) != -1) {
+        switch (opt) {
+        case 'b':
+            messageBits = strtoul (optarg, &endptr, 10);
+            if (*endptr != '\0') {
+                usage ();
+                exit (EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage ();
+            exit (EXIT_FAILURE);
+        }
+    }
+    if (messageBits == 0 || argc - optind < 2) {
+        usage ();
+        exit (EXIT_FAILURE);
+    }
+    unsigned int bits1 = messageBits >> 1, bits2 = messageBits >> 1;
+
+    FILE *f = fopen (argv[optind], "r");
+    if (f == NULL) {
+        perror (argv[optind]);
+        exit (EXIT_FAILURE);
+    }
+    ElgamalCryptosystem e;
+    e.read (f);
+    fclose (f);
+
+    size_t count = argc - optind - 1;
+    ElgamalCipherText *cts = (ElgamalCipherText *) malloc (count * sizeof (ElgamalCipherText));
+    mpz_t *ms = (mpz_t *) malloc (count * sizeof (mpz_t));
+    if (cts == NULL || ms == NULL) {
+        printf ("ERR: out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+    for (size_t i=0; i < count; i++) {
+        mpz_init (ms[i]);
+        mpz_init (cts[i].gk);
+        mpz_init (cts[i].myk);
+        f = fopen (argv[optind + 1 + i], "r");
+        if (f == NULL) {
+            perror (argv[optind + 1 + i]);
+            exit (EXIT_FAILURE);
+        }
+        mpz_inp_raw (ms[i], f);
+        mpz_inp_raw (cts[i].gk, f);
+        mpz_inp_raw (cts[i].myk, f);
+        fclose (f);
+    }
+
+    gmp_randstate_t rstate;
+    gmp_randinit_default (rstate);
+
+    int returnValue = EXIT_SUCCESS;
+    if (!testTargetStream (&e, cts, count))
+        returnValue = EXIT_FAILURE;
+
+    ElgamalAttack *attacks[3];
+    attacks[0] = new MimAttack (&e, bits1, bits2);
+    attacks[1] = new HashMimAttack (&e, bits1, bits2);
+    attacks[2] = new HashMimAttack5 (&e, bits1, bits2);
+    for (int a=0; a < 3; a++) {
+        if (!testAttack (attacks[a], cts, ms, count, rstate))
+            returnValue = EXIT_FAILURE;
+        delete attacks[a];
+    }
+
+    for (size_t i=0; i < count; i++) {
+        mpz_clear (ms[i]);
+        mpz_clear (cts[i].gk);
+        mpz_clear (cts[i].myk);
+    }
+    free (ms);
+    free (cts);
+    gmp_randclear (rstate);
+
+    if (returnValue == EXIT_SUCCESS)
+        printf ("attacktest: all results agree\n");
+    return returnValue;
+}
@@ -17,12 +17,14 @@ my $csDirPath = '';
 my $startBits = 0;
 my $endBits = 0;
 my @messageBitsList = ();
+my $count = 10;
 
 my $man = 0;
 my $help = 0;
 
 GetOptions ("cryptosystem|c=s" => \$csFilePath,
             "messagebits|b=i{1,2}" => \@messageBitsList,
+            "count|n=i" => \$count,
             'help|?' => \$help, man => \$man) or pod2usage(2);
 
 pod2usage(-verbose => 0) if $help;
@@ -52,16 +54,14 @@ unless (-d $csDirPath) {
     mkdir $csDirPath;
 }
 
-my ($messageBits, $halfBits, $tag, $bitMessageDir);
+my ($messageBits, $halfBits, $bitMessageDir);
 for $halfBits ($startBits/2 .. $endBits /2) {
     $messageBits = 2 * $halfBits;
     $bitMessageDir = "$csDirPath/${halfBits}_${halfBits}/";
     unless (-d $bitMessageDir) {
         mkdir $bitMessageDir;
     }
-    for $tag ('a' .. 'j') {
-        system ("elgamalmgr cm '$bitMessageDir$tag.msg' -m$messageBits -c '$csFilePath'\n");
-    }
+    system ("elgamalmgr cm '$bitMessageDir' -n$count -m$messageBits -c '$csFilePath'\n");
 }
 
 __END__
@@ -75,7 +75,7 @@ createMessages.pl - create messages for attack.pl
 
     createMessages.pl -help|-man
 OR  createMessages.pl -cryptosystem CSFILE|CSNAME \
-                      -messagebits STARTBITS [ENDBITS]
+                      -messagebits STARTBITS [ENDBITS] [-count COUNT]
 
  Options:
    -help        brief help message
@@ -84,6 +84,8 @@ OR  createMessages.pl -cryptosystem CSFILE|CSNAME \
                 file containing ElGamal cryptosystem or name of cryptosystem
    -messagebits, -b STARTBITS [ENDBITS]
                 createMessages messages of given sizes (or inclusive range)
+   -count, -n COUNT
+                messages of each size, default 10
 
 =head1 OPTIONS
 
@@ -108,6 +110,10 @@ elgamalmgr. If the file does not exist, then $CSDIR is prepended and
 Create messages of sizes starting with STARTBITS, and if given,
 increment by two until ENDBITS is reached (inclusive).
 
+=item B<-count>, B<-n> COUNT
+
+Number of messages to create for each size, 10 by default.
+
 =back
 
 =head1 DESCRIPTION
@@ -119,7 +125,8 @@ create the actual messages.
 The $CSDIR variable should be set to the desired output directory. If
 the cryptosystem specified with -cryptosystem is 'test1024bit.elg', then
 createMessages.pl will put messages in "$CSDIR/test1024bit/$halfBits_$halfBits"
-with names a.msg, b.msg, c.msg, etc. $halfBits is half the bit size
+with names a.msg, b.msg, c.msg, etc. All messages of one size are created
+by a single run of elgamalmgr. $halfBits is half the bit size
 of the message; the purpose of this naming scheme is to make clear that the
 message splits into two part of $halfBits size each. Other splits are currently
 not implemented by elgamalmgr, but may be added in the future.
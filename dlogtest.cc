@@ -17,13 +17,16 @@
 
 typedef enum { PH, RHO } Algorithm;
 
+// number of threads for pollard_rho_parallel, 1 uses the sequential algorithm
+static unsigned int nThreads = 1;
+
 bool test_random_prime_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
                               mpz_t y, unsigned int nBits, unsigned int pBits,
                               gmp_randstate_t rstate, bool verbose, Algorithm alg);
 
                      
 void usage () {
-    printf ("Usage: dlogtest [-h] [-l|-r] [-t] [-c count [-n nBits] [-p pBits] [-s sBits]] [-v] [alpha p n beta]\n");
+    printf ("Usage: dlogtest [-h] [-l|-r] [-t] [-c count [-n nBits] [-p pBits] [-s sBits]] [-j threads] [-v] [--seed N] [alpha p n beta]\n");
 }
 
 void help () {
@@ -31,9 +34,12 @@ void help () {
     printf ("Options:\n"
             "  -h\t display this help message and exit\n"
             "  -v\t verbose, display more information\n"
+            "  --seed N\t take the random numbers from seed N, to repeat a run\n"
             " Algorithm selection:\n"
             "  -r\t use the Pollard-Rho algorithm (default)\n"
             "  -l\t use the Pohlig-Hellman algorithm\n"
+            "  -jN\t use parallel Pollard-Rho with N threads (0 for one per processor) for\n"
+            "     \t prime orders, and with Pohlig-Hellman for factors of at least 32 bits\n"
             " Test cases:\n"
             "  -t\t test the algorithm with specific discrete log instances\n"
             " Random testing:\n"
@@ -55,7 +61,18 @@ bool test_alg (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
     int runCount = 1;
 
     if (alg == RHO) {
-        runCount = pollard_rho (result, alpha, p, n, beta, rstate);
+        if (nThreads != 1) {
+            if (!pollard_rho_parallel (result, alpha, p, n, beta, rstate, nThreads)) {
+                fputs ("Error starting threads in pollard_rho_parallel\n", stderr);
+                return false;
+            }
+        } else {
+            runCount = pollard_rho (result, alpha, p, n, beta, rstate);
+            if (runCount == 0) {
+                fputs ("Malloc error in pollard_rho\n", stderr);
+                return false;
+            }
+        }
     } else {
         CFactoredInteger fi;
         fi.factorValue (n);
@@ -63,7 +80,10 @@ bool test_alg (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
             fputs ("Malloc error in CFactoredInteger.factorValue\n", stderr);
             return false;
         }
-        pohlig_hellman (result, alpha, p, &fi, beta, rstate);
+        if (!pohlig_hellman (result, alpha, p, &fi, beta, rstate, nThreads)) {
+            fputs ("Malloc error in pohlig_hellman\n", stderr);
+            return false;
+        }
     }
 
     mpz_t beta2;
@@ -89,7 +109,7 @@ bool test_alg (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
 
 bool test_random_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
                         mpz_t y, unsigned int nBits, unsigned int pBits, unsigned int sBits,
-                        gmp_randstate_t rstate, bool verbose, Algorithm alg, PH_ARG_LIST) {
+                        gmp_randstate_t rstate, bool verbose, Algorithm alg) {
 
     if (alg == RHO) {
         return test_random_prime_order (result, alpha, p, n, beta, y, nBits, pBits,
@@ -208,13 +228,21 @@ bool test_random_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
 
     mpz_powm (beta, alpha, y, p);
 
+    // the per-factor constants only depend on alpha, p and n, so don't time them
+    PohligHellmanContext ph (alpha, p, &fi);
+    if (ph.hasMallocError ()) {
+        fputs ("Malloc error in PohligHellmanContext\n", stderr);
+        return false;
+    }
+    ph.setThreads (nThreads);
+
     timeval start, end;
     gettimeofday (&start, NULL);
    
     //gmp_printf ("About to call PH: log base %Zd of %Zd, in Z_{%Zd}, with n = %Zd\n",
     //                alpha, beta, p, n);
 
-    pohlig_hellman (result, alpha, p, &fi, beta, rstate, LIST_PH_LOCALS);
+    ph.log (result, beta, rstate);
 
     gettimeofday (&end, NULL);
 
@@ -229,6 +257,20 @@ bool test_random_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
     if (mpz_cmp (result, y) != 0)
         success = false;
 
+    // a context loaded from the saved constants must give the same log
+    FILE *saved = tmpfile ();
+    if (saved == NULL || !ph.write (saved)) {
+        success = false;
+    } else {
+        rewind (saved);
+        PohligHellmanContext loaded (alpha, p, &fi, PH_TABLE_MAX_BABY_STEPS, saved);
+        loaded.log (result, beta, rstate);
+        if (loaded.hasMallocError () || mpz_cmp (result, y) != 0)
+            success = false;
+    }
+    if (saved != NULL)
+        fclose (saved);
+
     if (verbose) {
         if (success) { printf ("[ok] "); }
         else { printf ("[FAIL!] "); }
@@ -289,7 +331,18 @@ bool test_random_prime_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t
     int runCount = 1;
     
     if (alg == RHO) {
-        runCount = pollard_rho (result, alpha, p, n, beta, rstate);
+        if (nThreads != 1) {
+            if (!pollard_rho_parallel (result, alpha, p, n, beta, rstate, nThreads)) {
+                fputs ("Error starting threads in pollard_rho_parallel\n", stderr);
+                return false;
+            }
+        } else {
+            runCount = pollard_rho (result, alpha, p, n, beta, rstate);
+            if (runCount == 0) {
+                fputs ("Malloc error in pollard_rho\n", stderr);
+                return false;
+            }
+        }
     } else {
         CFactoredInteger fi;
         fi.factorValue (n);
@@ -297,7 +350,10 @@ bool test_random_prime_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t
             fputs ("Malloc error in CFactoredInteger.factorValue\n", stderr);
             return false;
         }
-        pohlig_hellman (result, alpha, p, &fi, beta, rstate);
+        if (!pohlig_hellman (result, alpha, p, &fi, beta, rstate, nThreads)) {
+            fputs ("Malloc error in pohlig_hellman\n", stderr);
+            return false;
+        }
     }
 
     if (verbose && runCount > 1) {
@@ -325,6 +381,7 @@ bool test_random_prime_order (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t
 }
 
 int main (int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
     mpz_t result, alpha, p, n, beta, y;
     mpz_init (result);
     mpz_init (alpha); mpz_init (p); mpz_init (n); mpz_init (beta);
@@ -345,7 +402,7 @@ int main (int argc, char **argv) {
 
     char *endptr;
     int opt;
-    while ((opt = getopt (argc, argv, "hlrc:vtn:p:s:")) != -1) {
+    while ((opt = getopt (argc, argv, "hlrc:vtn:p:s:j:")) != -1) {
         switch (opt) {
         case 'h':
             help ();
@@ -385,6 +442,13 @@ int main (int argc, char **argv) {
                 exit (1);
             }
             break;
+        case 'j':
+            nThreads = strtoul (optarg, &endptr, 10);
+            if (*endptr != '\0') {
+                usage ();
+                exit (1);
+            }
+            break;
         case 'l':
             alg = PH;
             break;
@@ -398,8 +462,10 @@ int main (int argc, char **argv) {
         }
     }
 
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+    if (!initRandState (rstate, seed)) {
+        fprintf (stderr, "Failed to seed random state, exiting\n");
+        exit (EXIT_FAILURE);
+    }
 
     // If there are 4 arguments left after processing switches,
     // treat them as a discrete log instance.
@@ -494,12 +560,9 @@ int main (int argc, char **argv) {
     
     // if a count was specified with -cN, then run the algorithm on N random discrete log instances.
     if (count > 0) {
-        DECLARE_PH_LOCALS
-        INIT_PH_LOCALS(p)
-
         for (int i=0; i < count; i++) {
             if (!test_random_order (result, alpha, p, n, beta,
-                                    y, nBits, pBits, sBits, rstate, verbose, alg, LIST_PH_LOCALS)) {
+                                    y, nBits, pBits, sBits, rstate, verbose, alg)) {
                 returnValue = EXIT_FAILURE;
                 if (!verbose)
                     printf (" 0");
@@ -509,8 +572,6 @@ int main (int argc, char **argv) {
         }
 
         if (!verbose) { printf ("\n"); }
-        
-        CLEAR_PH_LOCALS
     }
 
     mpz_clear (result);
@@ -22,13 +22,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <gmp.h>
 #include "include/types.h"
 #include "include/randomhelpers.h"
+#include "include/philox.h"
 #include "include/elgamal.h"
+#include "include/CipherTextContainer.h"
 //#include "resourcefilenames.h"
 
 typedef enum { NONE, CREATE_CS, CREATE_MSG, DISPLAY_CS, DISPLAY_MSG } Mode;
@@ -37,8 +41,8 @@ typedef enum { NONE, CREATE_CS, CREATE_MSG, DISPLAY_CS, DISPLAY_MSG } Mode;
 
 void usage () {
     printf ("elgamalmgr cc outfile [-p prime_bits] [-b base_bits] "
-            "[-s smooth_bits -l smoothness_bit_limit] "
-            "| cm outfile -m message_bits -c cryptosystem_infile "
+            "[-s smooth_bits -l smoothness_bit_limit] [-j threads] [--seed N] "
+            "| cm outfile -m message_bits -c cryptosystem_infile [-n count [-j threads]] [--seed N] "
             "| lc infile "
             "| lm infile\n");
 }
@@ -55,7 +59,163 @@ Mode getDisplayModeFromExt (char *fileName) {
     }
 }
 
+/*
+ * Random message m = m1 * m2 with m1 and m2 both exactly halfBits bits, so
+ * that it splits for the attacks.
+ */
+void randomSplittingMessage (mpz_t m, mpz_t m2, int halfBits, gmp_randstate_t rstate) {
+    mpz_urandomb (m, rstate, halfBits - 1);
+    mpz_setbit (m, halfBits - 1);
+    mpz_urandomb (m2, rstate, halfBits - 1);
+    mpz_setbit (m2, halfBits - 1);
+}
+
+bool writeMessage (const char *fileName, const mpz_t m, const ElgamalCipherText ct) {
+    FILE *f = fopen (fileName, "w");
+    if (f == NULL) {
+        perror (fileName);
+        return false;
+    }
+    bool ok = mpz_out_raw (f, m) != 0;
+    ok = ok && mpz_out_raw (f, ct.gk) != 0;
+    ok = ok && mpz_out_raw (f, ct.myk) != 0;
+    return (fclose (f) == 0) && ok;
+}
+
+/*
+ * Name of message number i in a bulk run: a, b, ... z, aa, ab, ... the same
+ * sequence perl's string increment gives, which createMessages.pl used.
+ */
+void messageTag (char *tag, unsigned int i) {
+    char reversed[16];
+    int length = 0;
+    i++;
+    while (i > 0) {
+        i--;
+        reversed[length++] = 'a' + i % 26;
+        i /= 26;
+    }
+    for (int k=0; k < length; k++)
+        tag[k] = reversed[length - 1 - k];
+    tag[length] = '\0';
+}
+
+typedef struct {
+    ElgamalCryptosystem *e;
+    CipherTextContainer *container;    // NULL to write .msg files into dirName
+    const char *dirName;
+    int halfBits;
+    unsigned int first, step, count;   // messages first, first + step, ... below count
+    uint64_t seed;                     // message i draws from stream i of it
+    bool failed;
+    pthread_t thread;
+} MessageThread;
+
+void *createMessagesThread (void *arg) {
+    MessageThread *t = (MessageThread *) arg;
+
+    gmp_randstate_t rstate;
+    randStateInitPhilox (rstate, t->seed, 0);
+
+    mpz_t m, m2;
+    mpz_init (m); mpz_init (m2);
+    ElgamalCipherText ct;
+    mpz_init (ct.gk); mpz_init (ct.myk);
+
+    char *fileName = (char *) malloc (strlen (t->dirName) + 32);
+    t->failed = (fileName == NULL);
+    char tag[16];
+
+    for (unsigned int i = t->first; !t->failed && i < t->count; i += t->step) {
+        randStateSetStream (rstate, t->seed, i);
+        randomSplittingMessage (m, m2, t->halfBits, rstate);
+        mpz_mul (m, m, m2);
+        t->e->encrypt (&ct, m, rstate);
+
+        if (t->container != NULL) {
+            if (!t->container->set (i, m, ct)) {
+                fprintf (stderr, "message %u does not fit in the container\n", i);
+                t->failed = true;
+            }
+        } else {
+            messageTag (tag, i);
+            sprintf (fileName, "%s/%s.msg", t->dirName, tag);
+            if (!writeMessage (fileName, m, ct))
+                t->failed = true;
+        }
+    }
+
+    free (fileName);
+    mpz_clear (m); mpz_clear (m2); mpz_clear (ct.gk); mpz_clear (ct.myk);
+    gmp_randclear (rstate);
+    return NULL;
+}
+
+/*
+ * Encrypt count random splitting messages into dirName/a.msg, b.msg, ...
+ * or, if dirName ends in .ctc, into a single CipherTextContainer. Each
+ * thread takes every threads'th message; message i is drawn from stream i
+ * of one seed, so the messages do not depend on the number of threads.
+ */
+bool createMessages (ElgamalCryptosystem *e, const char *dirName, unsigned int count,
+                     size_t msgBits, gmp_randstate_t rstate, unsigned int threads) {
+    if (threads == 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? online : 1;
+    }
+    if (threads > count)
+        threads = count;
+
+    // pays for itself after a handful of messages, and is shared by the threads
+    e->precomputeEncryption ();
+
+    CipherTextContainer *container = NULL;
+    if (CipherTextContainer::isContainerName (dirName)) {
+        container = new CipherTextContainer (dirName, e, count);
+        if (container->hasError ()) {
+            delete container;
+            return false;
+        }
+    } else if (mkdir (dirName, 0777) != 0 && errno != EEXIST) {
+        perror (dirName);
+        return false;
+    }
+
+    MessageThread *t = (MessageThread *) malloc (threads * sizeof (MessageThread));
+    if (t == NULL) {
+        delete container;
+        return false;
+    }
+
+    unsigned int started = 0;
+    uint64_t seed = randStateSeed (rstate);
+    for (unsigned int i=0; i < threads; i++) {
+        t[i].e = e;
+        t[i].container = container;
+        t[i].dirName = dirName;
+        t[i].halfBits = ceil (msgBits / 2.0);
+        t[i].first = i;
+        t[i].step = threads;
+        t[i].count = count;
+        t[i].seed = seed;
+        if (pthread_create (&t[i].thread, NULL, createMessagesThread, &t[i]) != 0)
+            break;
+        started++;
+    }
+
+    bool ok = (started == threads);
+    for (unsigned int i=0; i < started; i++) {
+        pthread_join (t[i].thread, NULL);
+        ok = ok && !t[i].failed;
+    }
+    free (t);
+    delete container;
+
+    return ok;
+}
+
 int main (int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
 
     Mode mode = NONE;
     //char *label = NULL;
@@ -68,6 +228,9 @@ int main (int argc, char **argv) {
 
     size_t msgBits = 40;
 
+    unsigned int threads = 0; // one per online processor
+    unsigned int count = 0;   // bulk cm writes count messages into a directory
+
     if (argc < 3) {
         printf ("argc = %d\n", argc);
         usage ();
@@ -96,7 +259,7 @@ int main (int argc, char **argv) {
     argv += 2;
 
     int opt, x;
-    while ((opt = getopt (argc, argv, "c:p:b:m:l:s:")) != -1) {
+    while ((opt = getopt (argc, argv, "c:p:b:m:l:s:j:n:")) != -1) {
         switch (opt) {
         case 'c':
             if (mode == CREATE_MSG) {
@@ -158,6 +321,26 @@ int main (int argc, char **argv) {
                 exit (EXIT_FAILURE);
             }
             break;
+        case 'n':
+            x = strtol (optarg, &endptr, 10);
+            if (*endptr == '\0' && x > 0 && mode == CREATE_MSG) {
+                count = x;
+            } else {
+                printf ("-n expects a positive integer argument, for command 'cm'\n");
+                usage ();
+                exit (EXIT_FAILURE);
+            }
+            break;
+        case 'j':
+            x = strtol (optarg, &endptr, 10);
+            if (*endptr == '\0' && x >= 0) {
+                threads = x;
+            } else {
+                printf ("-j expects a non-negative integer argument\n");
+                usage ();
+                exit (EXIT_FAILURE);
+            }
+            break;
         case ':':
         case '?':
             usage ();
@@ -203,14 +386,20 @@ int main (int argc, char **argv) {
             printf (" smoothness parameters: bits = %zu, limit = %zu\n", smoothBits, smoothBitLimit);
         }
 
-        gmp_randinit_default (rstate);
-        seedRandState (rstate);
+        if (!initRandState (rstate, seed)) {
+            fprintf (stderr, "Failed to seed random state, exiting\n");
+            exit (EXIT_FAILURE);
+        }
 
         if (primeBits != baseOrderBits) {
             e = new ElgamalCryptosystem (primeBits, baseOrderBits, rstate,
-                                         smoothBits, smoothBitLimit);
+                                         smoothBits, smoothBitLimit, threads);
         } else {
-            e = new ElgamalCryptosystem (primeBits, rstate);
+            e = new ElgamalCryptosystem (primeBits, rstate, threads);
+        }
+        if (e->hasMallocError ()) {
+            printf ("Failed to allocate memory for the cryptosystem\n");
+            exit (EXIT_FAILURE);
         }
 
         /*
@@ -246,6 +435,24 @@ int main (int argc, char **argv) {
 
         mpz_init (m); mpz_init (ct.gk); mpz_init (ct.myk);
 
+        if (CipherTextContainer::isContainerName (inFileName)) {
+            CipherTextContainer container (inFileName);
+            if (container.hasError ())
+                exit (EXIT_FAILURE);
+            printf ("%llu ciphertexts of %zu limbs, cryptosystem fingerprint %016llx\n",
+                    (unsigned long long) container.count, container.limbs,
+                    (unsigned long long) container.fingerprint);
+            for (uint64_t i = 0; i < container.count; i++) {
+                container.get (i, m, &ct);
+                printf ("[%llu]\n", (unsigned long long) i);
+                gmp_printf ("m = %Zd (%u bits)\n", m, mpz_sizeinbase (m, 2));
+                gmp_printf ("g^k = %Zd (%u bits)\n", ct.gk, mpz_sizeinbase (ct.gk, 2));
+                gmp_printf ("m*y^k = %Zd (%u bits)\n", ct.myk, mpz_sizeinbase (ct.myk, 2));
+            }
+            mpz_clear (m); mpz_clear (ct.gk); mpz_clear (ct.myk);
+            return 0;
+        }
+
         FILE *f = fopen (inFileName, "r");
         if (f == NULL) {
             perror (NULL);
@@ -286,19 +493,37 @@ int main (int argc, char **argv) {
         
         fclose (f);
 
+        // the product of two halfBits factors has to stay below the prime
+        if (2 * (size_t) halfBits >= mpz_sizeinbase (e->prime, 2)) {
+            printf ("Messages of %zu bits do not fit below the %zu bit prime, exiting\n",
+                    msgBits, mpz_sizeinbase (e->prime, 2));
+            exit (EXIT_FAILURE);
+        }
+
+        if (!initRandState (rstate, seed)) {
+            fprintf (stderr, "Failed to seed random state, exiting\n");
+            exit (EXIT_FAILURE);
+        }
+
+        if (count > 0) {
+            printf ("Generating %u random splitting messages in '%s'\n", count, outFileName);
+            if (!createMessages (e, outFileName, count, msgBits, rstate, threads)) {
+                printf ("Failed to create messages\n");
+                exit (EXIT_FAILURE);
+            }
+            delete e;
+            gmp_randclear (rstate);
+            mpz_clear (m); mpz_clear (m2);
+            return 0;
+        }
+
         ElgamalCipherText ct;
         mpz_init (ct.gk);
         mpz_init (ct.myk);
 
-        gmp_randinit_default (rstate);
-        seedRandState (rstate);
-
         if (mpz_cmp_ui (m, 0) == 0) {
             printf ("Generating random splitting message with at most %zu bits:\n", msgBits);
-            mpz_urandomb (m, rstate, halfBits - 1);
-            mpz_setbit (m, halfBits - 1);
-            mpz_urandomb (m2, rstate, halfBits - 1);
-            mpz_setbit (m2, halfBits - 1);
+            randomSplittingMessage (m, m2, halfBits, rstate);
             gmp_printf ("message factors = %Zd; %Zd\n", m, m2);
 
             mpz_mul (m, m, m2);
@@ -308,16 +533,10 @@ int main (int argc, char **argv) {
 
         delete e;
 
-        f = fopen (outFileName, "w");
-        if (f == NULL) {
-            perror (NULL);
+        if (!writeMessage (outFileName, m, ct)) {
             exit (EXIT_FAILURE);
         }
 
-        mpz_out_raw (f, m);
-        mpz_out_raw (f, ct.gk);
-        mpz_out_raw (f, ct.myk);
-
         gmp_printf ("message = %Zd\n", m);
         gmp_printf ("actual message bits = %zu\n", mpz_sizeinbase (m, 2));
         //gmp_printf ("half bits = %d\n", halfBits);
@@ -12,24 +12,30 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <gmp.h>
 #include <unistd.h>
 
 #include "include/types.h"
 #include "include/randomhelpers.h"
+#include "include/philox.h"
 #include "include/elgamal.h"
 
 void usage () {
-    printf ("elgamaltest [-c count] [-v] [-t] [-f file ] [-m msgBits] [-p primeBits] [-b maxBaseOrderBits] [-x]\n");
+    printf ("elgamaltest [-c count] [-v] [-t] [-f file ] [-m msgBits] [-p primeBits] [-b maxBaseOrderBits] [-x] [--seed N]\n");
 }
 
 int main(int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
 
     mpz_t m, m2;
 
     gmp_randstate_t rstate;
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+    if (!initRandState (rstate, seed)) {
+        fprintf (stderr, "Failed to seed random state, exiting\n");
+        exit (EXIT_FAILURE);
+    }
 
     bool verbose = false;
     bool extendedTests = false;
@@ -232,6 +238,106 @@ int main(int argc, char **argv) {
         mpz_clear (pMinus2);
     }
 
+    if (testFuncs) {
+        // Philox4x32-10 known answers from Random123
+        static const uint32_t counters[3][4] = {
+            { 0, 0, 0, 0 },
+            { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+            { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 } };
+        static const uint32_t keys[3][2] = {
+            { 0, 0 }, { 0xffffffff, 0xffffffff }, { 0xa4093822, 0x299f31d0 } };
+        static const uint32_t outputs[3][4] = {
+            { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+            { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+            { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } };
+        for (int i=0; i < 3; i++) {
+            uint32_t out[4];
+            philox4x32 (out, counters[i], keys[i]);
+            if (memcmp (out, outputs[i], sizeof (out)) != 0) {
+                printf ("ERR: Philox4x32-10 known answer %d\n", i);
+                returnValue = EXIT_FAILURE;
+            }
+        }
+
+        // the same seed and stream repeat, other streams differ
+        gmp_randstate_t s1, s2, s3;
+        randStateInitPhilox (s1, 12345, 0);
+        randStateInitPhilox (s2, 12345, 0);
+        randStateInitPhilox (s3, 12345, 1);
+        mpz_urandomb (m, s1, 200);
+        mpz_urandomb (m2, s2, 200);
+        if (mpz_cmp (m, m2) != 0) {
+            printf ("ERR: random stream does not repeat\n");
+            returnValue = EXIT_FAILURE;
+        }
+        mpz_urandomb (m2, s3, 200);
+        if (mpz_cmp (m, m2) == 0) {
+            printf ("ERR: random streams are the same\n");
+            returnValue = EXIT_FAILURE;
+        }
+        gmp_randclear (s1); gmp_randclear (s2); gmp_randclear (s3);
+
+        // through each of GMP's entries: a copy goes on from the same place,
+        // a new seed starts the stream again, urandomm stays below its bound
+        mpz_t seed, bound;
+        mpz_init_set_ui (seed, 999);
+        mpz_init_set_str (bound, "1000000000000000000000000000039", 10);
+        randStateInitPhilox (s1, 777, 3);
+        mpz_urandomb (m, s1, 100);
+        gmp_randinit_set (s2, s1);
+        mpz_urandomb (m, s1, 300);
+        mpz_urandomb (m2, s2, 300);
+        if (mpz_cmp (m, m2) != 0) {
+            printf ("ERR: copied random state does not go on the same\n");
+            returnValue = EXIT_FAILURE;
+        }
+        gmp_randseed (s2, seed);
+        randStateInitPhilox (s3, 999, 3);
+        mpz_urandomb (m, s2, 300);
+        mpz_urandomb (m2, s3, 300);
+        if (mpz_cmp (m, m2) != 0) {
+            printf ("ERR: reseeded random state does not restart its stream\n");
+            returnValue = EXIT_FAILURE;
+        }
+        for (int i=0; i < 100; i++) {
+            mpz_urandomm (m, s2, bound);
+            mpz_urandomm (m2, s3, bound);
+            if (mpz_cmp (m, m2) != 0 || mpz_sgn (m) < 0 || mpz_cmp (m, bound) >= 0) {
+                printf ("ERR: mpz_urandomm on a Philox state\n");
+                returnValue = EXIT_FAILURE;
+                break;
+            }
+        }
+        // moving a state to another stream starts it as a new state would
+        randStateInitPhilox (s1, 777, 3);
+        mpz_urandomb (m, s1, 100);
+        randStateSetStream (s1, 999, 3);
+        randStateInitPhilox (s3, 999, 3);
+        mpz_urandomb (m, s1, 300);
+        mpz_urandomb (m2, s3, 300);
+        if (mpz_cmp (m, m2) != 0) {
+            printf ("ERR: random state moved to another stream does not start it\n");
+            returnValue = EXIT_FAILURE;
+        }
+        gmp_randclear (s1); gmp_randclear (s2); gmp_randclear (s3);
+        mpz_clear (seed); mpz_clear (bound);
+
+        // the prime search gives the same cryptosystem on any number of
+        // threads
+        randStateInitPhilox (s1, 4242, 0);
+        randStateInitPhilox (s2, 4242, 0);
+        ElgamalCryptosystem one (256, 128, s1, 0, 16, 1);
+        ElgamalCryptosystem several (256, 128, s2, 0, 16, 4);
+        if (one.hasMallocError () || several.hasMallocError ()
+                || mpz_cmp (one.prime, several.prime) != 0
+                || mpz_cmp (one.base, several.base) != 0
+                || mpz_cmp (one.enc, several.enc) != 0) {
+            printf ("ERR: the cryptosystem for a seed depends on the threads\n");
+            returnValue = EXIT_FAILURE;
+        }
+        gmp_randclear (s1); gmp_randclear (s2);
+    }
+
     mpz_clear (ct.gk);
     mpz_clear (ct.myk);
     mpz_clear (m);
@@ -16,25 +16,32 @@
 #include "include/elgamal.h"
 
 void usage (char *argv0) {
-    printf ("%s [-v] [-m msgBits] [-c count] cryptoSystemFilePath\n", argv0);
+    printf ("%s [-v] [-m msgBits] [-c count] [--seed N] cryptoSystemFilePath\n", argv0);
 }
 
 // TODO: requires factoring of n?
 //bool isPrimitive (mpz_t a, mpz_t n);
 
+double elapsed (const timeval &start, const timeval &end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
 int main(int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
 
 
     gmp_randstate_t rstate;
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+    if (!initRandState (rstate, seed)) {
+        fprintf (stderr, "Failed to seed random state, exiting\n");
+        exit (EXIT_FAILURE);
+    }
 
     bool verbose = false;
     char *filePath = NULL;
     
     char *endptr;
     int opt;
-    int count = 0;
+    int count = 100;
     unsigned int messageBits = 0;
     while ((opt = getopt (argc, argv, "m:c:v")) != -1) {
         switch (opt) {
@@ -109,35 +116,54 @@ int main(int argc, char **argv) {
         mpz_sub_ui (max, max, 1);
     }
 
-    timeval start, end;
-    gettimeofday (&start, NULL);
+    // one pass with mpz_powm, then one with the fixed base tables
+    int errors = 0;
+    double rate[2];
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            timeval start, end;
+            gettimeofday (&start, NULL);
+            if (!e->precomputeEncryption ()) {
+                printf ("Failed to allocate the fixed base tables\n");
+                returnValue = EXIT_FAILURE;
+                break;
+            }
+            gettimeofday (&end, NULL);
+            printf ("[%u %s]: precomputation %.3f s\n", messageBits, filePath,
+                    elapsed (start, end));
+        }
 
-    for (int i=count; i > 0; i--) {
-        mpz_urandomm (m, rstate, max); // 0 to max-1
-        mpz_add_ui (m, m, 1); // 1 to max
+        double encryptTime = 0;
+        for (int i=count; i > 0; i--) {
+            mpz_urandomm (m, rstate, max); // 0 to max-1
+            mpz_add_ui (m, m, 1); // 1 to max
 
-        //if (verbose)
-        //    gmp_printf ("%d: %Zd\n", i, m);
+            if (verbose)
+                gmp_printf ("%d: %Zd\n", i, m);
 
-        //e->encrypt (&ct, m, rstate);
-        //e->decrypt (m2, ct);
-    }
-    
-    gettimeofday (&end, NULL);
+            timeval start, end;
+            gettimeofday (&start, NULL);
+            e->encrypt (&ct, m, rstate);
+            gettimeofday (&end, NULL);
+            encryptTime += elapsed (start, end);
 
-    long sdiff = end.tv_sec - start.tv_sec;
-    long udiff = 0;
-    if (start.tv_usec > end.tv_usec) {
-        sdiff--;
-        udiff = 1000000l - start.tv_usec + end.tv_usec;
-    } else {
-        udiff = end.tv_usec - start.tv_usec;
+            e->decrypt (m2, ct);
+            if (mpz_cmp (m, m2) != 0)
+                errors++;
+        }
+
+        rate[pass] = (encryptTime > 0) ? count / encryptTime : 0;
+        printf ("[%u %s]: %s: %d encryptions in %.3f s, %.1f per second\n", messageBits,
+                filePath, pass == 0 ? "powm" : "fixed base", count, encryptTime, rate[pass]);
     }
 
-    ldiv_t min = ldiv (sdiff, 60);
-    ldiv_t msec = ldiv (udiff, 1000);
-    printf ("[%u %s]: %ldmin %lds %ldms %ldus (%ld.%6ld tot sec)\n", messageBits, filePath,
-            min.quot, min.rem, msec.quot, msec.rem, sdiff, udiff);
+    if (returnValue == EXIT_SUCCESS && rate[0] > 0)
+        printf ("[%u %s]: speedup %.2f\n", messageBits, filePath, rate[1] / rate[0]);
+
+    if (errors > 0) {
+        printf ("ERR: %d messages did not decrypt correctly\n", errors);
+        returnValue = EXIT_FAILURE;
+    }
 
     delete (e);
 
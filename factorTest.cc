@@ -25,10 +25,11 @@
 #include "include/randomhelpers.h"
 
 void usage (char *argv0) {
-    printf ("%s -r bits | integer\n", argv0);
+    printf ("%s [--seed N] -r bits | integer\n", argv0);
 }
 
 int main(int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
 
     unsigned long bits = 0;
     char *endptr;
@@ -59,8 +60,10 @@ int main(int argc, char **argv) {
 
     gmp_randstate_t rstate;
 
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+    if (!initRandState (rstate, seed)) {
+        fprintf (stderr, "Failed to seed random state, exiting\n");
+        exit (EXIT_FAILURE);
+    }
 
     CFactoredInteger fi;
     if (bits > 0) {
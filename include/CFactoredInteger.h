@@ -30,6 +30,9 @@ class CFactoredInteger {
         // up to and including index
         bool ensureMallocInitTo (size_t index, bool exactSize = false);
 
+        // one accepted RFN run, primes go to factors[*last + 1 ...]
+        bool randomRun (mpz_t v, mpz_t max, gmp_randstate_t rstate, int *last);
+
     public:
         unsigned int nFactors;
         PrimePower *factors;
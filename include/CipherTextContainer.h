@@ -0,0 +1,82 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  CipherTextContainer.h
+ *
+ *    Description:  Many ciphertexts for one cryptosystem in a single file,
+ *                  as fixed size records which are memory mapped.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _CipherTextContainer_h
+#define _CipherTextContainer_h
+
+#define CIPHERTEXT_CONTAINER_MAGIC "ELGCTC1"
+#define CIPHERTEXT_CONTAINER_BYTE_ORDER 0x01020304u
+
+/*
+ * The file starts with this header, in the byte order of the machine which
+ * wrote it. Then follow count records of three values m, g^k and m*y^k,
+ * each stored as limbs limbs of limbBits bits, least significant first and
+ * padded with zeros. A record is 3 * limbs limbs, so record i can be found
+ * without reading the ones before it.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t limbBits;
+    uint64_t limbs;          // per value, the size of the prime
+    uint64_t count;
+    uint64_t fingerprint;    // of the cryptosystem, see elgamalFingerprint
+    uint64_t reserved[3];
+} CipherTextContainerHeader;
+
+// Hash of the public key (prime, base, baseOrder and enc), so that a
+// container is not used with the wrong cryptosystem.
+uint64_t elgamalFingerprint (ElgamalCryptosystem *e);
+
+class CipherTextContainer {
+    private:
+        bool error;
+        int fd;
+        void *map;
+        size_t mapLength;
+        mp_limb_t *records;
+        size_t stride;       // limbs per record
+
+        bool mapFile (const char *fileName, bool writable);
+
+    public:
+        uint64_t count;
+        uint64_t fingerprint;
+        size_t limbs;
+
+        // open an existing container read only
+        CipherTextContainer (const char *fileName);
+        // create a container for count ciphertexts of e, to be filled with set
+        CipherTextContainer (const char *fileName, ElgamalCryptosystem *e, uint64_t count);
+        ~CipherTextContainer ();
+
+        // false if the file could not be opened, mapped or is not a container
+        // written with the same limb size and byte order
+        bool hasError () { return error; }
+
+        // The limbs of record i, m first, for slicing without copying.
+        const mp_limb_t *record (uint64_t i) { return records + i * stride; }
+
+        // Copy record i out; m may be NULL.
+        void get (uint64_t i, mpz_t m, ElgamalCipherText *ct);
+        // Store record i. Different records may be set from different threads.
+        // Returns false, writing nothing, if a value has more limbs than the
+        // prime of the container.
+        bool set (uint64_t i, const mpz_t m, const ElgamalCipherText ct);
+
+        // true if fileName has the .ctc extension used for containers
+        static bool isContainerName (const char *fileName);
+};
+#endif
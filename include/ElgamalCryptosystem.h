@@ -1,11 +1,16 @@
 #ifndef _ElgamalCryptosystem_h
 #define _ElgamalCryptosystem_h
+
+class FixedBasePowm;
+
 class ElgamalCryptosystem {
     private:
         bool init ();
         void findSGenerator (gmp_randstate_t rstate);
         mpz_t baseOrderMinus1;
         bool mallocError;
+        FixedBasePowm *basePowm, *encPowm;   // NULL until precomputeEncryption
+        void clearPrecomputation ();
 
     public:
 //        char * label;
@@ -25,12 +30,17 @@ class ElgamalCryptosystem {
 
         ElgamalCryptosystem ();
 
+        // The search for p runs on threads workers, 0 for one per online
+        // processor, or in the calling thread with 1. The result only
+        // depends on rstate, however many threads there are.
+
         // use for baseOrder != p-1
         ElgamalCryptosystem (unsigned int primeBits, unsigned int baseOrderBits, gmp_randstate_t rstate,
-                             unsigned int smoothBits = 0, unsigned int smoothnessBitLimit = 16);
+                             unsigned int smoothBits = 0, unsigned int smoothnessBitLimit = 16,
+                             unsigned int threads = 1);
 
         // use for baseOrder = p-1
-        ElgamalCryptosystem (unsigned int primeBits, gmp_randstate_t rstate);
+        ElgamalCryptosystem (unsigned int primeBits, gmp_randstate_t rstate, unsigned int threads = 1);
 
         ~ElgamalCryptosystem ();
 
@@ -40,6 +50,13 @@ class ElgamalCryptosystem {
         int read  (FILE *f);
         int write (FILE *f);
 
+        // Build tables of powers of base and enc, after which encrypt is
+        // several times faster. They take 2^FIXED_BASE_WINDOW_BITS residues
+        // per FIXED_BASE_WINDOW_BITS bits of baseOrder each, about 1.4 MB
+        // for 1024 bits. Returns false if they could not be allocated.
+        bool precomputeEncryption ();
+
+        // may be called from several threads once precomputeEncryption is done
         void encrypt (ElgamalCipherText *ct, const mpz_t m, gmp_randstate_t rstate);
         void decrypt (mpz_t m, const ElgamalCipherText ct);
 
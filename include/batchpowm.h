@@ -0,0 +1,81 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  batchpowm.h
+ *
+ *    Description:  Many small bases raised to the same exponent modulo the
+ *                  same p, several at a time in SIMD lanes.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _batchpowm_h
+#define _batchpowm_h
+
+// Kernels for BatchPowm. AUTO picks the fastest one the processor supports,
+// see batchPowmBestKernel.
+#define BATCH_POWM_AUTO   0
+#define BATCH_POWM_SCALAR 1   // mpz_powm, one base at a time
+#define BATCH_POWM_AVX2   2   // 4 lanes of 26 bit digits
+#define BATCH_POWM_IFMA   3   // 8 lanes of 52 bit digits, AVX-512 IFMA
+
+// window size for the lane exponentiation
+#define BATCH_POWM_WINDOW_BITS 4
+
+/*
+ * The SIMD kernels run one Montgomery exponentiation per lane, in lockstep,
+ * since the exponent and modulus are the same for all of them. The digits
+ * of each lane are kept in a redundant form with lazy carries, and with
+ * R = 2^(digits * digitBits) > 4p no lane ever needs a conditional
+ * subtraction until the result is converted back.
+ *
+ * The kernel is chosen at run time, so the same binary works on any x86-64
+ * processor. Holds scratch space, so it must not be shared between threads.
+ */
+class BatchPowm {
+    private:
+        bool mallocError;
+        unsigned int kernel;
+        unsigned int lanes;
+        mpz_t p, e, tmp;
+
+        // lane representation, every array holds digits vectors of lanes
+        // uint64_t values
+        unsigned int digitBits;
+        unsigned int digits;
+        uint64_t *pDigits;      // p in every lane
+        uint64_t *pInv;         // -p^-1 mod 2^digitBits in every lane
+        uint64_t *r2;           // R^2 mod p in every lane
+        uint64_t *one;          // 1 in every lane
+        uint64_t *window;       // 2^BATCH_POWM_WINDOW_BITS powers of the bases
+        uint64_t *x;
+        uint64_t *t;            // 2 digits + 1 vectors for products
+        unsigned char *exponentWindows;
+        size_t windowCount;
+
+        void powLanes (mpz_t *r, const unsigned long *bases, size_t count);
+
+    public:
+        BatchPowm (const mpz_t p, const mpz_t e, unsigned int kernel=BATCH_POWM_AUTO);
+        ~BatchPowm ();
+
+        bool hasMallocError () { return mallocError; }
+        unsigned int getKernel () { return kernel; }
+        // bases per batch which fill every lane
+        unsigned int getLanes () { return lanes; }
+
+        // r[k] = bases[k]^e mod p, r must be initialized
+        void powm (mpz_t *r, const unsigned long *bases, size_t count);
+};
+
+// the best kernel this processor supports
+unsigned int batchPowmBestKernel ();
+const char *batchPowmKernelName (unsigned int kernel);
+// returns BATCH_POWM_AUTO for an unknown name
+unsigned int batchPowmKernelFromName (const char *name);
+
+#endif
@@ -1,20 +1,129 @@
 #ifndef _dlog_h
 #define _dlog_h
+
+// Subgroups of prime order q up to this size get a table of every power of
+// their generator, so a log costs a single lookup.
+#define PH_TABLE_FULL_LIMIT (1u << 16)
+
+// Larger subgroups use baby-step giant-step with at most this many baby
+// steps, and fall back to pollard_rho beyond that.
+#define PH_TABLE_MAX_BABY_STEPS (1u << 16)
+
+// Subgroups without a table whose order has at least this many bits use
+// pollard_rho_parallel, if the context was given more than one thread.
+#define PH_PARALLEL_RHO_MIN_BITS 32
+
+/*
+ * Constants for one prime power q^c of the group order n, which depend
+ * only on alpha, p and n.
+ */
+typedef struct {
+    mpz_t q;
+    unsigned int power;
+    mpz_t ndivqc;    // n / q^c, only used to set up the context
+    mpz_t alphaInv;  // alpha^-(n/q^c), inverse of the generator of the subgroup of order q^c
+    mpz_t alphaBar;  // alpha^(n/q), generates the subgroup of order q
+    mpz_t *qPowers;  // qPowers[j] = q^j, 0 <= j < c
+    mpz_t crt;       // CRT coefficient, 1 mod q^c and 0 mod n/q^c
+
+    // Lookup table for logs base alphaBar. Keys are the low 64 bits of
+    // alphaBar^k mod p, for 0 <= k < babySteps. babySteps is 0 if there
+    // is no table.
+    size_t babySteps;
+    size_t giantSteps;
+    mpz_t giantStep;       // alphaBar^-babySteps
+    unsigned int tableShift;
+    uint64_t *tableKeys;
+    UIntType *tableValues; // UINT32_MAX marks an empty slot
+} PHFactorData;
+
 /*
- * These defines are a dirty hack to make calling pohlig_hellman with pre-initialized
- * mpz_t variables easier. We will be calling the function so many times that it could have
- * significant performance advantages.
+ * Pohlig-Hellman for a fixed alpha, p and factored group order n. All
+ * values which do not depend on beta are computed once by the constructor,
+ * so repeated calls to log only do the beta dependent work. maxBabySteps
+ * limits the size of the subgroup lookup tables, 0 disables them.
+ *
+ * The per factor constants and tables can be saved with write and given
+ * back to the constructor as saved, which then reads them instead of
+ * computing them. Nothing in saved identifies alpha and p, so the caller
+ * must make sure it was written for the same ones; the factors, their
+ * powers and maxBabySteps are checked, and whatever does not match is
+ * computed as usual.
+ *
+ * Also holds the scratch variables, so a context must not be shared
+ * between threads.
  */
-#define DECLARE_PH_LOCALS mpz_t xi, q, qj, lj, ndivq, alphaBar, betaBar, betaStripped, alphaStrip, x, a, b, x1, a1, b1, alphaPower;
-#define INIT_PH_LOCALS(prime) mpz_init (xi); mpz_init (q); mpz_init (qj); mpz_init (lj); mpz_init (ndivq); mpz_init2 (alphaBar, mpz_sizeinbase(prime,2)); mpz_init (betaBar); mpz_init2 (betaStripped, mpz_sizeinbase(prime,2)); mpz_init (alphaStrip); mpz_init (x); mpz_init (a); mpz_init (b); mpz_init (x1); mpz_init (a1); mpz_init (b1); mpz_init2 (alphaPower, mpz_sizeinbase(prime,2));
-#define LIST_PH_LOCALS xi, q, qj, lj, ndivq, alphaBar, betaBar, betaStripped, alphaStrip, x, a, b, x1, a1, b1, alphaPower
-#define CLEAR_PH_LOCALS mpz_clear (xi); mpz_clear (q); mpz_clear (qj); mpz_clear (lj); mpz_clear (ndivq); mpz_clear (alphaBar); mpz_clear (betaBar); mpz_clear (betaStripped); mpz_clear (alphaStrip); mpz_clear (x); mpz_clear (a); mpz_clear (b); mpz_clear (x1); mpz_clear (a1); mpz_clear (b1); mpz_clear (alphaPower);
-#define PH_ARG_LIST mpz_t xi, mpz_t q, mpz_t qj, mpz_t lj, mpz_t ndivq, mpz_t alphaBar, mpz_t betaBar, mpz_t betaStripped, mpz_t alphaStrip, mpz_t x, mpz_t a, mpz_t b, mpz_t x1, mpz_t a1, mpz_t b1, mpz_t alphaPower
- 
+class PohligHellmanContext {
+    private:
+        bool mallocError;
+        mpz_t p;
+        mpz_t n;
+        unsigned int nFactors;
+        PHFactorData *factors;
+        unsigned int threads;
+        unsigned int parallelMinBits;
+        size_t maxBabySteps;
+
+        // Product tree over the prime powers q^c of n, heap numbered from 1.
+        // treeExp[k] is the exponent taking the value at the parent of node
+        // k to the value at node k, which is the product of the prime powers
+        // under the sibling of k. The leaves are beta^(n/q^c).
+        mpz_t *treeExp;
+        unsigned int treeSize;
+        mpz_t *treeScratch;  // one per tree level
+        mpz_t *projections;  // beta^(n/q^c) for each factor, for log
+
+        mpz_t gamma, betaStripped, betaBar, xi, lj, tmp;
+        mpz_t x, a, b, x1, a1, b1, alphaPower;
+
+        bool buildTable (PHFactorData *f, size_t maxBabySteps);
+        bool readFactor (PHFactorData *f, FILE *saved);
+        void buildTree (unsigned int node, unsigned int lo, unsigned int hi, CFactoredInteger *n);
+        void project (mpz_t *out, unsigned int node, unsigned int lo, unsigned int hi,
+                      mpz_t x, unsigned int depth);
+        void subgroupLog (mpz_t result, PHFactorData *f, mpz_t beta, gmp_randstate_t rstate);
+        void primePowerLog (mpz_t result, PHFactorData *f, mpz_t gamma, gmp_randstate_t rstate);
+
+    public:
+        PohligHellmanContext (mpz_t alpha, mpz_t p, CFactoredInteger *n,
+                              size_t maxBabySteps=PH_TABLE_MAX_BABY_STEPS,
+                              FILE *saved=NULL);
+        ~PohligHellmanContext ();
+
+        bool hasMallocError () { return mallocError; }
+
+        // Write the per factor constants and tables for the constructor's
+        // saved argument. Returns false on a write error.
+        bool write (FILE *f);
+
+        // threads == 0 uses one thread per online processor
+        void setThreads (unsigned int threads, unsigned int minBits=PH_PARALLEL_RHO_MIN_BITS) {
+            this->threads = threads;
+            parallelMinBits = minBits;
+        }
+
+        // Sets mallocError, checked with hasMallocError, if a rho walk could
+        // not be allocated.
+        void log (mpz_t result, mpz_t beta, gmp_randstate_t rstate);
+
+        // Logs of count betas into results, which must be initialized. This
+        // works through the factors one at a time for the whole batch, so
+        // only one lookup table is in use at a time. Returns false if the
+        // scratch space or a rho walk could not be allocated.
+        bool logBatch (mpz_t *results, mpz_t *betas, size_t count, gmp_randstate_t rstate);
+};
+
+// outcome of a single rho walk
+typedef enum { RHO_RETRY, RHO_FOUND, RHO_MALLOC_ERROR } RhoOutcome;
+
+// Returns the number of walks it took, or 0 if memory could not be allocated.
 int pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_randstate_t rstate);
-bool pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_randstate_t rstate, bool randomStart,
-                  mpz_t x, mpz_t a, mpz_t b, mpz_t x1, mpz_t a1, mpz_t b1);
+RhoOutcome pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_randstate_t rstate, bool randomStart,
+                        mpz_t x, mpz_t a, mpz_t b, mpz_t x1, mpz_t a1, mpz_t b1);
+bool pollard_rho_parallel (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
+                           gmp_randstate_t rstate, unsigned int threads);
 
-void pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n, mpz_t beta, gmp_randstate_t rstate);
-void pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n, mpz_t beta, gmp_randstate_t rstate, PH_ARG_LIST);
+// false if memory could not be allocated
+bool pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n, mpz_t beta, gmp_randstate_t rstate,
+                     unsigned int threads=1);
 #endif
@@ -15,6 +15,14 @@ void elgamalEncrypt (ElgamalCipherText *ct, const mpz_t m,
 void elgamalDecrypt (mpz_t m, const ElgamalCipherText ct,
                               const mpz_t p, const mpz_t x);
 
+class FixedBasePowm;
+
+// elgamalEncrypt with g^k and y^k from precomputed tables, drawing k the
+// same way
+void elgamalEncryptFixedBase (ElgamalCipherText *ct, const mpz_t m, const mpz_t p,
+                              FixedBasePowm *g, const mpz_t nMinus1,
+                              FixedBasePowm *y, gmp_randstate_t rstate);
+
 int elgamalWriteCipherText (FILE *f, const ElgamalCipherText ct);
 int  elgamalReadCipherText (ElgamalCipherText ct, FILE *f);
 
@@ -0,0 +1,67 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  factor.h
+ *
+ *    Description:  Integer factoring by trial division, Pollard-Brent rho and
+ *                  the elliptic curve method, for CFactoredInteger.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _factor_h
+#define _factor_h
+
+// Trial division uses the primes below this bound. Whatever is left after
+// it is split with rho and ECM.
+#define FACTOR_TRIAL_LIMIT (1u << 16)
+
+// Iterations of rho on a multi limb cofactor before switching to ECM.
+// Enough to find factors of about 24 bits.
+#define FACTOR_RHO_MAX_ITERATIONS (1ul << 12)
+
+/*
+ * Growable list of primes, in the order they were found.
+ */
+typedef struct {
+    size_t length;
+    size_t size;
+    mpz_t *primes;
+} FactorList;
+
+void factorListInit (FactorList *list);
+void factorListClear (FactorList *list);
+void factorListSort (FactorList *list);
+
+// Candidates for isProbablePrime are first divided by the primes below
+// this bound.
+#define FACTOR_PREFILTER_LIMIT 1000
+
+// Exact for every n < 2^64: a prime table lookup or deterministic
+// Miller-Rabin.
+bool isPrime64 (uint64_t n);
+
+// isPrime64 for n < 2^64, otherwise trial division by the primes below
+// FACTOR_PREFILTER_LIMIT and a Baillie-PSW test.
+bool isProbablePrime (const mpz_t n);
+
+/*
+ * Append the prime factors of n >= 1 to list, with multiplicity, and set
+ * cofactor to the part of n which was not factored.
+ *
+ * With factorBitLimit == 0 n is factored completely and cofactor is 1. If
+ * it is set, only prime factors of at most that many bits are kept. Up to
+ * 16 bits, or when the rest of n fits in 64 bits, the split is exact. Beyond
+ * that, a composite part whose factors are all larger is recognized by
+ * running out of rho and ECM effort sized for factorBitLimit bits, so a
+ * small factor is missed with low probability.
+ *
+ * Factors above 64 bits are only known to be prime by isProbablePrime.
+ * Returns false if memory allocation fails.
+ */
+bool factorInteger (FactorList *list, mpz_t cofactor, const mpz_t n, unsigned int factorBitLimit=0);
+#endif
@@ -0,0 +1,53 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  fixedbase.h
+ *
+ *    Description:  Powers of a fixed base modulo a fixed p from a table of
+ *                  precomputed powers.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _fixedbase_h
+#define _fixedbase_h
+
+// Bits of the exponent per table row. The table has 2^w - 1 residues per
+// row, so 6 bits and a 1024 bit p and exponent take about 1.4 MB.
+#define FIXED_BASE_WINDOW_BITS 6
+
+class MontgomeryContext;
+
+/*
+ * The exponent is split into w bit digits d_i, and
+ * g^e = prod g^(d_i 2^(w i)), where every factor is read from the table, so
+ * a power takes one multiplication per nonzero digit and no squarings.
+ *
+ * powm may be called from several threads at once.
+ */
+class FixedBasePowm {
+    private:
+        bool mallocError;
+        MontgomeryContext *mont;
+        mp_limb_t *table;          // row i, column d - 1: g^(d 2^(w i))
+        unsigned int windowBits;
+        size_t rows;
+        size_t exponentBits;
+        mpz_t base, modulus;       // for exponents beyond the table
+
+    public:
+        // exponents up to exponentBits bits use the table
+        FixedBasePowm (const mpz_t base, const mpz_t p, size_t exponentBits,
+                       unsigned int windowBits = FIXED_BASE_WINDOW_BITS);
+        ~FixedBasePowm ();
+
+        bool hasMallocError () { return mallocError; }
+
+        // r = base^e mod p for e >= 0
+        void powm (mpz_t r, const mpz_t e);
+};
+#endif
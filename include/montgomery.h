@@ -0,0 +1,82 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  montgomery.h
+ *
+ *    Description:  Montgomery arithmetic modulo a fixed odd number, usually
+ *                  a prime, on fixed length limb buffers.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _montgomery_h
+#define _montgomery_h
+
+// window size used by MontgomeryContext::powm
+#define MONT_WINDOW_BITS 4
+
+/*
+ * Residues are arrays of exactly n limbs holding x R mod p, where
+ * R = 2^(n GMP_NUMB_BITS), and are always fully reduced so that two residues
+ * are equal iff their limbs are. Everything works on the mpn layer, so the
+ * inner loops never allocate or normalize.
+ *
+ * The context has scratch space, so it must not be shared between threads.
+ * Results may alias inputs unless noted.
+ */
+class MontgomeryContext {
+    private:
+        bool mallocError;
+        mp_limb_t *scratch;   // 2n + 2 limbs for products
+        mp_limb_t *window;    // powm table, 2^MONT_WINDOW_BITS residues
+        mp_limb_t *conv;      // one residue for conversions
+        mpz_t modulus;
+        mpz_t tmp;
+
+        void redc (mp_limb_t *r, mp_limb_t *t);
+
+    public:
+        mp_size_t n;          // limbs in p
+        mp_limb_t *p;
+        mp_limb_t pInv;       // -p^-1 mod 2^GMP_NUMB_BITS
+        mp_limb_t *one;       // R mod p, 1 as a residue
+        mp_limb_t *r2;        // R^2 mod p
+
+        MontgomeryContext (const mpz_t p);
+        ~MontgomeryContext ();
+
+        bool hasMallocError () { return mallocError; }
+
+        // count residues, free with free ()
+        mp_limb_t *allocResidues (size_t count);
+
+        void mul (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b);
+        // mul and fromMont with a caller owned scratch of 2n + 2 limbs, so
+        // threads may share a context as long as they only use these
+        void mul (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mp_limb_t *scratch);
+        void sqr (mp_limb_t *r, const mp_limb_t *a);
+        void add (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b);
+        void sub (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b);
+
+        void toMont (mp_limb_t *r, const mpz_t x);
+        void fromMont (mpz_t r, const mp_limb_t *a);
+        void fromMont (mpz_t r, const mp_limb_t *a, mp_limb_t *scratch);
+
+        void set (mp_limb_t *r, const mp_limb_t *a) { mpn_copyi (r, a, n); }
+        bool equal (const mp_limb_t *a, const mp_limb_t *b) { return mpn_cmp (a, b, n) == 0; }
+
+        // r = base^e, r must not alias base
+        void powm (mp_limb_t *r, const mp_limb_t *base, const mpz_t e);
+
+        // a must be invertible mod p
+        void invert (mp_limb_t *r, const mp_limb_t *a);
+        // r[k] = a[k]^-1 for count residues stored back to back, with one
+        // inversion and 3 (count - 1) multiplications. scratch holds count
+        // residues, and r must not alias a.
+        void batchInvert (mp_limb_t *r, const mp_limb_t *a, size_t count, mp_limb_t *scratch);
+};
+#endif
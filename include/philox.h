@@ -0,0 +1,51 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  philox.h
+ *
+ *    Description:  Counter based random streams, and a GMP random state
+ *                  which draws from them.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _philox_h
+#define _philox_h
+
+/*
+ * Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+ * 3", SC 2011) maps a 128 bit counter and a 64 bit key to 128 random bits
+ * with ten rounds of multiplications. Block b of stream s for seed k is
+ * the output for key k and counter (b, s), so there is nothing to carry
+ * between threads: streams with the same seed and different numbers never
+ * overlap, and each is determined by (seed, stream) alone.
+ */
+typedef struct {
+    uint32_t key[2];
+    uint32_t counter[4];    // block in 0 and 1, stream in 2 and 3
+    uint32_t buffer[4];     // output for the block before counter
+    unsigned int used;      // words of buffer already returned
+} PhiloxStream;
+
+void philox4x32 (uint32_t out[4], const uint32_t counter[4], const uint32_t key[2]);
+
+void philoxStreamInit (PhiloxStream *s, uint64_t seed, uint64_t stream);
+uint32_t philoxStreamNext (PhiloxStream *s);
+
+// A GMP random state for mpz_urandomb and the like, drawing from stream of
+// seed. Free it with gmp_randclear; gmp_randinit_set copies the position
+// and gmp_randseed starts the same stream again under a new seed.
+void randStateInitPhilox (gmp_randstate_t state, uint64_t seed, uint64_t stream);
+
+// Move a state made by randStateInitPhilox to the start of stream of seed.
+// Drawing each piece of work, rather than each thread, from a stream of
+// its own keeps the results the same for any number of threads.
+void randStateSetStream (gmp_randstate_t state, uint64_t seed, uint64_t stream);
+
+// A seed drawn from state, for the streams of worker threads
+uint64_t randStateSeed (gmp_randstate_t state);
+#endif
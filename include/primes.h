@@ -0,0 +1,49 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  primes.h
+ *
+ *    Description:  Process wide table of small primes, sieved on demand.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _primes_h
+#define _primes_h
+
+// Default upper bound of the table. At 48 bits per 210 integers this is
+// about 2 MB once fully sieved.
+#define PRIME_TABLE_DEFAULT_LIMIT (1ul << 26)
+
+// Words of the bitmap sieved at a time, sized to stay in L1.
+#define PRIME_TABLE_SEGMENT_WORDS 4096
+
+/*
+ * The table stores one bit for each integer coprime to 2 3 5 7, so 48 bits
+ * for every 210 integers, and is sieved one segment at a time as lookups
+ * reach it. It is safe to use from several threads; only sieving a new
+ * segment takes a lock.
+ */
+
+// Raise the bound of the table. Has to be called before the first lookup,
+// after that it returns false if limit is above the bound in use.
+bool primeTableSetLimit (uint64_t limit);
+uint64_t primeTableLimit ();
+
+// Exact for n <= primeTableLimit (), which the caller has to check.
+bool primeTableIsPrime (uint64_t n);
+
+typedef struct {
+    uint64_t bit;    // next bitmap position to look at
+    uint64_t small;  // next of 2, 3, 5, 7 to return, 0 when done
+} PrimeIterator;
+
+// Iterate over the primes >= start in increasing order.
+void primeIteratorInit (PrimeIterator *it, uint64_t start);
+// Returns 0 once past primeTableLimit ().
+uint64_t primeIteratorNext (PrimeIterator *it);
+#endif
@@ -18,7 +18,16 @@
 #ifndef _randomhelpers_h
 #define _randomhelpers_h
 bool randomULong (unsigned long *out);
-bool seedRandState (gmp_randstate_t state);
+
+// Initializes state as stream 0 of seed (see philox.h), or of a seed read
+// from /dev/urandom if seed is NULL, and stores the seed in *seedUsed if
+// that is not NULL. Returns false if seed is not a number or urandom could
+// not be read.
+bool initRandState (gmp_randstate_t state, const char *seed, unsigned long long *seedUsed=NULL);
+
+// Removes --seed N or --seed=N from argv, before the options are parsed,
+// and returns N, or NULL if there is none. Exits if N is missing.
+const char *takeSeedOption (int *argc, char **argv);
 int randomNonIncreasingPrimeSequence (mpz_t *seq, const mpz_t max, gmp_randstate_t rstate);
 //FactoredInteger* randomFactoredInteger (mpz_t max, gmp_randstate_t rstate);
 //FactoredInteger* randomFactoredInteger (int maxBits, gmp_randstate_t rstate);
@@ -0,0 +1,99 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  splitestimate.h
+ *
+ *    Description:  Numerical estimate of the probability that a random
+ *                  integer splits into two factors of bounded size.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#ifndef _splitestimate_h
+#define _splitestimate_h
+
+// Log sizes are rounded to 1/4 bit, or coarser above 128 bits so that the
+// tables stay at SPLIT_ESTIMATE_MAX_STEPS steps. A query takes time about
+// cubic in the steps.
+#define SPLIT_ESTIMATE_STEPS_PER_BIT 4
+#define SPLIT_ESTIMATE_MAX_STEPS 512
+
+// Primes below 2^20 are weighted exactly, larger ones by Mertens' theorem.
+#define SPLIT_ESTIMATE_SIEVE_BITS 20
+
+// Largest prime factors placed exactly. With four a query takes about
+// 10ms at 64 bits and 0.1s at 128 or 256 bits; each more costs about the
+// number of steps again.
+#define SPLIT_ESTIMATE_DEFAULT_FACTORS 4
+#define SPLIT_ESTIMATE_MAX_FACTORS 6
+
+/*
+ * m, uniform on {1 ... 2^bits}, is built from its largest prime down as in
+ * Buchstab's identity: the share of integers below 2^x whose primes are all
+ * below 2^t is smooth(x, t) = 2^-x + sum over primes p < 2^t of
+ * 1/p smooth(x - log p, log p), a discrete form of Dickman's rho.
+ *
+ * The largest `factors` primes of m (with multiplicity) are placed in s1 or
+ * s2 exactly; the rest of m is treated as if it could be divided anywhere.
+ * So the estimate is an upper bound, falling to the sampled value as
+ * factors grows. Once b1 + b2 exceeds bits by SPLIT_ESTIMATE_MIN_SLACK or
+ * more bits the default is within about half a percent of splitProb's
+ * sampling. Below that the leftover has to be divided almost exactly and
+ * the bound is far off, the more so the larger bits is: sampled against
+ * estimated, in percent,
+ *
+ *   bits  b1  b2   sampled  k=4   k=6
+ *     64  31  32     11.3   13.0
+ *     64  32  32     17.4   22.7  20.0
+ *     64  32  33     28.9   29.3
+ *    128  64  64     14.6   21.1
+ *    128  64  65     23.4   25.0
+ *
+ * Finer steps do not help, and placing every prime means tracking every
+ * divisor. probability refuses those points, which have to be sampled.
+ */
+#define SPLIT_ESTIMATE_MIN_SLACK 2
+class SplitEstimator {
+    private:
+        bool mallocError;
+        unsigned int stepsPerBit;
+        unsigned int steps;          // bits * stepsPerBit
+        double *terminal;            // 2^-x for x steps
+        size_t *weightStart;         // of bin i in weights
+        double *weights;             // bin i, k primes: complete symmetric sum of 1/p
+        double *smooth;              // smooth[x * (steps + 2) + t], primes in bins < t
+
+        // used during probability
+        unsigned int top, b1Steps, b2Steps, factors;
+
+        double weight (unsigned int bin, unsigned int k) {
+            return weights[weightStart[bin] + k];
+        }
+        unsigned int weightCount (unsigned int bin) {
+            return weightStart[bin + 1] - weightStart[bin];
+        }
+        double smoothShare (unsigned int x, unsigned int t) {
+            return smooth[x * (steps + 2) + t];
+        }
+        double subtree (unsigned int tracked, unsigned int x, unsigned int cap,
+                        unsigned int placed, const unsigned int *sums, unsigned int nSums);
+
+    public:
+        unsigned int bits;
+
+        SplitEstimator (unsigned int bits);
+        ~SplitEstimator ();
+
+        bool hasMallocError () { return mallocError; }
+
+        // Probability that m = s1 s2 with s1 <= 2^b1 and s2 <= 2^b2, with
+        // up to SPLIT_ESTIMATE_MAX_FACTORS primes placed exactly. NaN if
+        // b1 + b2 < bits + SPLIT_ESTIMATE_MIN_SLACK, -1 on a malloc error.
+        double probability (unsigned int b1, unsigned int b2,
+                            unsigned int factors = SPLIT_ESTIMATE_DEFAULT_FACTORS);
+};
+#endif
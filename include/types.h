@@ -39,6 +39,28 @@ typedef struct {
     UIntTableEntry *entries;
 } UIntTable;
 
+// Table with 64 bit keys, stored as two parallel arrays so that the keys can
+// be scanned without touching the values.
+typedef struct {
+    size_t length;
+    uint64_t *keys;
+    UIntType *values;
+} UInt64Table;
+
+static inline uint64_t mpzGetUInt64 (const mpz_t x) {
+#if GMP_NUMB_BITS >= 64
+    return (uint64_t) mpz_getlimbn (x, 0);
+#else
+    return (uint64_t) mpz_getlimbn (x, 0) | ((uint64_t) mpz_getlimbn (x, 1) << GMP_NUMB_BITS);
+#endif
+}
+
+static inline void mpzSetUInt64 (mpz_t x, uint64_t v) {
+    mpz_set_ui (x, (unsigned long) (v >> 32));
+    mpz_mul_2exp (x, x, 32);
+    mpz_add_ui (x, x, (unsigned long) (v & 0xffffffffu));
+}
+
 /*
 typedef struct {
     PrimePower *factors;
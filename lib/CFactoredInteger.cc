@@ -10,6 +10,7 @@
 #include <gmp.h>
 
 #include "../include/types.h"
+#include "../include/factor.h"
 
 // WARNING: there is no proper copy operator
 
@@ -128,7 +129,8 @@ bool CFactoredInteger::factorValue (unsigned int n, unsigned int factorBitLimit)
     return isok;
 }
 
-// Factor using trial division. Not very efficient.
+// Factor with factorInteger, see factor.h. Factors are stored in
+// increasing order.
 bool CFactoredInteger::factorValue (mpz_t n, unsigned int factorBitLimit) { 
 
     if (factorsSize == 0 && mallocError)
@@ -136,72 +138,46 @@ bool CFactoredInteger::factorValue (mpz_t n, unsigned int factorBitLimit) {
 
     // if factorBitLimit is set, value may be set < n later
     mpz_set (value, n);
+    nFactors = 0;
 
-    if (mpz_probab_prime_p (n, 10)) {
+    if (isProbablePrime (n)) {
 
         if (!ensureMallocInitTo (0)) { return false; }
         mpz_set (factors[0].prime, value);
         factors[0].power = 1;
         nFactors = 1;
 
-    } else {
-
-        mpz_t y, q, r, p;
-        mpz_init_set (y, n);
-        mpz_init (q); mpz_init (r);
-        mpz_init_set_ui (p, 3);
-
-        nFactors = 0;
-        unsigned int power;
+    } else if (mpz_cmp_ui (n, 1) > 0) {
 
-        // check for powers of two
-        power = 0;
-        while (mpz_tstbit (y, power) == 0) {
-            power++;
-        }
-
-        int i = -1; // FIXME: might be to small
-        if (power > 0) {
-            mpz_fdiv_q_2exp (y, y, power);
+        FactorList list;
+        mpz_t cofactor;
+        factorListInit (&list);
+        mpz_init (cofactor);
 
-            if (!ensureMallocInitTo (0)) { return false; }
-            mpz_set_ui (factors[0].prime, 2);
-            factors[0].power = power;
+        bool isok = factorInteger (&list, cofactor, n, factorBitLimit);
+        if (!isok)
+            mallocError = true;
+        factorListSort (&list);
 
-            i++;
+        for (size_t k=0; isok && k < list.length; k++) {
+            if (nFactors > 0 && mpz_cmp (factors[nFactors - 1].prime, list.primes[k]) == 0) {
+                factors[nFactors - 1].power++;
+                continue;
+            }
+            if (!ensureMallocInitTo (nFactors)) {
+                isok = false;
+                break;
+            }
+            mpz_set (factors[nFactors].prime, list.primes[k]);
+            factors[nFactors].power = 1;
             nFactors++;
         }
+        mpz_divexact (value, n, cofactor);
 
-        do {
-            mpz_fdiv_qr (q, r, y, p);
-            if (mpz_cmp_ui (r, 0) == 0) {
-                mpz_set (y, q);
-
-                if (nFactors > 0 && mpz_cmp (factors[i].prime, p) == 0) {
-                    factors[i].power++;
-                } else {
-
-                    i++;
-                    nFactors++;
-                    
-                    // new factor found
-                    if (!ensureMallocInitTo (i)) { return false; }
-
-                    mpz_set (factors[i].prime, p);
-                    factors[i].power = 1;
-
-                }
-
-            } else {
-                mpz_add_ui (p, p, 2);
-                if (factorBitLimit > 0 && mpz_sizeinbase (p, 2) > factorBitLimit) {
-                    mpz_div (value, n, y);
-                    break;
-                }
-            }
-        } while (mpz_cmp_ui (y, 1) > 0);
-
-        mpz_clear (y); mpz_clear (q); mpz_clear (r); mpz_clear (p);
+        factorListClear (&list);
+        mpz_clear (cofactor);
+        if (!isok)
+            return false;
     }
 
     computePrimePowerValues ();
@@ -211,34 +187,75 @@ bool CFactoredInteger::factorValue (mpz_t n, unsigned int factorBitLimit) {
 }
 
 /*
- * Generate a random factored integer in {1 ... max} with a uniform
- * distribution using Victor Shoup's algorithm RFN (see p 298).
+ * One accepted run of Shoup's RFN on {1 ... max}: set v to a factored
+ * integer, uniform on {1 ... max}, and store its primes in non-increasing
+ * order in factors[*last + 1 ...], leaving *last at the final one. The
+ * primes are not merged with the ones already before them.
+ *
+ * While max fits in a word the run is done in word arithmetic with
+ * isPrime64. gmp_urandomm_ui takes the same bits from rstate as
+ * mpz_urandomm does for a one limb bound, so the output does not change.
  */
-bool CFactoredInteger::random (mpz_t max, gmp_randstate_t rstate) {
+bool CFactoredInteger::randomRun (mpz_t v, mpz_t max, gmp_randstate_t rstate, int *last) {
+    int first = *last;
+    int i;
+
+    if (mpz_fits_ulong_p (max)) {
+        unsigned long wordMax = mpz_get_ui (max);
+        unsigned long w, n, currentFactor, currentMax;
+        while (true) {
+            w = 1;
+            currentFactor = 0;
+            i = first;
+            currentMax = wordMax;
+            do {
+                n = gmp_urandomm_ui (rstate, currentMax) + 1;
+                if (isPrime64 (n)) {
+                    if (n > wordMax / w) {
+                        w = 0; // product is above max
+                        break;
+                    }
+                    w *= n;
+                    if (n != currentFactor) {
+                        i++;
+                        if (!ensureMallocInitTo (i)) { return false; }
+                        currentFactor = n;
+                        mpz_set_ui (factors[i].prime, n);
+                        factors[i].power = 1;
+                    } else {
+                        factors[i].power++;
+                    }
+                }
+                currentMax = n;
+            } while (currentMax > 1);
+
+            if (w > 0 && w >= gmp_urandomm_ui (rstate, wordMax) + 1) {
+                mpz_set_ui (v, w);
+                *last = i;
+                return true;
+            }
+        }
+    }
 
-    if (factorsSize == 0 && mallocError)
-        return false;
     mpz_t x, currentFactor, currentMax, n;
     mpz_init (x); mpz_init (currentFactor); mpz_init (currentMax); mpz_init (n);
 
-    int i;
     bool done = false;
     while (!done) {
-        mpz_set_ui (value, 1);
+        mpz_set_ui (v, 1);
         mpz_set_ui (currentFactor, 0);
 
         // generate random sequence using RN and save the primes
-        i = -1;
+        i = first;
         mpz_set (currentMax, max);
         do {
             mpz_urandomm (n, rstate, currentMax); // between 0 and currentMax - 1
             mpz_add_ui (n, n, 1); // now between 1 and currentMax
-            if (mpz_probab_prime_p (n, 10)) {
+            if (isProbablePrime (n)) {
 
-                mpz_mul (value, value, n);
+                mpz_mul (v, v, n);
 
-                if (mpz_cmp (value, max) > 0) {
-                    //printf ("value too big, breaking\n");
+                if (mpz_cmp (v, max) > 0) {
                     break;
                 }
 
@@ -246,47 +263,60 @@ bool CFactoredInteger::random (mpz_t max, gmp_randstate_t rstate) {
 
                     i++;
 
-                    if (!ensureMallocInitTo (i)) { return false; }
+                    if (!ensureMallocInitTo (i)) {
+                        mpz_clear (x); mpz_clear (currentFactor); mpz_clear (currentMax); mpz_clear (n);
+                        return false;
+                    }
 
                     mpz_set (currentFactor, n);
-                    //gmp_printf ("currentFactor = %Zd\n", currentFactor);
-                    //gmp_printf ("seq[i] = %Zd\n", seq[i]);
-                    //gmp_printf ("factorIndex = %d\n", factorIndex);
-
                     mpz_set (factors[i].prime, n);
                     factors[i].power = 1;
 
                 } else {
                     factors[i].power++;
-                    //gmp_printf ("Inc power for index %d, value %Zd\n", i, currentFactor);
                 }
 
             }
 
             mpz_set (currentMax, n);
-            
+
         } while (mpz_cmp_ui (currentMax, 1) > 0);
 
         // now test if we generated a suitible factored integer
-        if (mpz_cmp_ui (value, 0) > 0 && mpz_cmp (value, max) <= 0) {
+        if (mpz_cmp_ui (v, 0) > 0 && mpz_cmp (v, max) <= 0) {
             mpz_urandomm (x, rstate, max);
             mpz_add_ui (x, x, 1);
-            //gmp_printf ("    x = %Zd\n", x);
-            if (mpz_cmp (value, x) >= 0) {
-                    done = true;
-            } else {
-                //printf ("value smaller than x\n");
+            if (mpz_cmp (v, x) >= 0) {
+                done = true;
             }
-        } else {
-            //printf ("value too big or zero \n");
         }
-
     }
-    
-    nFactors = i+1;
+
+    *last = i;
 
     mpz_clear (x); mpz_clear (currentFactor); mpz_clear (currentMax); mpz_clear (n);
-    
+
+    return true;
+}
+
+/*
+ * Generate a random factored integer in {1 ... max} with a uniform
+ * distribution using Victor Shoup's algorithm RFN (see p 298).
+ *
+ * Most candidates are composite, and isProbablePrime rejects those by trial
+ * division before its Baillie-PSW test. See randomRun.
+ */
+bool CFactoredInteger::random (mpz_t max, gmp_randstate_t rstate) {
+
+    if (factorsSize == 0 && mallocError)
+        return false;
+
+    int i = -1;
+    if (!randomRun (value, max, rstate, &i))
+        return false;
+
+    nFactors = i+1;
+
     computePrimePowerValues ();
 
     return true;
@@ -327,9 +357,8 @@ bool CFactoredInteger::randomSmooth (unsigned int maxBits, gmp_randstate_t rstat
     if (factorsSize == 0 && mallocError)
         return false;
 
-    mpz_t max, v, x, currentFactor, currentMax, n;
+    mpz_t max, v;
     mpz_init (max); mpz_init (v);
-    mpz_init (x); mpz_init (currentFactor); mpz_init (currentMax); mpz_init (n);
 
     mpz_set_ui (value, 1);
     nFactors = 0;
@@ -341,64 +370,12 @@ bool CFactoredInteger::randomSmooth (unsigned int maxBits, gmp_randstate_t rstat
     unsigned int runCount = maxBits / factorBitLimit;
 
     int i;
-    bool done, found;
+    bool found;
 
     do {
-        done = false;
-        while (!done) {
-            mpz_set_ui (v, 1);
-            mpz_set_ui (currentFactor, 0);
-
-            // generate random sequence using RN and save the primes
-            i = nFactors - 1;
-            mpz_set (currentMax, max);
-            do {
-                mpz_urandomm (n, rstate, currentMax); // between 0 and currentMax - 1
-                mpz_add_ui (n, n, 1); // now between 1 and currentMax
-
-                if (mpz_probab_prime_p (n, 10)) {
-
-                    mpz_mul (v, v, n);
-
-                    if (mpz_cmp (v, max) > 0) {
-                        //printf ("value too big, breaking\n");
-                        break;
-                    }
-                    if (mpz_cmp (n, currentFactor) != 0) {
-
-                        i++;
-
-                        if (!ensureMallocInitTo (i)) { return false; }
-
-                        mpz_set (currentFactor, n);
-                        //gmp_printf ("currentFactor = %Zd\n", currentFactor);
-                        //gmp_printf ("seq[i] = %Zd\n", seq[i]);
-                        //gmp_printf ("factorIndex = %d\n", factorIndex);
-
-                        mpz_set (factors[i].prime, n);
-                        factors[i].power = 1;
-
-                    } else {
-                        factors[i].power++;
-                        //gmp_printf ("Inc power for index %d, value %Zd\n", i, currentFactor);
-                    }
-
-                }
-
-                mpz_set (currentMax, n);
-                
-            } while (mpz_cmp_ui (currentMax, 1) > 0);
-
-            // now test if we generated a suitible factored integer
-            if (mpz_cmp_ui (v, 0) > 0 && mpz_cmp (v, max) <= 0) {
-                mpz_urandomm (x, rstate, max);
-                mpz_add_ui (x, x, 1);
-                //gmp_printf ("    x = %Zd\n", x);
-                if (mpz_cmp (v, x) >= 0) {
-                    done = true;
-                }
-            }
-        }
+        i = nFactors - 1;
+        if (!randomRun (v, max, rstate, &i))
+            return false;
 
         mpz_mul (value, value, v);
 
@@ -409,7 +386,7 @@ bool CFactoredInteger::randomSmooth (unsigned int maxBits, gmp_randstate_t rstat
             found = false;
             for (unsigned int k = 0; k < nFactors; k++) {
                 if (mpz_cmp (factors[j].prime, factors[k].prime) == 0) {
-                    factors[k].power++;
+                    factors[k].power += factors[j].power;
                     found = true;
                     break;
                 }
@@ -431,7 +408,6 @@ bool CFactoredInteger::randomSmooth (unsigned int maxBits, gmp_randstate_t rstat
     } while (runCount > 0);
     
     mpz_clear (max); mpz_clear (v);
-    mpz_clear (x); mpz_clear (currentFactor); mpz_clear (currentMax); mpz_clear (n);
     
     computePrimePowerValues ();
 
@@ -451,9 +427,8 @@ bool CFactoredInteger::randomSmoothExactBits (unsigned int bits, gmp_randstate_t
 
     if (factorsSize == 0 && mallocError)
         return false;
-    mpz_t max, v, x, currentFactor, currentMax, n;
+    mpz_t max, v;
     mpz_init (max); mpz_init (v);
-    mpz_init (x); mpz_init (currentFactor); mpz_init (currentMax); mpz_init (n);
 
     mpz_set_ui (value, 1);
     nFactors = 0;
@@ -462,72 +437,19 @@ bool CFactoredInteger::randomSmoothExactBits (unsigned int bits, gmp_randstate_t
     //mpz_sub_ui (max, max, 1);
 
     int i;
-    bool done, found;
+    bool found;
 
     unsigned int bitsLeft = bits;
 
     do {
-        done = false;
-        while (!done) {
-            mpz_set_ui (v, 1);
-            mpz_set_ui (currentFactor, 0);
-
-            // generate random sequence using RN and save the primes
-            i = nFactors - 1;
-
-            if (bitsLeft < factorBitLimit) {
-                mpz_ui_pow_ui (max, 2, bitsLeft);
-                //mpz_sub_ui (max, max, 1);
-                factorBitLimit = bitsLeft;
-            }
-            mpz_set (currentMax, max);
-            do {
-                mpz_urandomm (n, rstate, currentMax); // between 0 and currentMax - 1
-                mpz_add_ui (n, n, 1); // now between 1 and currentMax
-
-                if (mpz_probab_prime_p (n, 10)) {
-
-                    mpz_mul (v, v, n);
-
-                    if (mpz_cmp (v, max) > 0) {
-                        //printf ("value too big, breaking\n");
-                        break;
-                    }
-                    if (mpz_cmp (n, currentFactor) != 0) {
-
-                        i++;
-
-                        if (!ensureMallocInitTo (i)) { return false; }
-
-                        mpz_set (currentFactor, n);
-                        //gmp_printf ("currentFactor = %Zd\n", currentFactor);
-                        //gmp_printf ("seq[i] = %Zd\n", seq[i]);
-                        //gmp_printf ("factorIndex = %d\n", factorIndex);
-
-                        mpz_set (factors[i].prime, n);
-                        factors[i].power = 1;
-
-                    } else {
-                        factors[i].power++;
-                        //gmp_printf ("Inc power for index %d, value %Zd\n", i, currentFactor);
-                    }
-
-                }
-
-                mpz_set (currentMax, n);
-                
-            } while (mpz_cmp_ui (currentMax, 1) > 0);
-
-            // now test if we generated a suitible factored integer
-            if (mpz_cmp_ui (v, 0) > 0 && mpz_cmp (v, max) <= 0) {
-                mpz_urandomm (x, rstate, max);
-                mpz_add_ui (x, x, 1);
-                //gmp_printf ("    x = %Zd\n", x);
-                if (mpz_cmp (v, x) >= 0) {
-                    done = true;
-                }
-            }
+        if (bitsLeft < factorBitLimit) {
+            mpz_ui_pow_ui (max, 2, bitsLeft);
+            //mpz_sub_ui (max, max, 1);
+            factorBitLimit = bitsLeft;
         }
+        i = nFactors - 1;
+        if (!randomRun (v, max, rstate, &i))
+            return false;
 
         mpz_mul (value, value, v);
         bitsLeft = bits - mpz_sizeinbase (value, 2);
@@ -559,7 +481,6 @@ bool CFactoredInteger::randomSmoothExactBits (unsigned int bits, gmp_randstate_t
     } while (bitsLeft > 0);
     
     mpz_clear (max); mpz_clear (v);
-    mpz_clear (x); mpz_clear (currentFactor); mpz_clear (currentMax); mpz_clear (n);
     
     computePrimePowerValues ();
 
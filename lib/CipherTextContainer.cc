@@ -0,0 +1,185 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  CipherTextContainer.cc
+ *
+ *    Description:  Memory mapped file of ciphertexts for one cryptosystem.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gmp.h>
+#include "../include/types.h"
+#include "../include/elgamal.h"
+#include "../include/CipherTextContainer.h"
+
+// FNV-1a over the limbs and sizes of each value
+static uint64_t fingerprintMpz (uint64_t h, const mpz_t x) {
+    size_t n = mpz_size (x);
+    const mp_limb_t *limbs = mpz_limbs_read (x);
+    h = (h ^ n) * 0x100000001b3ull;
+    for (size_t i=0; i < n; i++) {
+        uint64_t v = (uint64_t) limbs[i];
+        for (int b=0; b < GMP_LIMB_BITS; b += 8)
+            h = (h ^ ((v >> b) & 0xff)) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t elgamalFingerprint (ElgamalCryptosystem *e) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = fingerprintMpz (h, e->prime);
+    h = fingerprintMpz (h, e->base);
+    h = fingerprintMpz (h, e->baseOrder);
+    h = fingerprintMpz (h, e->enc);
+    return h;
+}
+
+bool CipherTextContainer::isContainerName (const char *fileName) {
+    size_t n = strlen (fileName);
+    return n >= 4 && strcmp (fileName + n - 4, ".ctc") == 0;
+}
+
+bool CipherTextContainer::mapFile (const char *fileName, bool writable) {
+    fd = open (fileName, writable ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0666);
+    if (fd < 0) {
+        perror (fileName);
+        return false;
+    }
+
+    if (writable) {
+        if (ftruncate (fd, mapLength) != 0) {
+            perror (fileName);
+            return false;
+        }
+    } else {
+        struct stat st;
+        if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (CipherTextContainerHeader)) {
+            fprintf (stderr, "%s: not a ciphertext container\n", fileName);
+            return false;
+        }
+        mapLength = st.st_size;
+    }
+
+    map = mmap (NULL, mapLength, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        perror (fileName);
+        return false;
+    }
+    return true;
+}
+
+CipherTextContainer::CipherTextContainer (const char *fileName) {
+    error = true;
+    fd = -1;
+    map = NULL;
+    records = NULL;
+    count = 0;
+    fingerprint = 0;
+    limbs = 0;
+    stride = 0;
+
+    if (!mapFile (fileName, false))
+        return;
+
+    CipherTextContainerHeader *h = (CipherTextContainerHeader *) map;
+    if (memcmp (h->magic, CIPHERTEXT_CONTAINER_MAGIC, sizeof (h->magic)) != 0
+            || h->byteOrder != CIPHERTEXT_CONTAINER_BYTE_ORDER
+            || h->limbBits != GMP_LIMB_BITS || h->limbs == 0) {
+        fprintf (stderr, "%s: not a ciphertext container for this machine\n", fileName);
+        return;
+    }
+    limbs = h->limbs;
+    stride = 3 * limbs;
+    if ((mapLength - sizeof (*h)) / sizeof (mp_limb_t) / stride < h->count) {
+        fprintf (stderr, "%s: truncated ciphertext container\n", fileName);
+        return;
+    }
+    count = h->count;
+    fingerprint = h->fingerprint;
+    records = (mp_limb_t *) ((char *) map + sizeof (*h));
+
+    // records are read in order
+    madvise (map, mapLength, MADV_SEQUENTIAL);
+
+    error = false;
+}
+
+CipherTextContainer::CipherTextContainer (const char *fileName, ElgamalCryptosystem *e,
+                                          uint64_t count) {
+    error = true;
+    fd = -1;
+    map = NULL;
+    records = NULL;
+    this->count = count;
+    fingerprint = elgamalFingerprint (e);
+    limbs = mpz_size (e->prime);
+    stride = 3 * limbs;
+
+    mapLength = sizeof (CipherTextContainerHeader) + count * stride * sizeof (mp_limb_t);
+    if (!mapFile (fileName, true))
+        return;
+
+    CipherTextContainerHeader *h = (CipherTextContainerHeader *) map;
+    memset (h, 0, sizeof (*h));
+    memcpy (h->magic, CIPHERTEXT_CONTAINER_MAGIC, sizeof (h->magic));
+    h->byteOrder = CIPHERTEXT_CONTAINER_BYTE_ORDER;
+    h->limbBits = GMP_LIMB_BITS;
+    h->limbs = limbs;
+    h->count = count;
+    h->fingerprint = fingerprint;
+    records = (mp_limb_t *) ((char *) map + sizeof (*h));
+
+    error = false;
+}
+
+CipherTextContainer::~CipherTextContainer () {
+    if (map != NULL)
+        munmap (map, mapLength);
+    if (fd >= 0)
+        close (fd);
+}
+
+static void getValue (mpz_t x, const mp_limb_t *limbs, size_t n) {
+    mpz_t view;
+    mpz_set (x, mpz_roinit_n (view, limbs, n));
+}
+
+// x must fit in n limbs
+static void setValue (mp_limb_t *limbs, size_t n, const mpz_t x) {
+    size_t size = mpz_size (x);
+    memcpy (limbs, mpz_limbs_read (x), size * sizeof (mp_limb_t));
+    memset (limbs + size, 0, (n - size) * sizeof (mp_limb_t));
+}
+
+void CipherTextContainer::get (uint64_t i, mpz_t m, ElgamalCipherText *ct) {
+    const mp_limb_t *r = record (i);
+    if (m != NULL)
+        getValue (m, r, limbs);
+    getValue (ct->gk, r + limbs, limbs);
+    getValue (ct->myk, r + 2 * limbs, limbs);
+}
+
+bool CipherTextContainer::set (uint64_t i, const mpz_t m, const ElgamalCipherText ct) {
+    if (mpz_size (m) > limbs || mpz_size (ct.gk) > limbs || mpz_size (ct.myk) > limbs)
+        return false;
+    mp_limb_t *r = records + i * stride;
+    setValue (r, limbs, m);
+    setValue (r + limbs, limbs, ct.gk);
+    setValue (r + 2 * limbs, limbs, ct.myk);
+    return true;
+}
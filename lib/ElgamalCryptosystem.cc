@@ -6,10 +6,16 @@
  * Distributed under the MIT license: see COPYING.MIT
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <gmp.h>
 #include "../include/types.h"
 #include "../include/randomhelpers.h"
+#include "../include/philox.h"
 #include "../include/elgamal.h"
+#include "../include/fixedbase.h"
 
 //#define DEBUG 1
 
@@ -26,6 +32,9 @@ bool ElgamalCryptosystem::init () {
     mpz_init (r);
     mpz_init (sGenerator);
 
+    basePowm = NULL;
+    encPowm = NULL;
+
     s = new CFactoredInteger();
 
     mallocError = s->hasMallocError ();
@@ -78,6 +87,221 @@ void ElgamalCryptosystem::findSGenerator (gmp_randstate_t rstate) {
 }
 
 
+/*
+ * Search for the prime p, shared by both constructors. With baseOrderBits
+ * == 0 p = n+1 for a random factored n, which is returned in s. Otherwise
+ * p = baseOrder * r * s + 1 with prime baseOrder, as described in the
+ * constructor.
+ */
+typedef struct {
+    unsigned int primeBits, baseOrderBits, smoothBits, smoothnessBitLimit;
+} PrimeSearch;
+
+typedef struct {
+    mpz_t prime, baseOrder, y, r;
+    CFactoredInteger *s;
+} PrimeCandidate;
+
+static bool initCandidate (PrimeCandidate *c) {
+    mpz_init (c->prime); mpz_init (c->baseOrder); mpz_init (c->y); mpz_init (c->r);
+    c->s = new CFactoredInteger ();
+    return !c->s->hasMallocError ();
+}
+
+static void clearCandidate (PrimeCandidate *c) {
+    mpz_clear (c->prime); mpz_clear (c->baseOrder); mpz_clear (c->y); mpz_clear (c->r);
+    if (c->s != NULL)
+        delete c->s;
+}
+
+/*
+ * Draw one candidate. Returns true if c->prime is a prime of the right size,
+ * and sets *mallocError if the factored integer could not be allocated.
+ */
+static bool nextCandidate (PrimeCandidate *c, const PrimeSearch *ps,
+                           gmp_randstate_t rstate, bool *mallocError) {
+    if (ps->baseOrderBits == 0) {
+        do {
+            c->s->random (ps->primeBits, rstate);
+            if (c->s->hasMallocError ()) {
+                *mallocError = true;
+                return false;
+            }
+        } while (mpz_sizeinbase (c->s->value, 2) != ps->primeBits);
+
+        mpz_set (c->baseOrder, c->s->value);
+        mpz_add_ui (c->prime, c->s->value, 1);
+        return mpz_probab_prime_p (c->prime, 4) && mpz_sizeinbase (c->prime, 2) == ps->primeBits;
+    }
+
+    do {
+        mpz_urandomb (c->baseOrder, rstate, ps->baseOrderBits - 1);
+        mpz_setbit (c->baseOrder, ps->baseOrderBits - 1);
+        mpz_nextprime (c->baseOrder, c->baseOrder);
+    } while (mpz_sizeinbase (c->baseOrder, 2) > ps->baseOrderBits);
+
+    // pick random even integer so the product baseOrder * (s * y) is at most primeBits bits,
+    // and s is smooth
+    unsigned int rbits;
+    if (ps->smoothBits == 0) {
+        // We want y to have primeBits - baseOrderBits and be even,
+        // so we generate 2 less random bits than needed and set
+        // the first and last bits accordingly.
+        rbits = ps->primeBits - ps->baseOrderBits - 2;
+        mpz_urandomb (c->y, rstate, rbits);
+        mpz_setbit (c->y, rbits); // set high order bit
+        mpz_mul_2exp (c->y, c->y, 1); // shift left by one, making y even
+        mpz_set_ui (c->s->value, 1);
+        mpz_set (c->r, c->y);
+    } else {
+        c->s->randomSmoothExactBits (ps->smoothBits, rstate, ps->smoothnessBitLimit);
+        if (c->s->hasMallocError ()) {
+            *mallocError = true;
+            return false;
+        }
+
+        rbits = ps->primeBits - ps->baseOrderBits - mpz_sizeinbase (c->s->value, 2) - 2;
+        mpz_urandomb (c->r, rstate, rbits);
+        mpz_setbit (c->r, rbits); // set high order bit
+        mpz_mul_2exp (c->r, c->r, 1); // shift left by one, making y even
+        mpz_mul (c->y, c->r, c->s->value);
+    }
+
+    mpz_mul (c->prime, c->y, c->baseOrder);
+    mpz_add_ui (c->prime, c->prime, 1);
+
+    return mpz_probab_prime_p (c->prime, 10) && mpz_sizeinbase (c->prime, 2) >= ps->primeBits;
+}
+
+typedef struct {
+    const PrimeSearch *search;
+    uint64_t seed;           // round j draws from stream j of it
+    pthread_mutex_t lock;
+    uint64_t next;           // the next round to draw
+    uint64_t winnerRound;    // UINT64_MAX until a prime is found
+    bool mallocError;
+    PrimeCandidate *winner;
+} PrimeSearchStore;
+
+typedef struct {
+    PrimeSearchStore *store;
+    PrimeCandidate candidate;
+    pthread_t thread;
+} PrimeSearchThread;
+
+/*
+ * Draw candidates, one round at a time, until every round below the best
+ * prime found so far has been drawn. A round only depends on its stream,
+ * so the lowest prime round wins whichever thread draws it.
+ */
+static void *primeSearchThread (void *arg) {
+    PrimeSearchThread *t = (PrimeSearchThread *) arg;
+    PrimeSearchStore *store = t->store;
+
+    gmp_randstate_t rstate;
+    randStateInitPhilox (rstate, store->seed, 0);
+
+    bool mallocError = false;
+    for (;;) {
+        pthread_mutex_lock (&store->lock);
+        uint64_t round = store->next;
+        bool draw = !store->mallocError && round < store->winnerRound;
+        if (draw)
+            store->next++;
+        pthread_mutex_unlock (&store->lock);
+        if (!draw)
+            break;
+
+        randStateSetStream (rstate, store->seed, round);
+        bool found = nextCandidate (&t->candidate, store->search, rstate, &mallocError);
+        if (found || mallocError) {
+            pthread_mutex_lock (&store->lock);
+            if (mallocError) {
+                store->mallocError = true;
+            } else if (round < store->winnerRound) {
+                store->winnerRound = round;
+                store->winner = &t->candidate;
+            }
+            pthread_mutex_unlock (&store->lock);
+            // every later round loses to this one
+            break;
+        }
+    }
+
+    gmp_randclear (rstate);
+    return NULL;
+}
+
+/*
+ * Run the search on threads workers, 0 for one per online processor. The
+ * candidates are drawn in rounds from streams of one seed taken from
+ * rstate (see philox.h), and the prime is the one of the lowest round, so
+ * it only depends on rstate and not on the number of threads or their
+ * timing. The result is swapped into c.
+ */
+static bool findPrime (PrimeCandidate *c, const PrimeSearch *ps,
+                       gmp_randstate_t rstate, unsigned int threads) {
+    if (threads == 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? online : 1;
+    }
+
+    PrimeSearchThread *t = (PrimeSearchThread *) malloc (threads * sizeof (PrimeSearchThread));
+    if (t == NULL)
+        return false;
+
+    PrimeSearchStore store;
+    store.search = ps;
+    store.seed = randStateSeed (rstate);
+    pthread_mutex_init (&store.lock, NULL);
+    store.next = 0;
+    store.winnerRound = UINT64_MAX;
+    store.mallocError = false;
+    store.winner = NULL;
+
+    unsigned int started = 0;
+    for (unsigned int i=0; threads > 1 && i < threads; i++) {
+        t[i].store = &store;
+        bool ok = initCandidate (&t[i].candidate);
+        if (!ok || pthread_create (&t[i].thread, NULL, primeSearchThread, &t[i]) != 0) {
+            clearCandidate (&t[i].candidate);
+            break;
+        }
+        started++;
+    }
+    for (unsigned int i=0; i < started; i++) {
+        pthread_join (t[i].thread, NULL);
+    }
+
+    // one thread, or no worker could be started: search here instead
+    if (started == 0) {
+        t[0].store = &store;
+        if (initCandidate (&t[0].candidate))
+            primeSearchThread (&t[0]);
+        started = 1;
+    }
+
+    // a lower round may have been left undrawn after a malloc error
+    bool success = (store.winner != NULL && !store.mallocError);
+    if (success) {
+        mpz_swap (c->prime, store.winner->prime);
+        mpz_swap (c->baseOrder, store.winner->baseOrder);
+        mpz_swap (c->y, store.winner->y);
+        mpz_swap (c->r, store.winner->r);
+        CFactoredInteger *s = c->s;
+        c->s = store.winner->s;
+        store.winner->s = s;
+    }
+    for (unsigned int i=0; i < started; i++) {
+        clearCandidate (&t[i].candidate);
+    }
+    free (t);
+    pthread_mutex_destroy (&store.lock);
+
+    return success;
+}
+
+
 //*********************** PUBLIC METHODS & INSTRUCTORS *******************************
 
 ElgamalCryptosystem::ElgamalCryptosystem () {
@@ -85,36 +309,25 @@ ElgamalCryptosystem::ElgamalCryptosystem () {
 }
 
 // Generate a cryptosystem with p = n+1
-ElgamalCryptosystem::ElgamalCryptosystem (unsigned int primeBits, gmp_randstate_t rstate) {
+ElgamalCryptosystem::ElgamalCryptosystem (unsigned int primeBits, gmp_randstate_t rstate,
+                                          unsigned int threads) {
     if (!init ())
         return;
 
-    //mpz_t highBit;
-    //mpz_init_set_ui (highBit, 1);
-    //mpz_mul_2exp (highBit, highBit, baseOrderBits - 1);
-
-    //mpz_ui_pow_ui (tmp, 2, baseOrderBits);
-    //mpz_sub_ui (tmp, 1);
-    
-    //unsigned int bitDebug;
-
     // pick factored n so that p = n+1 is prime
-    CFactoredInteger n;
-    do {
-        do {
-            n.random (primeBits, rstate);
-            if (n.hasMallocError ()) {
-                mallocError = true;
-                return; // no mpz_init calls above which need clearing
-            }
-        } while (mpz_sizeinbase (n.value, 2) != primeBits);
+    PrimeSearch ps = { primeBits, 0, 0, 0 };
+    PrimeCandidate c;
+    if (!initCandidate (&c) || !findPrime (&c, &ps, rstate, threads)) {
+        clearCandidate (&c);
+        mallocError = true;
+        return;
+    }
+    CFactoredInteger &n = *c.s;
 
-        mpz_set (baseOrder, n.value);
-        mpz_sub_ui (baseOrderMinus1, baseOrder, 1);
+    mpz_set (prime, c.prime);
+    mpz_set (baseOrder, c.baseOrder);
+    mpz_sub_ui (baseOrderMinus1, baseOrder, 1);
 
-        mpz_add_ui (prime, n.value, 1);
-    } while (!mpz_probab_prime_p (prime, 4) || mpz_sizeinbase (prime, 2) != primeBits);
-    
 #ifdef DEBUG
     printf ("generated random prime with specified length\n");
     gmp_printf ("prime = %Zd\n", prime);
@@ -162,78 +375,35 @@ ElgamalCryptosystem::ElgamalCryptosystem (unsigned int primeBits, gmp_randstate_
     mpz_set_ui (r, 1);
     mpz_set_ui (s->value, 1);
 
-    //mpz_clear (tmp);
+    clearCandidate (&c);
 }
 
 ElgamalCryptosystem::ElgamalCryptosystem (unsigned int primeBits,
                              unsigned int baseOrderBits, gmp_randstate_t rstate,
-                             unsigned int smoothBits, unsigned int smoothnessBitLimit) {
+                             unsigned int smoothBits, unsigned int smoothnessBitLimit,
+                             unsigned int threads) {
     if (!init ())
         return;
 
-    //mpz_t highBit;
-    //mpz_init_set_ui (highBit, 1);
-    //mpz_mul_2exp (highBit, highBit, baseOrderBits - 1);
-
-    //mpz_ui_pow_ui (tmp, 2, baseOrderBits);
-    //mpz_sub_ui (tmp, 1);
-    
-    //unsigned int bitDebug;
-
     // pick prime baseOrder, smooth s, and y such that p = baseOrder * y + 1 is prime and s is a factor of y.
-    do {
-        do {
-            mpz_urandomb (baseOrder, rstate, baseOrderBits - 1);
-            mpz_setbit (baseOrder, baseOrderBits - 1);
-            mpz_nextprime (baseOrder, baseOrder);
-        } while (mpz_sizeinbase (baseOrder, 2) > baseOrderBits);
-
-        mpz_sub_ui (baseOrderMinus1, baseOrder, 1);
-
-        // pick random even integer so the product baseOrder * (s * y) is at most primeBits bits,
-        // and s is smooth
-        unsigned int rbits;
-        if (smoothBits == 0) {
-            // We want y to have primeBits - baseOrderBits and be even,
-            // so we generate 2 less random bits than needed and set
-            // the first and last bits accordingly.
-            rbits = primeBits - baseOrderBits - 2;
-            mpz_urandomb (y, rstate, rbits);
-            mpz_setbit (y, rbits); // set high order bit
-            mpz_mul_2exp (y, y, 1); // shift left by one, making y even
-            mpz_set_ui (s->value, 1);
-            mpz_set (r, y);
-        } else {
-            s->randomSmoothExactBits (smoothBits, rstate, smoothnessBitLimit);
-            //printf ("s bits = %zu\n", mpz_sizeinbase (s->value, 2));
-            if (s->hasMallocError ()) {
-                mallocError = true;
-                return; // not mpz_init calls above which need clearing
-            }
-
-            rbits = primeBits - baseOrderBits - mpz_sizeinbase (s->value, 2) - 2;
-            mpz_urandomb (r, rstate, rbits);
-            mpz_setbit (r, rbits); // set high order bit
-            mpz_mul_2exp (r, r, 1); // shift left by one, making y even
-            mpz_mul (y, r, s->value);
-            //bitDebug = mpz_sizeinbase (y, 2);
-            //printf ("y bits = %u\n", bitDebug);
-        }
-
-        //gmp_printf ("baseOrder = %Zd\n", baseOrder);
-        //gmp_printf ("        y = %Zd\n", y);
+    PrimeSearch ps = { primeBits, baseOrderBits, smoothBits, smoothnessBitLimit };
+    PrimeCandidate c;
+    if (!initCandidate (&c) || !findPrime (&c, &ps, rstate, threads)) {
+        clearCandidate (&c);
+        mallocError = true;
+        return;
+    }
+    mpz_swap (prime, c.prime);
+    mpz_swap (baseOrder, c.baseOrder);
+    mpz_swap (y, c.y);
+    mpz_swap (r, c.r);
+    CFactoredInteger *winner = c.s;
+    c.s = s;
+    s = winner;
+    clearCandidate (&c);
 
-        mpz_mul (prime, y, baseOrder);
-        //mpz_mul (prime, prime, s->value);
-        mpz_add_ui (prime, prime, 1);
-        //gmp_printf ("   prime? = %Zd\n", prime);
-        //bitDebug = mpz_sizeinbase (prime, 2);
-        //printf ("prime bits = %u\n", bitDebug);
+    mpz_sub_ui (baseOrderMinus1, baseOrder, 1);
 
-        //mpz_urandomb (prime, rstate, primeBits);
-        //mpz_nextprime (prime, prime);
-    } while (!mpz_probab_prime_p (prime, 10) || mpz_sizeinbase (prime, 2) < primeBits);
-    
 #ifdef DEBUG
     printf ("generated random prime with specified base order length\n");
     gmp_printf ("prime = %Zd\n", prime);
@@ -270,9 +440,33 @@ ElgamalCryptosystem::ElgamalCryptosystem (unsigned int primeBits,
 
 }
 
+void ElgamalCryptosystem::clearPrecomputation () {
+    if (basePowm != NULL)
+        delete basePowm;
+    if (encPowm != NULL)
+        delete encPowm;
+    basePowm = NULL;
+    encPowm = NULL;
+}
+
+bool ElgamalCryptosystem::precomputeEncryption () {
+    clearPrecomputation ();
+    size_t bits = mpz_sizeinbase (baseOrder, 2);
+    basePowm = new FixedBasePowm (base, prime, bits);
+    encPowm = new FixedBasePowm (enc, prime, bits);
+    if (basePowm->hasMallocError () || encPowm->hasMallocError ()) {
+        clearPrecomputation ();
+        return false;
+    }
+    return true;
+}
+
 void ElgamalCryptosystem::encrypt (ElgamalCipherText *ct, const mpz_t m,
                                    gmp_randstate_t rstate) {
-    elgamalEncrypt (ct, m, prime, base, baseOrderMinus1, enc, rstate);
+    if (basePowm != NULL)
+        elgamalEncryptFixedBase (ct, m, prime, basePowm, baseOrderMinus1, encPowm, rstate);
+    else
+        elgamalEncrypt (ct, m, prime, base, baseOrderMinus1, enc, rstate);
 }
 
 void ElgamalCryptosystem::decrypt (mpz_t m, const ElgamalCipherText ct) {
@@ -318,6 +512,8 @@ ElgamalCryptosystem::~ElgamalCryptosystem () {
     mpz_clear (r);
     mpz_clear (sGenerator);
 
+    clearPrecomputation ();
+
     if (s != NULL) {
         delete s;
     }
@@ -356,6 +552,9 @@ int ElgamalCryptosystem::write (FILE *f) {
 
 int ElgamalCryptosystem::read (FILE *f) {
 
+    // the tables are for the old base and enc
+    clearPrecomputation ();
+
     int bytes = 0;
     bytes += mpz_inp_raw (prime, f); 
     bytes += mpz_inp_raw (base, f); 
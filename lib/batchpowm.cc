@@ -0,0 +1,345 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  batchpowm.cc
+ *
+ *    Description:  Lane parallel modular exponentiation with run time
+ *                  kernel selection.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "../include/batchpowm.h"
+
+#if defined (__x86_64__) && GMP_NUMB_BITS == 64
+#define BATCH_POWM_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * r = a b / R mod p in every lane, for a and b below 2p. The digits of a
+ * and b must be normalized, r is normalized and below 2p. t holds
+ * 2 digits + 1 vectors, r may alias a or b.
+ */
+typedef void (*LaneMulFunction) (uint64_t *r, const uint64_t *a, const uint64_t *b,
+                                 const uint64_t *p, const uint64_t *pInv,
+                                 unsigned int digits, uint64_t *t);
+
+#ifdef BATCH_POWM_X86
+
+/*
+ * Product scanning with 26 bit digits, so that the 32x32 bit vpmuludq can be
+ * used and the 64 bit columns never overflow for any p of practical size.
+ */
+__attribute__ ((target ("avx2")))
+static void laneMulAvx2 (uint64_t *r, const uint64_t *a, const uint64_t *b,
+                         const uint64_t *p, const uint64_t *pInv,
+                         unsigned int digits, uint64_t *t) {
+    __m256i *tv = (__m256i *) t;
+    const __m256i *av = (const __m256i *) a;
+    const __m256i *bv = (const __m256i *) b;
+    const __m256i *pv = (const __m256i *) p;
+    const __m256i inv = *(const __m256i *) pInv;
+    const __m256i mask = _mm256_set1_epi64x ((1ll << 26) - 1);
+
+    for (unsigned int k=0; k < 2 * digits + 1; k++)
+        tv[k] = _mm256_setzero_si256 ();
+
+    for (unsigned int i=0; i < digits; i++) {
+        __m256i bi = bv[i];
+        __m256i c = _mm256_add_epi64 (tv[i], _mm256_mul_epu32 (av[0], bi));
+        __m256i m = _mm256_and_si256 (_mm256_mul_epu32 (c, inv), mask);
+        c = _mm256_add_epi64 (c, _mm256_mul_epu32 (pv[0], m));
+        // the low digit of c is now 0
+        tv[i + 1] = _mm256_add_epi64 (tv[i + 1], _mm256_srli_epi64 (c, 26));
+        for (unsigned int j=1; j < digits; j++) {
+            c = _mm256_add_epi64 (tv[i + j], _mm256_mul_epu32 (av[j], bi));
+            tv[i + j] = _mm256_add_epi64 (c, _mm256_mul_epu32 (pv[j], m));
+        }
+    }
+
+    __m256i carry = _mm256_setzero_si256 ();
+    for (unsigned int j=0; j < digits; j++) {
+        __m256i c = _mm256_add_epi64 (tv[digits + j], carry);
+        ((__m256i *) r)[j] = _mm256_and_si256 (c, mask);
+        carry = _mm256_srli_epi64 (c, 26);
+    }
+}
+
+/*
+ * Same with 52 bit digits. vpmadd52luq and vpmadd52huq add the low and high
+ * halves of a 52x52 bit product, so each column takes 2^12 of them before
+ * it can overflow. The shifts are the masked form only because the unmasked
+ * one trips -Wmaybe-uninitialized in the GCC 12 headers.
+ */
+__attribute__ ((target ("avx512f,avx512ifma")))
+static void laneMulIfma (uint64_t *r, const uint64_t *a, const uint64_t *b,
+                         const uint64_t *p, const uint64_t *pInv,
+                         unsigned int digits, uint64_t *t) {
+    __m512i *tv = (__m512i *) t;
+    const __m512i *av = (const __m512i *) a;
+    const __m512i *bv = (const __m512i *) b;
+    const __m512i *pv = (const __m512i *) p;
+    const __m512i inv = *(const __m512i *) pInv;
+    const __m512i mask = _mm512_set1_epi64 ((1ll << 52) - 1);
+    const __m512i zero = _mm512_setzero_si512 ();
+
+    for (unsigned int k=0; k < 2 * digits + 1; k++)
+        tv[k] = zero;
+
+    for (unsigned int i=0; i < digits; i++) {
+        __m512i bi = bv[i];
+        __m512i c = _mm512_madd52lo_epu64 (tv[i], av[0], bi);
+        __m512i m = _mm512_madd52lo_epu64 (zero, c, inv);
+        c = _mm512_madd52lo_epu64 (c, pv[0], m);
+
+        // high halves go one column up
+        __m512i high = _mm512_madd52hi_epu64 (zero, av[0], bi);
+        high = _mm512_madd52hi_epu64 (high, pv[0], m);
+        high = _mm512_add_epi64 (high, _mm512_maskz_srli_epi64 ((__mmask8) -1, c, 52));
+        for (unsigned int j=1; j < digits; j++) {
+            c = _mm512_add_epi64 (tv[i + j], high);
+            c = _mm512_madd52lo_epu64 (c, av[j], bi);
+            tv[i + j] = _mm512_madd52lo_epu64 (c, pv[j], m);
+            high = _mm512_madd52hi_epu64 (zero, av[j], bi);
+            high = _mm512_madd52hi_epu64 (high, pv[j], m);
+        }
+        tv[i + digits] = _mm512_add_epi64 (tv[i + digits], high);
+    }
+
+    __m512i carry = zero;
+    for (unsigned int j=0; j < digits; j++) {
+        __m512i c = _mm512_add_epi64 (tv[digits + j], carry);
+        ((__m512i *) r)[j] = _mm512_and_si512 (c, mask);
+        carry = _mm512_maskz_srli_epi64 ((__mmask8) -1, c, 52);
+    }
+}
+
+#endif
+
+/*
+ * In release builds, with 512 to 1024 bit p and 256 to 512 bit exponents,
+ * the IFMA kernel is about 4 times as fast as mpz_powm, while the AVX2
+ * kernel is about 25% slower than it, so AVX2 is never picked by default.
+ */
+unsigned int batchPowmBestKernel () {
+#ifdef BATCH_POWM_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512ifma"))
+        return BATCH_POWM_IFMA;
+#endif
+    return BATCH_POWM_SCALAR;
+}
+
+static bool kernelSupported (unsigned int kernel) {
+    switch (kernel) {
+        case BATCH_POWM_SCALAR:
+            return true;
+#ifdef BATCH_POWM_X86
+        case BATCH_POWM_AVX2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx2");
+        case BATCH_POWM_IFMA:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx512ifma");
+#endif
+        default:
+            return false;
+    }
+}
+
+static const char *kernelNames[] = { "auto", "scalar", "avx2", "ifma" };
+
+const char *batchPowmKernelName (unsigned int kernel) {
+    if (kernel > BATCH_POWM_IFMA)
+        return "unknown";
+    return kernelNames[kernel];
+}
+
+unsigned int batchPowmKernelFromName (const char *name) {
+    for (unsigned int kernel=0; kernel <= BATCH_POWM_IFMA; kernel++) {
+        if (strcmp (name, kernelNames[kernel]) == 0)
+            return kernel;
+    }
+    return BATCH_POWM_AUTO;
+}
+
+/*
+ * Set digit j of every lane to digit j of x.
+ */
+static void broadcastDigits (uint64_t *d, const mpz_t x, unsigned int digits,
+                             unsigned int digitBits, unsigned int lanes, mpz_t tmp) {
+    uint64_t mask = ((uint64_t)1 << digitBits) - 1;
+    for (unsigned int j=0; j < digits; j++) {
+        mpz_fdiv_q_2exp (tmp, x, j * digitBits);
+        uint64_t digit = mpz_getlimbn (tmp, 0) & mask;
+        for (unsigned int l=0; l < lanes; l++)
+            d[j * lanes + l] = digit;
+    }
+}
+
+static uint64_t *allocVectors (size_t count, unsigned int lanes) {
+    void *v = NULL;
+    if (posix_memalign (&v, 64, count * lanes * sizeof (uint64_t)) != 0)
+        return NULL;
+    return (uint64_t *) v;
+}
+
+BatchPowm::BatchPowm (const mpz_t p, const mpz_t e, unsigned int kernel) {
+    mallocError = false;
+    mpz_init_set (this->p, p);
+    mpz_init_set (this->e, e);
+    mpz_init (tmp);
+    pDigits = NULL;
+    exponentWindows = NULL;
+    lanes = 1;
+
+    if (kernel == BATCH_POWM_AUTO || !kernelSupported (kernel))
+        kernel = batchPowmBestKernel ();
+    // the lanes take bases below 2^64 without reducing them
+    if (mpz_sizeinbase (p, 2) <= 64)
+        kernel = BATCH_POWM_SCALAR;
+    this->kernel = kernel;
+    if (kernel == BATCH_POWM_SCALAR)
+        return;
+
+    if (kernel == BATCH_POWM_IFMA) {
+        lanes = 8;
+        digitBits = 52;
+    } else {
+        lanes = 4;
+        digitBits = 26;
+    }
+    // R > 4p, see laneMul
+    digits = (mpz_sizeinbase (p, 2) + 2 + digitBits - 1) / digitBits;
+
+    size_t windowSize = (size_t)1 << BATCH_POWM_WINDOW_BITS;
+    // p, pInv, r2, one, window, x and t
+    pDigits = allocVectors ((windowSize + 6) * digits + 2, lanes);
+    windowCount = (mpz_sizeinbase (e, 2) + BATCH_POWM_WINDOW_BITS - 1) / BATCH_POWM_WINDOW_BITS;
+    exponentWindows = (unsigned char *) malloc (windowCount + 1);
+    if (pDigits == NULL || exponentWindows == NULL) {
+        mallocError = true;
+        return;
+    }
+    size_t stride = digits * lanes;
+    pInv = pDigits + stride;
+    r2 = pInv + lanes;
+    one = r2 + stride;
+    window = one + stride;
+    x = window + windowSize * stride;
+    t = x + stride;
+
+    broadcastDigits (pDigits, p, digits, digitBits, lanes, tmp);
+
+    // Newton iteration for p^-1 mod 2^64, see MontgomeryContext
+    uint64_t p0 = mpz_getlimbn (p, 0), inv = p0;
+    for (unsigned int bits=3; bits < 64; bits *= 2)
+        inv *= 2 - p0 * inv;
+    for (unsigned int l=0; l < lanes; l++)
+        pInv[l] = (-inv) & (((uint64_t)1 << digitBits) - 1);
+
+    mpz_set_ui (tmp, 0);
+    mpz_setbit (tmp, 2 * digits * digitBits);
+    mpz_mod (tmp, tmp, p);
+    mpz_t r2Value;
+    mpz_init_set (r2Value, tmp);
+    broadcastDigits (r2, r2Value, digits, digitBits, lanes, tmp);
+    mpz_clear (r2Value);
+
+    memset (one, 0, stride * sizeof (uint64_t));
+    for (unsigned int l=0; l < lanes; l++)
+        one[l] = 1;
+
+    for (size_t w=0; w < windowCount; w++) {
+        unsigned char value = 0;
+        for (unsigned int b=BATCH_POWM_WINDOW_BITS; b-- > 0; )
+            value = (value << 1) | mpz_tstbit (e, w * BATCH_POWM_WINDOW_BITS + b);
+        exponentWindows[w] = value;
+    }
+}
+
+BatchPowm::~BatchPowm () {
+    if (pDigits != NULL)
+        free (pDigits);
+    if (exponentWindows != NULL)
+        free (exponentWindows);
+    mpz_clear (p);
+    mpz_clear (e);
+    mpz_clear (tmp);
+}
+
+/*
+ * One batch of at most lanes bases, with a fixed window exponentiation in
+ * every lane. Unused lanes raise 0.
+ */
+void BatchPowm::powLanes (mpz_t *r, const unsigned long *bases, size_t count) {
+    LaneMulFunction mul = NULL;
+#ifdef BATCH_POWM_X86
+    mul = (kernel == BATCH_POWM_IFMA) ? laneMulIfma : laneMulAvx2;
+#endif
+    size_t stride = digits * lanes;
+    uint64_t mask = ((uint64_t)1 << digitBits) - 1;
+
+    for (unsigned int j=0; j < digits; j++) {
+        for (unsigned int l=0; l < lanes; l++) {
+            uint64_t base = (l < count) ? bases[l] : 0;
+            x[j * lanes + l] = (j * digitBits < 64) ? (base >> (j * digitBits)) & mask : 0;
+        }
+    }
+
+    // window[k] = base^k R mod p
+    mul (window, one, r2, pDigits, pInv, digits, t);
+    mul (window + stride, x, r2, pDigits, pInv, digits, t);
+    size_t windowSize = (size_t)1 << BATCH_POWM_WINDOW_BITS;
+    for (size_t k=2; k < windowSize; k++)
+        mul (window + k * stride, window + (k - 1) * stride, window + stride, pDigits, pInv, digits, t);
+
+    memcpy (x, window + exponentWindows[windowCount - 1] * stride, stride * sizeof (uint64_t));
+    for (size_t w=windowCount-1; w-- > 0; ) {
+        for (unsigned int b=0; b < BATCH_POWM_WINDOW_BITS; b++)
+            mul (x, x, x, pDigits, pInv, digits, t);
+        if (exponentWindows[w] != 0)
+            mul (x, x, window + exponentWindows[w] * stride, pDigits, pInv, digits, t);
+    }
+    mul (x, x, one, pDigits, pInv, digits, t);
+
+    // pack the digits of each lane into limbs
+    mp_size_t limbs = (digits * digitBits + 63) / 64;
+    for (size_t l=0; l < count; l++) {
+        mp_limb_t *rp = mpz_limbs_write (r[l], limbs);
+        memset (rp, 0, limbs * sizeof (mp_limb_t));
+        for (unsigned int j=0; j < digits; j++) {
+            uint64_t digit = x[j * lanes + l];
+            unsigned int bit = j * digitBits;
+            rp[bit / 64] |= digit << (bit % 64);
+            if (bit % 64 + digitBits > 64)
+                rp[bit / 64 + 1] |= digit >> (64 - bit % 64);
+        }
+        mpz_limbs_finish (r[l], limbs);
+        if (mpz_cmp (r[l], p) >= 0)
+            mpz_sub (r[l], r[l], p);
+    }
+}
+
+void BatchPowm::powm (mpz_t *r, const unsigned long *bases, size_t count) {
+    if (kernel == BATCH_POWM_SCALAR || mpz_sgn (e) == 0) {
+        for (size_t k=0; k < count; k++) {
+            mpz_set_ui (tmp, bases[k]);
+            mpz_powm (r[k], tmp, e, p);
+        }
+        return;
+    }
+
+    for (size_t k=0; k < count; k += lanes)
+        powLanes (r + k, bases + k, (count - k < lanes) ? count - k : lanes);
+}
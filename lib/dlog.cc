@@ -18,10 +18,15 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <gmp.h>
 
 #include "../include/types.h"
 #include "../include/dlog.h"
+#include "../include/montgomery.h"
+#include "../include/primes.h"
+#include "../include/philox.h"
 
 /*
  * Pollard's Rho algorithm for discrete logs.
@@ -35,112 +40,212 @@
  */
 
 /*
- * This is the random-looking function used for the Pollard Rho algorithm
+ * The random-looking function used for the Pollard Rho algorithm is Teske's
+ * r-adding walk, see E. Teske, "Speeding up Pollard's rho method for
+ * computing discrete logarithms", ANTS III (1998). The group is split into
+ * RHO_PARTITIONS sets, and a step multiplies x by the multiplier for its set,
+ * m[i] = alpha^u[i] beta^v[i]. With 20 sets it behaves close to a random
+ * mapping, and unlike the classic 3 set walk it never squares.
+ *
+ * x is kept in Montgomery form on the mpn layer, so a step is one
+ * multiplication and one reduction with no allocation. The walk, the
+ * distinguished points and the cycle check all work on x R mod p directly,
+ * which is just as good a representation of the group element as x.
  */
-void inline f(mpz_t x, mpz_t a, mpz_t b, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta) {
-    unsigned long int mod = mpz_fdiv_ui (x, 3); 
-    if (mod == 1) {
+#define RHO_PARTITIONS 20
+
+// Setting up the walk takes 2 * RHO_PARTITIONS exponentiations, so for very
+// small n it is cheaper to just try every power of alpha.
+#define RHO_BRUTE_FORCE_LIMIT 256
+
+typedef struct {
+    mpz_t u[RHO_PARTITIONS];
+    mpz_t v[RHO_PARTITIONS];
+    mp_limb_t *m;            // RHO_PARTITIONS residues, m[i] in Montgomery form
+
+    // When n fits in a word the exponents are kept in uint64_t, and only x
+    // is a multiprecision residue.
+    bool wordSize;
+    uint64_t n64;
+    uint64_t u64[RHO_PARTITIONS];
+    uint64_t v64[RHO_PARTITIONS];
+} RAddingWalk;
+
+static bool initWalk (RAddingWalk *w, MontgomeryContext *mont, mpz_t alpha, mpz_t p, mpz_t n,
+                      mpz_t beta, gmp_randstate_t rstate, mpz_t m, mpz_t tmp) {
+    w->m = mont->allocResidues (RHO_PARTITIONS);
+    for (unsigned int i=0; i < RHO_PARTITIONS; i++) {
+        mpz_init (w->u[i]); mpz_init (w->v[i]);
+        mpz_urandomm (w->u[i], rstate, n);
+        mpz_urandomm (w->v[i], rstate, n);
+        if (w->m == NULL)
+            continue;
+        mpz_powm (m, alpha, w->u[i], p);
+        mpz_powm (tmp, beta, w->v[i], p);
+        mpz_mul (m, m, tmp);
+        mpz_mod (m, m, p);
+        mont->toMont (w->m + i * mont->n, m);
+    }
 
-        // x = beta * x (mod p)
-        mpz_mul (x, x, beta);
-        mpz_mod (x, x, p);
-        
-        // a = a
-        //mpz_set (a, a);
+    w->wordSize = (mpz_sizeinbase (n, 2) <= 64);
+    if (w->wordSize) {
+        w->n64 = mpzGetUInt64 (n);
+        for (unsigned int i=0; i < RHO_PARTITIONS; i++) {
+            w->u64[i] = mpzGetUInt64 (w->u[i]);
+            w->v64[i] = mpzGetUInt64 (w->v[i]);
+        }
+    }
+    return (w->m != NULL);
+}
 
-        // b = b + 1 (mod n)
-        mpz_add_ui (b, b, 1);
-        mpz_mod (b, b, n);
+static void clearWalk (RAddingWalk *w) {
+    for (unsigned int i=0; i < RHO_PARTITIONS; i++) {
+        mpz_clear (w->u[i]); mpz_clear (w->v[i]);
+    }
+    if (w->m != NULL)
+        free (w->m);
+}
 
-    } else if (mod == 0) {
+/*
+ * The set is chosen from a multiplicative hash of the low limb, so that it is
+ * independent of the low bits used for distinguished points.
+ */
+static inline unsigned int walkIndex (const mp_limb_t *x) {
+    uint64_t h = ((uint64_t) x[0] * 0x9E3779B97F4A7C15ull) >> 32;
+    return (unsigned int) ((h * RHO_PARTITIONS) >> 32);
+}
 
-        // x = x^2 (mod p)
-        mpz_mul (x, x, x);
-        mpz_mod (x, x, p);
-        
-        // a = 2 * a (mod n)
-        mpz_mul_2exp (a, a, 1);
-        mpz_mod (a, a, n);
+/*
+ * a + u mod n for a, u < n < 2^64. The sum can wrap around only if it is >= n.
+ */
+static inline uint64_t addMod64 (uint64_t a, uint64_t u, uint64_t n) {
+    uint64_t r = a + u;
+    if (r < a || r >= n)
+        r -= n;
+    return r;
+}
 
-        // b = 2 * b (mod n)
-        mpz_mul_2exp (b, b, 1);
-        mpz_mod (b, b, n);
+static inline void walkStep64 (RAddingWalk *w, MontgomeryContext *mont, mp_limb_t *x,
+                               uint64_t *a, uint64_t *b) {
+    unsigned int i = walkIndex (x);
 
-    } else {
- 
-        // x = alpha * x (mod p)
-        mpz_mul (x, x, alpha);
-        mpz_mod (x, x, p);
-        
-        // a = a + 1 (mod n)
-        mpz_add_ui (a, a, 1);
-        mpz_mod (a, a, n);
+    mont->mul (x, x, w->m + i * mont->n);
 
-        // b = b
-        //mpz_set (b, b);
-       
-    }
+    *a = addMod64 (*a, w->u64[i], w->n64);
+    *b = addMod64 (*b, w->v64[i], w->n64);
 }
 
+static inline void walkStep (RAddingWalk *w, MontgomeryContext *mont, mp_limb_t *x,
+                             mpz_t a, mpz_t b, mpz_t n) {
+    unsigned int i = walkIndex (x);
+
+    mont->mul (x, x, w->m + i * mont->n);
+
+    mpz_add (a, a, w->u[i]);
+    if (mpz_cmp (a, n) >= 0)
+        mpz_sub (a, a, n);
+
+    mpz_add (b, b, w->v[i]);
+    if (mpz_cmp (b, n) >= 0)
+        mpz_sub (b, b, n);
+}
 
 /*
- * boolean return value indicates wether or not the algorithm was successful.
+ * RHO_RETRY means the walk ended in a collision which gives no log, and
+ * another walk from a random start is needed.
+ *
+ * Cycles are found with Brent's method: (x1, a1, b1) holds the point at the
+ * last power of two step, and the walk stops when it comes back to it. This
+ * takes one walk step per iteration instead of three for Floyd's method.
  */
-bool pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_randstate_t rstate, bool randomStart,
-                  mpz_t x, mpz_t a, mpz_t b, mpz_t x1, mpz_t a1, mpz_t b1) {
+RhoOutcome pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_randstate_t rstate, bool randomStart,
+                        mpz_t x, mpz_t a, mpz_t b, mpz_t x1, mpz_t a1, mpz_t b1) {
 
     if (randomStart) {
 
-        //mpz_init (x); mpz_init (a); mpz_init (b);
-        //mpz_init (x1); mpz_init (a1); mpz_init (b1);
-        
-        mpz_set (x1, n); // use x1 as a temp variable for n-1
-        mpz_sub_ui (x1, x1, 1);
-        mpz_urandomm (a, rstate, x1);
-        mpz_urandomm (b, rstate, x1);
-        mpz_add_ui (a, a, 1);
-        mpz_add_ui (b, b, 1);
+        mpz_urandomm (a, rstate, n);
+        mpz_urandomm (b, rstate, n);
 
         mpz_powm (x, alpha, a, p);
         mpz_powm (x1, beta, b, p);
         mpz_mul (x, x, x1);
         mpz_mod (x, x, p);
 
-        mpz_set (x1, x);
-        mpz_set (a1, a);
-        mpz_set (b1, b);
-
     } else {
 
         mpz_set_ui (x, 1);
         mpz_set_ui (a, 0);
         mpz_set_ui (b, 0);
 
-        mpz_set_ui (x1, 1);
-        mpz_set_ui (a1, 0);
-        mpz_set_ui (b1, 0);
-
     }
 
-    //f (x1, a1, b1, x, a, b, alpha, p, n, beta);
+    MontgomeryContext mont (p);
+    if (mont.hasMallocError ())
+        return RHO_MALLOC_ERROR;
+    RAddingWalk w;
+    mp_limb_t *xm = mont.allocResidues (2);
+    if (!initWalk (&w, &mont, alpha, p, n, beta, rstate, x1, a1) || xm == NULL) {
+        clearWalk (&w);
+        if (xm != NULL)
+            free (xm);
+        return RHO_MALLOC_ERROR;
+    }
+    mp_limb_t *x1m = xm + mont.n;
+
+    mont.toMont (xm, x);
+    mont.set (x1m, xm);
+    mpz_set (a1, a);
+    mpz_set (b1, b);
+
+    unsigned long power = 1, length = 0;
+    if (w.wordSize) {
+        uint64_t a64 = mpzGetUInt64 (a), b64 = mpzGetUInt64 (b);
+        uint64_t a164 = a64, b164 = b64;
+        do {
+
+            if (length == power) {
+                mont.set (x1m, xm);
+                a164 = a64;
+                b164 = b64;
+                power *= 2;
+                length = 0;
+            }
+
+            walkStep64 (&w, &mont, xm, &a64, &b64);
+            length++;
+
+        } while (!mont.equal (xm, x1m));
+
+        mpzSetUInt64 (a, a64); mpzSetUInt64 (b, b64);
+        mpzSetUInt64 (a1, a164); mpzSetUInt64 (b1, b164);
+    } else {
+        do {
 
-    do {
+            if (length == power) {
+                mont.set (x1m, xm);
+                mpz_set (a1, a);
+                mpz_set (b1, b);
+                power *= 2;
+                length = 0;
+            }
 
-        f (x, a, b, alpha, p, n, beta);
-        f (x1, a1, b1, alpha, p, n, beta);
-        f (x1, a1, b1, alpha, p, n, beta);
+            walkStep (&w, &mont, xm, a, b, n);
+            length++;
 
-        //gmp_printf (" i: %Zd, %Zd, %Zd\n", x, a, b);
-        //gmp_printf ("2i: %Zd, %Zd, %Zd\n\n", x1, a1, b1);
+        } while (!mont.equal (xm, x1m));
+    }
 
-    } while (mpz_cmp (x, x1) != 0);
+    mont.fromMont (x, xm);
+    mont.fromMont (x1, x1m);
+    free (xm);
+    clearWalk (&w);
 
-    bool success = false;
+    RhoOutcome success = RHO_RETRY;
 
     mpz_sub (b, b, b1);
     mpz_mod (b, b, n);
     if (mpz_cmp_ui (b, 0) != 0) {
-        success = true;
+        success = RHO_FOUND;
 
         mpz_sub (a, a1, a);
         mpz_mod (a, a, n);
@@ -153,6 +258,17 @@ bool pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_r
     return success;
 }
 
+/*
+ * The rho walk ends by solving b x = a mod n, which needs n prime, so a
+ * composite n the prime table knows about is searched exhaustively too.
+ */
+static bool rhoBruteForce (mpz_t n) {
+    if (mpz_cmp_ui (n, RHO_BRUTE_FORCE_LIMIT) <= 0)
+        return true;
+    return mpz_cmp_ui (n, primeTableLimit ()) <= 0 && !primeTableIsPrime (mpz_get_ui (n));
+}
+
+// the number of walks, or 0 if memory could not be allocated
 inline int pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n,
                         mpz_t beta, gmp_randstate_t rstate,
                         mpz_t x, mpz_t a, mpz_t b, mpz_t x1, mpz_t a1, mpz_t b1, mpz_t alphaPower) {
@@ -168,7 +284,7 @@ inline int pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n,
         }
     }*/
     
-    if (mpz_cmp_ui (n, 11) <= 0) {
+    if (rhoBruteForce (n)) {
 
         mpz_set (alphaPower, alpha);
         unsigned long int power = 1;
@@ -181,13 +297,16 @@ inline int pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n,
 
     } else {
 
-        bool ok = pollard_rho (result, alpha, p, n, beta, rstate, false, x, a, b, x1, a1, b1);
+        RhoOutcome outcome = pollard_rho (result, alpha, p, n, beta, rstate, false,
+                                          x, a, b, x1, a1, b1);
 
-        while (!ok) {
+        while (outcome == RHO_RETRY) {
             //printf ("failed, running with random start\n");
-            ok = pollard_rho (result, alpha, p, n, beta, rstate, true, x, a, b, x1, a1, b1);
+            outcome = pollard_rho (result, alpha, p, n, beta, rstate, true, x, a, b, x1, a1, b1);
             runCount++;
         }
+        if (outcome == RHO_MALLOC_ERROR)
+            runCount = 0;
 
     }
 
@@ -202,30 +321,701 @@ int pollard_rho (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta, gmp_ra
     mpz_init (x1); mpz_init (a1); mpz_init (b1);
     mpz_init (alphaPower);
 
-    return pollard_rho (result, alpha, p, n, beta, rstate, x, a, b, x1, a1, b1, alphaPower);
+    int runCount = pollard_rho (result, alpha, p, n, beta, rstate, x, a, b, x1, a1, b1, alphaPower);
 
     mpz_clear (x); mpz_clear (a); mpz_clear (b);
     mpz_clear (x1); mpz_clear (a1); mpz_clear (b1);
     mpz_clear (alphaPower);
+
+    return runCount;
 }
 
 /*
- * Pollard's Rho algorithm for discrete logs.
- * See Handbook of Applied Cryptography, algorithm 3.60 page 106.
+ * Parallel collision search version of Pollard's Rho for discrete logs.
+ * See van Oorschot and Wiener, "Parallel Collision Search with
+ * Cryptanalytic Applications", J. Cryptology 12 (1999).
+ *
+ * Each thread repeatedly starts a walk at alpha^a beta^b for random a and b,
+ * using the same iteration function as pollard_rho, until it reaches a
+ * distinguished point (low distBits bits of x are zero). The point is added
+ * to a store shared by all threads. Two walks which reach the same
+ * distinguished point give a + b log(beta) = a' + b' log(beta) mod n, which
+ * can be solved when b != b'.
+ *
+ * As with pollard_rho, n is assumed to be prime.
+ */
+
+typedef struct {
+    mpz_t x, a, b;
+} RhoPoint;
+
+typedef struct {
+    mpz_srcptr alpha, p, n, beta;
+    mpz_ptr result;
+    RAddingWalk *walk;       // shared so every walk uses the same function
+
+    unsigned int distBits;
+    unsigned long maxWalk;   // walks longer than this are probably in a cycle
+
+    pthread_mutex_t lock;
+    bool done;               // read without the lock, see rhoDone
+    bool mallocError;
+
+    size_t pointsLength, pointsSize;
+    RhoPoint *points;
+    unsigned int indexShift;
+    size_t *index;           // open addressing into points, SIZE_MAX marks an empty slot
+} RhoStore;
+
+typedef struct {
+    RhoStore *store;
+    uint64_t seed;
+    unsigned int stream;
+    pthread_t thread;
+} RhoThread;
+
+static inline bool rhoDone (RhoStore *store) {
+    return __atomic_load_n (&store->done, __ATOMIC_RELAXED);
+}
+
+static inline size_t rhoIndexSlot (mpz_t x, unsigned int shift) {
+    return (size_t) (((uint64_t) mpz_getlimbn (x, 0) * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+/*
+ * Double the size of the index and reinsert every point. Called with the
+ * lock held.
+ */
+static bool rhoGrowIndex (RhoStore *store) {
+    unsigned int shift = store->indexShift - 1;
+    size_t size = (size_t)1 << (64 - shift);
+    size_t *index = (size_t *) malloc (size * sizeof (size_t));
+    if (index == NULL)
+        return false;
+    for (size_t i=0; i < size; i++)
+        index[i] = SIZE_MAX;
+    for (size_t i=0; i < store->pointsLength; i++) {
+        size_t slot = rhoIndexSlot (store->points[i].x, shift);
+        while (index[slot] != SIZE_MAX)
+            slot = (slot + 1) & (size - 1);
+        index[slot] = i;
+    }
+    if (store->index != NULL)
+        free (store->index);
+    store->index = index;
+    store->indexShift = shift;
+    return true;
+}
+
+/*
+ * Add a distinguished point to the store, or solve for the log if another
+ * walk already reached it.
+ */
+static void rhoStorePoint (RhoStore *store, mpz_t x, mpz_t a, mpz_t b, mpz_t tmp) {
+    pthread_mutex_lock (&store->lock);
+    if (store->done) {
+        pthread_mutex_unlock (&store->lock);
+        return;
+    }
+
+    size_t mask = ((size_t)1 << (64 - store->indexShift)) - 1;
+    size_t slot = rhoIndexSlot (x, store->indexShift);
+    while (store->index[slot] != SIZE_MAX) {
+        RhoPoint *point = &store->points[store->index[slot]];
+        if (mpz_cmp (point->x, x) == 0) {
+            // a + b y = a' + b' y, so y = (a - a') / (b' - b)
+            mpz_sub (tmp, point->b, b);
+            mpz_mod (tmp, tmp, store->n);
+            if (mpz_sgn (tmp) != 0) {
+                mpz_invert (tmp, tmp, store->n);
+                mpz_sub (store->result, a, point->a);
+                mpz_mul (store->result, store->result, tmp);
+                mpz_mod (store->result, store->result, store->n);
+                __atomic_store_n (&store->done, true, __ATOMIC_RELAXED);
+            }
+            // otherwise both walks came from the same relation, which is useless
+            pthread_mutex_unlock (&store->lock);
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (store->pointsLength == store->pointsSize) {
+        size_t size = store->pointsSize * 2;
+        RhoPoint *points = (RhoPoint *) realloc (store->points, size * sizeof (RhoPoint));
+        if (points == NULL) {
+            store->mallocError = true;
+            __atomic_store_n (&store->done, true, __ATOMIC_RELAXED);
+            pthread_mutex_unlock (&store->lock);
+            return;
+        }
+        store->points = points;
+        store->pointsSize = size;
+    }
+
+    RhoPoint *point = &store->points[store->pointsLength];
+    mpz_init_set (point->x, x);
+    mpz_init_set (point->a, a);
+    mpz_init_set (point->b, b);
+    store->index[slot] = store->pointsLength;
+    store->pointsLength++;
+
+    // keep the index at most half full
+    if (2 * store->pointsLength > mask + 1 && !rhoGrowIndex (store)) {
+        store->mallocError = true;
+        __atomic_store_n (&store->done, true, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock (&store->lock);
+}
+
+static void *rhoWalkThread (void *arg) {
+    RhoThread *t = (RhoThread *) arg;
+    RhoStore *store = t->store;
+
+    gmp_randstate_t rstate;
+    randStateInitPhilox (rstate, t->seed, t->stream);
+
+    mpz_t alpha, p, n, beta, x, a, b, tmp;
+    mpz_init_set (alpha, store->alpha);
+    mpz_init_set (p, store->p);
+    mpz_init_set (n, store->n);
+    mpz_init_set (beta, store->beta);
+    mpz_init (x); mpz_init (a); mpz_init (b); mpz_init (tmp);
+
+    // each thread needs its own scratch space
+    MontgomeryContext mont (p);
+    mp_limb_t *xm = mont.allocResidues (1);
+    if (mont.hasMallocError () || xm == NULL) {
+        pthread_mutex_lock (&store->lock);
+        store->mallocError = true;
+        __atomic_store_n (&store->done, true, __ATOMIC_RELAXED);
+        pthread_mutex_unlock (&store->lock);
+    }
+
+    mp_limb_t mask = ((mp_limb_t)1 << store->distBits) - 1;
+
+    while (!rhoDone (store)) {
+        mpz_urandomm (a, rstate, n);
+        mpz_urandomm (b, rstate, n);
+        mpz_powm (x, alpha, a, p);
+        mpz_powm (tmp, beta, b, p);
+        mpz_mul (x, x, tmp);
+        mpz_mod (x, x, p);
+        mont.toMont (xm, x);
+
+        RAddingWalk *w = store->walk;
+        uint64_t a64 = mpzGetUInt64 (a), b64 = mpzGetUInt64 (b);
+        for (unsigned long steps=0; steps < store->maxWalk; steps++) {
+            if ((xm[0] & mask) == 0) {
+                if (w->wordSize) {
+                    mpzSetUInt64 (a, a64);
+                    mpzSetUInt64 (b, b64);
+                }
+                mpz_t view;
+                mpz_roinit_n (view, xm, mont.n);
+                rhoStorePoint (store, view, a, b, tmp);
+                break;
+            }
+            if (w->wordSize)
+                walkStep64 (w, &mont, xm, &a64, &b64);
+            else
+                walkStep (w, &mont, xm, a, b, n);
+            if ((steps & 0xff) == 0 && rhoDone (store))
+                break;
+        }
+    }
+
+    if (xm != NULL)
+        free (xm);
+    mpz_clear (alpha); mpz_clear (p); mpz_clear (n); mpz_clear (beta);
+    mpz_clear (x); mpz_clear (a); mpz_clear (b); mpz_clear (tmp);
+    gmp_randclear (rstate);
+
+    return NULL;
+}
+
+/*
+ * threads == 0 uses one thread per online processor. Returns false if memory
+ * or threads could not be allocated.
+ */
+bool pollard_rho_parallel (mpz_t result, mpz_t alpha, mpz_t p, mpz_t n, mpz_t beta,
+                           gmp_randstate_t rstate, unsigned int threads) {
+
+    if (threads == 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? online : 1;
+    }
+
+    if (rhoBruteForce (n))
+        return pollard_rho (result, alpha, p, n, beta, rstate) > 0;
+
+    RhoStore store;
+    store.alpha = alpha; store.p = p; store.n = n; store.beta = beta;
+    store.result = result;
+
+    // the multipliers are shared, the threads only need the same n as this
+    // context for their own
+    MontgomeryContext mont (p);
+    if (mont.hasMallocError ())
+        return false;
+    RAddingWalk walk;
+    mpz_t m, tmp;
+    mpz_init (m); mpz_init (tmp);
+    bool walkOk = initWalk (&walk, &mont, alpha, p, n, beta, rstate, m, tmp);
+    mpz_clear (m); mpz_clear (tmp);
+    store.walk = &walk;
+
+    // Expected total walk length is about sqrt(n), so walks of length
+    // around n^(1/4) keep both the store and the wasted work after the
+    // collision small.
+    store.distBits = mpz_sizeinbase (n, 2) / 4;
+    if (store.distBits > 24)
+        store.distBits = 24;
+    store.maxWalk = 20ul << store.distBits;
+
+    pthread_mutex_init (&store.lock, NULL);
+    store.done = false;
+    store.mallocError = false;
+    store.pointsLength = 0;
+    store.pointsSize = 1024;
+    store.points = (RhoPoint *) malloc (store.pointsSize * sizeof (RhoPoint));
+    store.index = NULL;
+    store.indexShift = 64 - 11; // 2048 slots
+    RhoThread *t = (RhoThread *) malloc (threads * sizeof (RhoThread));
+
+    bool success = false;
+    if (walkOk && store.points != NULL && t != NULL && rhoGrowIndex (&store)) {
+        unsigned int started = 0;
+        uint64_t seed = randStateSeed (rstate);
+        for (unsigned int i=0; i < threads; i++) {
+            t[i].store = &store;
+            t[i].seed = seed;
+            t[i].stream = i;
+            if (pthread_create (&t[i].thread, NULL, rhoWalkThread, &t[i]) != 0)
+                break;
+            started++;
+        }
+        if (started == 0) {
+            store.mallocError = true;
+        }
+        for (unsigned int i=0; i < started; i++) {
+            pthread_join (t[i].thread, NULL);
+        }
+        success = !store.mallocError;
+    }
+
+    for (size_t i=0; i < store.pointsLength; i++) {
+        mpz_clear (store.points[i].x);
+        mpz_clear (store.points[i].a);
+        mpz_clear (store.points[i].b);
+    }
+    if (store.points != NULL)
+        free (store.points);
+    if (store.index != NULL)
+        free (store.index);
+    if (t != NULL)
+        free (t);
+    clearWalk (&walk);
+    pthread_mutex_destroy (&store.lock);
+
+    return success;
+}
+
+static inline uint64_t phTableKey (mpz_t x) {
+    return (uint64_t) mpz_getlimbn (x, 0);
+}
+
+static inline size_t phTableSlot (uint64_t key, unsigned int shift) {
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+/*
+ * Build the baby-step table for the subgroup of order q. If q is small
+ * enough the table holds every power of alphaBar and only one giant step
+ * is needed.
+ *
+ * Returns false if there is no table, either because q is too large or
+ * because two powers share the same key. In that case pollard_rho is used.
+ */
+bool PohligHellmanContext::buildTable (PHFactorData *f, size_t maxBabySteps) {
+    f->babySteps = 0;
+    f->giantSteps = 0;
+    f->tableKeys = NULL;
+    f->tableValues = NULL;
+
+    if (maxBabySteps == 0)
+        return false;
+
+    size_t m;
+    if (mpz_cmp_ui (f->q, PH_TABLE_FULL_LIMIT) <= 0) {
+        m = mpz_get_ui (f->q);
+    } else {
+        mpz_sqrt (tmp, f->q);
+        mpz_add_ui (tmp, tmp, 1);
+        if (mpz_cmp_ui (tmp, maxBabySteps) > 0)
+            return false;
+        m = mpz_get_ui (tmp);
+    }
+
+    // table size is a power of two with load factor at most 2/3
+    unsigned int tableBits = 1;
+    while (((size_t)1 << tableBits) < m + m/2)
+        tableBits++;
+    size_t tableSize = (size_t)1 << tableBits;
+
+    f->tableKeys = (uint64_t *) malloc (tableSize * sizeof (uint64_t));
+    f->tableValues = (UIntType *) malloc (tableSize * sizeof (UIntType));
+    if (f->tableKeys == NULL || f->tableValues == NULL) {
+        mallocError = true;
+        return false;
+    }
+    for (size_t i=0; i < tableSize; i++)
+        f->tableValues[i] = UINT32_MAX;
+    f->tableShift = 64 - tableBits;
+
+    mpz_set_ui (alphaPower, 1);
+    bool ok = true;
+    for (size_t k=0; ok && k < m; k++) {
+        uint64_t key = phTableKey (alphaPower);
+        size_t slot = phTableSlot (key, f->tableShift);
+        while (f->tableValues[slot] != UINT32_MAX) {
+            if (f->tableKeys[slot] == key) {
+                ok = false;
+                break;
+            }
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        f->tableKeys[slot] = key;
+        f->tableValues[slot] = (UIntType) k;
+
+        mpz_mul (alphaPower, alphaPower, f->alphaBar);
+        mpz_mod (alphaPower, alphaPower, p);
+    }
+
+    if (!ok) {
+        free (f->tableKeys); f->tableKeys = NULL;
+        free (f->tableValues); f->tableValues = NULL;
+        return false;
+    }
+
+    // alphaPower = alphaBar^m now
+    mpz_invert (f->giantStep, alphaPower, p);
+    f->babySteps = m;
+    mpz_cdiv_q_ui (tmp, f->q, m);
+    f->giantSteps = mpz_get_ui (tmp);
+
+    return true;
+}
+
+/*
+ * Computes log base alphaBar of beta, where beta is in the subgroup of
+ * order q. Sets mallocError if pollard_rho could not allocate its walk.
+ *
+ * A key match is not verified, which could only go wrong if two distinct
+ * elements of Z_p agree in their low 64 bits.
+ */
+void PohligHellmanContext::subgroupLog (mpz_t result, PHFactorData *f, mpz_t beta,
+                                        gmp_randstate_t rstate) {
+    if (f->babySteps > 0) {
+        size_t tableMask = ((size_t)1 << (64 - f->tableShift)) - 1;
+        mpz_set (alphaPower, beta);
+        for (size_t g=0; g < f->giantSteps; g++) {
+            uint64_t key = phTableKey (alphaPower);
+            size_t slot = phTableSlot (key, f->tableShift);
+            while (f->tableValues[slot] != UINT32_MAX) {
+                if (f->tableKeys[slot] == key) {
+                    mpz_set_ui (result, g);
+                    mpz_mul_ui (result, result, f->babySteps);
+                    mpz_add_ui (result, result, f->tableValues[slot]);
+                    return;
+                }
+                slot = (slot + 1) & tableMask;
+            }
+            mpz_mul (alphaPower, alphaPower, f->giantStep);
+            mpz_mod (alphaPower, alphaPower, p);
+        }
+        // beta is not in the subgroup, let pollard_rho deal with it
+    } else if (threads != 1 && mpz_sizeinbase (f->q, 2) >= parallelMinBits) {
+        if (pollard_rho_parallel (result, f->alphaBar, p, f->q, beta, rstate, threads))
+            return;
+    }
+    if (pollard_rho (result, f->alphaBar, p, f->q, beta, rstate, x, a, b, x1, a1, b1, alphaPower) == 0) {
+        mallocError = true;
+        mpz_set_ui (result, 0);
+        return;
+    }
+    mpz_mod (result, result, f->q);
+}
+
+/*
+ * Read the constants and table of f as written by write, after checking
+ * that they are for the same q^c. On failure the table is freed and the
+ * constants are left to be computed.
+ */
+bool PohligHellmanContext::readFactor (PHFactorData *f, FILE *saved) {
+    unsigned int power;
+    uint64_t babySteps, giantSteps;
+    if (mpz_inp_raw (tmp, saved) == 0 || mpz_cmp (tmp, f->q) != 0
+        || fread (&power, sizeof (power), 1, saved) != 1 || power != f->power
+        || mpz_inp_raw (f->alphaInv, saved) == 0
+        || mpz_inp_raw (f->alphaBar, saved) == 0
+        || mpz_inp_raw (f->crt, saved) == 0
+        || fread (&babySteps, sizeof (babySteps), 1, saved) != 1
+        || fread (&giantSteps, sizeof (giantSteps), 1, saved) != 1
+        || mpz_inp_raw (f->giantStep, saved) == 0
+        || fread (&f->tableShift, sizeof (f->tableShift), 1, saved) != 1)
+        return false;
+    if (babySteps == 0)
+        return true;
+    if (f->tableShift == 0 || f->tableShift >= 64)
+        return false;
+
+    size_t tableSize = (size_t)1 << (64 - f->tableShift);
+    f->tableKeys = (uint64_t *) malloc (tableSize * sizeof (uint64_t));
+    f->tableValues = (UIntType *) malloc (tableSize * sizeof (UIntType));
+    if (f->tableKeys == NULL || f->tableValues == NULL
+        || fread (f->tableKeys, sizeof (uint64_t), tableSize, saved) != tableSize
+        || fread (f->tableValues, sizeof (UIntType), tableSize, saved) != tableSize) {
+        free (f->tableKeys); f->tableKeys = NULL;
+        free (f->tableValues); f->tableValues = NULL;
+        return false;
+    }
+    f->babySteps = babySteps;
+    f->giantSteps = giantSteps;
+    return true;
+}
+
+/*
+ * Pohlig-Hellman algorithm for discrete logs.
+ * See Handbook of Applied Cryptography, algorithm 3.63 page 108.
  *
  * Computes log base alpha of beta, where all operations are done
  * in Z_p and n is the order of alpha in Z_p.
  *
  * Uses pollard_rho to compute logs in groups of prime order.
+ *
+ * The constructor computes everything that depends only on alpha, p and n,
+ * which in the attacks is the same for every call.
  */
-void pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n,
-                     mpz_t beta, gmp_randstate_t rstate, PH_ARG_LIST) {
+PohligHellmanContext::PohligHellmanContext (mpz_t alpha, mpz_t p, CFactoredInteger *n,
+                                            size_t maxBabySteps, FILE *saved) {
+    mallocError = false;
+    this->maxBabySteps = maxBabySteps;
+    nFactors = 0;
+    factors = NULL;
+    treeExp = treeScratch = projections = NULL;
+    treeSize = 0;
+    threads = 1;
+    parallelMinBits = PH_PARALLEL_RHO_MIN_BITS;
+
+    size_t pBits = mpz_sizeinbase (p, 2);
+
+    mpz_init_set (this->p, p);
+    mpz_init_set (this->n, n->value);
+
+    mpz_init2 (gamma, pBits); mpz_init2 (betaStripped, pBits); mpz_init2 (betaBar, pBits);
+    mpz_init (xi); mpz_init (lj); mpz_init2 (tmp, pBits);
+    mpz_init (x); mpz_init (a); mpz_init (b);
+    mpz_init (x1); mpz_init (a1); mpz_init (b1);
+    mpz_init2 (alphaPower, pBits);
+
+    // the heap numbered tree has fewer than 4 * nFactors nodes
+    treeSize = 4 * n->nFactors + 1;
+    treeExp = (mpz_t *) malloc (sizeof (mpz_t) * treeSize);
+    treeScratch = (mpz_t *) malloc (sizeof (mpz_t) * (n->nFactors + 1));
+    projections = (mpz_t *) malloc (sizeof (mpz_t) * (n->nFactors + 1));
+    factors = (PHFactorData *) malloc (sizeof (PHFactorData) * n->nFactors);
+    if (treeExp == NULL || treeScratch == NULL || projections == NULL || factors == NULL) {
+        if (treeExp != NULL) { free (treeExp); treeExp = NULL; }
+        mallocError = true;
+        return;
+    }
+    for (unsigned int i=0; i < treeSize; i++)
+        mpz_init (treeExp[i]);
+    for (unsigned int i=0; i <= n->nFactors; i++) {
+        mpz_init2 (treeScratch[i], pBits);
+        mpz_init2 (projections[i], pBits);
+    }
+    if (n->nFactors > 0)
+        buildTree (1, 0, n->nFactors, n);
+
+    if (saved != NULL) {
+        unsigned int savedFactors;
+        uint64_t savedBabySteps;
+        if (fread (&savedFactors, sizeof (savedFactors), 1, saved) != 1
+            || savedFactors != n->nFactors
+            || fread (&savedBabySteps, sizeof (savedBabySteps), 1, saved) != 1
+            || savedBabySteps != maxBabySteps)
+            saved = NULL;
+    }
 
-    unsigned int c;
+    for (unsigned int i=0; i < n->nFactors; i++) {
+        PHFactorData *f = &factors[i];
+
+        f->qPowers = (mpz_t *) malloc (sizeof (mpz_t) * n->factors[i].power);
+        if (f->qPowers == NULL) {
+            mallocError = true;
+            return;
+        }
+        nFactors++;
+
+        mpz_init_set (f->q, n->factors[i].prime);
+        f->power = n->factors[i].power;
+
+        mpz_init_set_ui (f->qPowers[0], 1);
+        for (unsigned int j=1; j < f->power; j++) {
+            mpz_init (f->qPowers[j]);
+            mpz_mul (f->qPowers[j], f->qPowers[j-1], f->q);
+        }
+
+        mpz_init (f->ndivqc);
+        mpz_divexact (f->ndivqc, n->value, n->factors[i].value);
+        mpz_init (f->alphaInv);
+        mpz_init (f->alphaBar);
+        mpz_init (f->crt);
+        mpz_init (f->giantStep);
+        f->babySteps = 0;
+        f->giantSteps = 0;
+        f->tableShift = 0;
+        f->tableKeys = NULL;
+        f->tableValues = NULL;
+
+        // once anything fails to load, the rest of saved is not read
+        if (saved != NULL && !readFactor (f, saved))
+            saved = NULL;
+        if (saved != NULL)
+            continue;
+
+        // generator of the subgroup of order q^c, and its inverse
+        mpz_powm (f->alphaInv, alpha, f->ndivqc, p);
+        mpz_powm (f->alphaBar, f->alphaInv, f->qPowers[f->power-1], p);
+        mpz_invert (f->alphaInv, f->alphaInv, p);
+
+        // crt = (n/q^c) * ((n/q^c)^-1 mod q^c)
+        mpz_invert (f->crt, f->ndivqc, n->factors[i].value);
+        mpz_mul (f->crt, f->crt, f->ndivqc);
+
+        buildTable (f, maxBabySteps);
+        if (mallocError)
+            return;
+    }
+}
+
+bool PohligHellmanContext::write (FILE *f) {
+    if (mallocError)
+        return false;
+    uint64_t babySteps = maxBabySteps;
+    bool ok = fwrite (&nFactors, sizeof (nFactors), 1, f) == 1
+              && fwrite (&babySteps, sizeof (babySteps), 1, f) == 1;
+    for (unsigned int i=0; ok && i < nFactors; i++) {
+        PHFactorData *d = &factors[i];
+        uint64_t giantSteps = d->giantSteps;
+        babySteps = d->babySteps;
+        ok = mpz_out_raw (f, d->q) != 0
+             && fwrite (&d->power, sizeof (d->power), 1, f) == 1
+             && mpz_out_raw (f, d->alphaInv) != 0
+             && mpz_out_raw (f, d->alphaBar) != 0
+             && mpz_out_raw (f, d->crt) != 0
+             && fwrite (&babySteps, sizeof (babySteps), 1, f) == 1
+             && fwrite (&giantSteps, sizeof (giantSteps), 1, f) == 1
+             && mpz_out_raw (f, d->giantStep) != 0
+             && fwrite (&d->tableShift, sizeof (d->tableShift), 1, f) == 1;
+        if (ok && d->babySteps > 0) {
+            size_t tableSize = (size_t)1 << (64 - d->tableShift);
+            ok = fwrite (d->tableKeys, sizeof (uint64_t), tableSize, f) == tableSize
+                 && fwrite (d->tableValues, sizeof (UIntType), tableSize, f) == tableSize;
+        }
+    }
+    return ok;
+}
+
+PohligHellmanContext::~PohligHellmanContext () {
+    for (unsigned int i=0; i < nFactors; i++) {
+        PHFactorData *f = &factors[i];
+        mpz_clear (f->q);
+        for (unsigned int j=0; j < f->power; j++)
+            mpz_clear (f->qPowers[j]);
+        free (f->qPowers);
+        mpz_clear (f->ndivqc);
+        mpz_clear (f->alphaInv);
+        mpz_clear (f->alphaBar);
+        mpz_clear (f->crt);
+        mpz_clear (f->giantStep);
+        if (f->tableKeys != NULL)
+            free (f->tableKeys);
+        if (f->tableValues != NULL)
+            free (f->tableValues);
+    }
+    if (factors != NULL)
+        free (factors);
+    if (treeExp != NULL) {
+        for (unsigned int i=0; i < treeSize; i++)
+            mpz_clear (treeExp[i]);
+        for (unsigned int i=0; i <= treeSize / 4; i++) {
+            mpz_clear (treeScratch[i]);
+            mpz_clear (projections[i]);
+        }
+        free (treeExp);
+    }
+    if (treeScratch != NULL)
+        free (treeScratch);
+    if (projections != NULL)
+        free (projections);
+
+    mpz_clear (p); mpz_clear (n);
+    mpz_clear (gamma); mpz_clear (betaStripped); mpz_clear (betaBar);
+    mpz_clear (xi); mpz_clear (lj); mpz_clear (tmp);
+    mpz_clear (x); mpz_clear (a); mpz_clear (b);
+    mpz_clear (x1); mpz_clear (a1); mpz_clear (b1);
+    mpz_clear (alphaPower);
+}
+
+void PohligHellmanContext::buildTree (unsigned int node, unsigned int lo, unsigned int hi,
+                                      CFactoredInteger *n) {
+    if (hi - lo < 2)
+        return;
+    unsigned int mid = (lo + hi) / 2;
+
+    mpz_set_ui (treeExp[2*node], 1);
+    for (unsigned int i=mid; i < hi; i++)
+        mpz_mul (treeExp[2*node], treeExp[2*node], n->factors[i].value);
+
+    mpz_set_ui (treeExp[2*node+1], 1);
+    for (unsigned int i=lo; i < mid; i++)
+        mpz_mul (treeExp[2*node+1], treeExp[2*node+1], n->factors[i].value);
+
+    buildTree (2*node, lo, mid, n);
+    buildTree (2*node+1, mid, hi, n);
+}
+
+/*
+ * Sets out[i] = x^(n/q_i^c_i) for lo <= i < hi, where x is the value at node.
+ * Going down the tree instead of raising x to each n/q^c separately cuts the
+ * total exponent length from about (number of factors) * log n to about
+ * log (number of factors) * log n.
+ */
+void PohligHellmanContext::project (mpz_t *out, unsigned int node, unsigned int lo,
+                                    unsigned int hi, mpz_t x, unsigned int depth) {
+    if (hi - lo == 1) {
+        mpz_set (out[lo], x);
+        return;
+    }
+    unsigned int mid = (lo + hi) / 2;
+
+    mpz_powm (treeScratch[depth], x, treeExp[2*node], p);
+    project (out, 2*node, lo, mid, treeScratch[depth], depth + 1);
+
+    mpz_powm (treeScratch[depth], x, treeExp[2*node+1], p);
+    project (out, 2*node+1, mid, hi, treeScratch[depth], depth + 1);
+}
+
+/*
+ * Log base alpha^(n/q^c) of gamma, which is in the subgroup of order q^c.
+ */
+void PohligHellmanContext::primePowerLog (mpz_t result, PHFactorData *f, mpz_t gamma,
+                                          gmp_randstate_t rstate) {
 
-    PrimePower *factors = n->factors;
-    unsigned int nFactors = n->nFactors;
-    
     /*
      * Note that alpha^x = beta = alpha^{x_0} alpha^{x_1 q} alpha^{x_2 q^2}
      *                     ... alpha^{x_{c-1} q^{c-1}} alpha^{q^c n} 
@@ -234,100 +1024,101 @@ void pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n,
      * with a q^k in their exponent, where k >= j.
      */
 
-    mpz_set_ui (result, 0);
-
-    for (unsigned int i=0; i < nFactors; i++) {
+    unsigned int c = f->power;
 
-        // calculate xi = x mod q^c, where q^c is the current prime power
-        mpz_set (betaStripped, beta);
-
-        mpz_set (q, factors[i].prime);
-        c = factors[i].power;
-
-        //gmp_printf ("[%u] %Zd^%u\n", i, q, c);
+    if (c == 1) {
+        subgroupLog (result, f, gamma, rstate);
+        return;
+    }
 
-        mpz_div (ndivq, n->value, q);
-        //gmp_printf ("ndivq = %Zd\n", ndivq);
-        mpz_powm (alphaBar, alpha, ndivq, p);
-        //gmp_printf ("alphaBar = %Zd\n", alphaBar);
+    mpz_set (betaStripped, gamma);
+    mpz_set_ui (result, 0);
 
-        mpz_powm (betaBar, beta, ndivq, p);
-        //gmp_printf ("betaBar = %Zd\n", betaBar);
-        mpz_set_ui (qj, 1);
+    for (unsigned int j=0; j < c; j++) {
 
-        pollard_rho (lj, alphaBar, p, q, betaBar, rstate, x, a, b, x1, a1, b1, alphaPower);
-        mpz_set (xi, lj);
+        // betaBar = betaStripped^(q^(c-1-j)) is in the subgroup of order q
+        if (j == c - 1)
+            mpz_set (betaBar, betaStripped);
+        else
+            mpz_powm (betaBar, betaStripped, f->qPowers[c-1-j], p);
 
-        //mpz_set (xi, lj); // x_0 = log_alphaBar (beta^(n/q))
+        subgroupLog (lj, f, betaBar, rstate);
 
-        for (unsigned int j=1; j < c; j++) {
+        // l_j q^j is the next digit, strip it off
+        mpz_mul (lj, lj, f->qPowers[j]);
+        mpz_add (result, result, lj);
 
-            // strip off the alpha^(lj q^j) term we just found
-            mpz_neg (lj, lj);
-            mpz_powm (alphaStrip, alpha, lj, p);
-            mpz_mul (betaStripped, betaStripped, alphaStrip);
+        if (j < c - 1 && mpz_sgn (lj) != 0) {
+            mpz_powm (tmp, f->alphaInv, lj, p);
+            mpz_mul (betaStripped, betaStripped, tmp);
             mpz_mod (betaStripped, betaStripped, p);
-            //gmp_printf ("betaStripped = %Zd\n", betaStripped);
-            
-            // now raise to the n/q^(j+2)
-            mpz_div (ndivq, ndivq, q);
-            //gmp_printf ("ndivq = %Zd\n", ndivq);
-            mpz_powm (betaBar, betaStripped, ndivq, p);
-
-            // l_j = log_alphaBar (betaBar)) = log_{alpha^(n/q)} (betaStripped^(n/q^j+2))
-            pollard_rho (lj, alphaBar, p, q, betaBar, rstate, x, a, b, x1, a1, b1, alphaPower);
-
-            mpz_mul (qj, qj, q); // mods?
-            mpz_mul (lj, lj, qj);
-            mpz_add (xi, xi, lj);
-
         }
+    }
+}
 
-        //gmp_printf ("[%u] %Zd^%u: xi = %Zd\n", i, q, c, xi);
+void PohligHellmanContext::log (mpz_t result, mpz_t beta, gmp_randstate_t rstate) {
 
-        //mpz_pow_ui (qj, q, c);
-        mpz_div (ndivq, n->value, factors[i].value);
-        mpz_gcdext (lj, betaBar, NULL, ndivq, factors[i].value);
-        mpz_mul (betaStripped, betaBar, xi);
-        mpz_mul (betaBar, betaStripped, ndivq);
-        //mpz_mod (betaBar, betaBar, n->value);
-        mpz_add (result, result, betaBar);
-        mpz_mod (result, result, n->value);
+    if (nFactors == 0) {
+        mpz_set_ui (result, 0);
+        return;
+    }
+
+    // project beta into the subgroup of order q^c for every factor
+    project (projections, 1, 0, nFactors, beta, 0);
 
+    mpz_set_ui (result, 0);
+    for (unsigned int i=0; i < nFactors; i++) {
+        primePowerLog (xi, &factors[i], projections[i], rstate);
+        //gmp_printf ("[%u] %Zd^%u: xi = %Zd\n", i, factors[i].q, factors[i].power, xi);
+        mpz_addmul (result, xi, factors[i].crt);
     }
 
+    mpz_mod (result, result, n);
 }
 
-void pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n,
-                     mpz_t beta, gmp_randstate_t rstate) {
-    /*
-    mpz_t xi, q, qj, lj, ndivq;
-    mpz_t alphaBar, betaBar;
-    mpz_t betaStripped, alphaStrip;
-    mpz_t x, a, b, x1, a1, b1;
+bool PohligHellmanContext::logBatch (mpz_t *results, mpz_t *betas, size_t count,
+                                     gmp_randstate_t rstate) {
 
-    mpz_init (x); mpz_init (a); mpz_init (b);
-    mpz_init (x1); mpz_init (a1); mpz_init (b1);
+    for (size_t k=0; k < count; k++)
+        mpz_set_ui (results[k], 0);
+    if (nFactors == 0)
+        return true;
+
+    // row k holds the projections of betas[k]
+    size_t projCount = count * nFactors;
+    mpz_t *proj = (mpz_t *) malloc (projCount * sizeof (mpz_t));
+    if (proj == NULL)
+        return false;
+    for (size_t k=0; k < projCount; k++)
+        mpz_init2 (proj[k], mpz_sizeinbase (p, 2));
 
-    mpz_init (xi); mpz_init (q); mpz_init (qj); mpz_init (lj); mpz_init (ndivq);
-    mpz_init (alphaBar); mpz_init (betaBar);
-    mpz_init (betaStripped); mpz_init (alphaStrip);
+    for (size_t k=0; k < count; k++)
+        project (proj + k * nFactors, 1, 0, nFactors, betas[k], 0);
 
-    */
-    // 15 mpz_t local variables!!!
+    for (unsigned int i=0; i < nFactors; i++) {
+        for (size_t k=0; k < count; k++) {
+            primePowerLog (xi, &factors[i], proj[k * nFactors + i], rstate);
+            mpz_addmul (results[k], xi, factors[i].crt);
+        }
+    }
 
-    DECLARE_PH_LOCALS
-    INIT_PH_LOCALS(p)
-    pohlig_hellman (result, alpha, p, n, beta, rstate, LIST_PH_LOCALS);
-    CLEAR_PH_LOCALS
+    for (size_t k=0; k < count; k++)
+        mpz_mod (results[k], results[k], n);
 
-/*
-    mpz_clear (xi); mpz_clear (q); mpz_clear (qj); mpz_clear (lj); mpz_clear (ndivq);
-    mpz_clear (alphaBar); mpz_clear (betaBar);
-    mpz_clear (betaStripped); mpz_clear (alphaStrip);
+    for (size_t k=0; k < projCount; k++)
+        mpz_clear (proj[k]);
+    free (proj);
 
-    mpz_clear (x); mpz_clear (a); mpz_clear (b);
-    mpz_clear (x1); mpz_clear (a1); mpz_clear (b1);
-    */
+    return !mallocError;
 }
 
+bool pohlig_hellman (mpz_t result, mpz_t alpha, mpz_t p, CFactoredInteger *n,
+                     mpz_t beta, gmp_randstate_t rstate, unsigned int threads) {
+    // building lookup tables for a single log is not worth it
+    PohligHellmanContext ph (alpha, p, n, 0);
+    if (ph.hasMallocError ())
+        return false;
+    ph.setThreads (threads);
+    ph.log (result, beta, rstate);
+    return !ph.hasMallocError ();
+}
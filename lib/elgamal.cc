@@ -11,6 +11,7 @@
 #include "../include/types.h"
 #include "../include/randomhelpers.h"
 #include "../include/elgamal.h"
+#include "../include/fixedbase.h"
 
 //#define DEBUG 1
 
@@ -33,6 +34,23 @@ void elgamalEncrypt (ElgamalCipherText *ct, const mpz_t m,
     mpz_clear (k);
 }
 
+void elgamalEncryptFixedBase (ElgamalCipherText *ct, const mpz_t m, const mpz_t p,
+                              FixedBasePowm *g, const mpz_t nMinus1,
+                              FixedBasePowm *y, gmp_randstate_t rstate) {
+    mpz_t k;
+    mpz_init (k);
+    mpz_urandomm (k, rstate, nMinus1); // 0 - n-2
+    mpz_add_ui (k, k, 1); // 1 - n-1
+
+    g->powm (ct->gk, k);
+
+    y->powm (ct->myk, k);
+    mpz_mul (ct->myk, ct->myk, m);
+    mpz_mod (ct->myk, ct->myk, p);
+
+    mpz_clear (k);
+}
+
 void elgamalDecrypt (mpz_t m, const ElgamalCipherText ct,
                               const mpz_t p, const mpz_t x) {
     mpz_invert (m, ct.gk, p);
@@ -0,0 +1,920 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  factor.cc
+ *
+ *    Description:  Integer factoring by trial division, Pollard-Brent rho and
+ *                  the elliptic curve method.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "../include/montgomery.h"
+#include "../include/primes.h"
+#include "../include/factor.h"
+
+// rho multiplies this many differences together between gcds
+#define RHO_BATCH 128
+
+// ECM stage 2 covers primes up to ECM_B2_FACTOR * B1, with giant steps of
+// ECM_D = 2 3 5 7.
+#define ECM_B2_FACTOR 50
+#define ECM_D 210
+
+// residues used by ecmCurve, including the baby steps j Q for odd j < D / 2
+#define ECM_BABY_STEPS (ECM_D / 4 + 1)
+#define ECM_WORK_RESIDUES (2 * ECM_BABY_STEPS + 23)
+
+/*
+ * B1 and curve counts, from the GMP-ECM recommendations for factors of 15,
+ * 20, 25, ... decimal digits. bits is the size of factor each level is
+ * meant to find.
+ */
+static const struct {
+    unsigned int bits;
+    unsigned long B1;
+    unsigned int curves;
+} ecmLevels[] = {
+    {  30,     150,   10 },
+    {  40,     500,   20 },
+    {  50,    2000,   25 },
+    {  66,   11000,   90 },
+    {  83,   50000,  300 },
+    { 100,  250000,  700 },
+    { 116, 1000000, 1800 },
+    { 133, 3000000, 5100 },
+};
+#define ECM_LEVELS (sizeof (ecmLevels) / sizeof (*ecmLevels))
+
+//*********************** FACTOR LISTS *******************************
+
+void factorListInit (FactorList *list) {
+    list->length = 0;
+    list->size = 0;
+    list->primes = NULL;
+}
+
+void factorListClear (FactorList *list) {
+    for (size_t i=0; i < list->size; i++)
+        mpz_clear (list->primes[i]);
+    free (list->primes);
+    factorListInit (list);
+}
+
+static bool factorListPush (FactorList *list, const mpz_t p) {
+    if (list->length == list->size) {
+        size_t size = list->size == 0 ? 16 : 2 * list->size;
+        mpz_t *primes = (mpz_t *) realloc (list->primes, size * sizeof (mpz_t));
+        if (primes == NULL)
+            return false;
+        list->primes = primes;
+        for (size_t i=list->size; i < size; i++)
+            mpz_init (list->primes[i]);
+        list->size = size;
+    }
+    mpz_set (list->primes[list->length++], p);
+    return true;
+}
+
+static int compareMpz (const void *a, const void *b) {
+    return mpz_cmp (*(const mpz_t *) a, *(const mpz_t *) b);
+}
+
+void factorListSort (FactorList *list) {
+    qsort (list->primes, list->length, sizeof (mpz_t), compareMpz);
+}
+
+/*
+ * Keep a prime factor, or fold it into the cofactor if it is larger than
+ * factorBitLimit.
+ */
+static bool keepFactor (FactorList *list, mpz_t cofactor, const mpz_t p,
+                        unsigned int factorBitLimit) {
+    if (factorBitLimit > 0 && mpz_sizeinbase (p, 2) > factorBitLimit) {
+        mpz_mul (cofactor, cofactor, p);
+        return true;
+    }
+    return factorListPush (list, p);
+}
+
+static void mpzSetUint64 (mpz_t r, uint64_t x) {
+    if (sizeof (unsigned long) >= sizeof (uint64_t)) {
+        mpz_set_ui (r, (unsigned long) x);
+    } else {
+        mpz_set_ui (r, (unsigned long) (x >> 32));
+        mpz_mul_2exp (r, r, 32);
+        mpz_add_ui (r, r, (unsigned long) (x & 0xffffffff));
+    }
+}
+
+//*********************** SINGLE WORD *******************************
+
+// The single word code needs a double word product.
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 uint128_t;
+
+/*
+ * Montgomery arithmetic modulo an odd n < 2^64 with R = 2^64.
+ */
+typedef struct {
+    uint64_t n;
+    uint64_t nInv;   // n^-1 mod 2^64
+    uint64_t one;    // R mod n
+} Mont64;
+
+static void mont64Init (Mont64 *m, uint64_t n) {
+    m->n = n;
+    uint64_t inv = n;
+    for (int i=0; i < 5; i++)
+        inv *= 2 - n * inv;
+    m->nInv = inv;
+    m->one = (0 - n) % n;
+}
+
+static inline uint64_t mont64Mul (const Mont64 *m, uint64_t a, uint64_t b) {
+    uint128_t t = (uint128_t) a * b;
+    uint64_t q = (uint64_t) t * m->nInv;
+    // t - q n is divisible by R, so the low words cancel
+    uint64_t hi = (uint64_t) (t >> 64);
+    uint64_t qnHi = (uint64_t) (((uint128_t) q * m->n) >> 64);
+    return hi >= qnHi ? hi - qnHi : hi - qnHi + m->n;
+}
+
+static inline uint64_t mont64To (const Mont64 *m, uint64_t a) {
+    return (uint64_t) (((uint128_t) (a % m->n) << 64) % m->n);
+}
+
+static inline uint64_t mont64Add (const Mont64 *m, uint64_t a, uint64_t b) {
+    uint64_t s = a + b;
+    return (s < a || s >= m->n) ? s - m->n : s;
+}
+
+static uint64_t gcd64 (uint64_t a, uint64_t b) {
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+    int shift = __builtin_ctzll (a | b);
+    a >>= __builtin_ctzll (a);
+    while (b != 0) {
+        b >>= __builtin_ctzll (b);
+        if (a > b) {
+            uint64_t t = a; a = b; b = t;
+        }
+        b -= a;
+    }
+    return a << shift;
+}
+
+/*
+ * A table lookup for small n, otherwise Miller-Rabin with the 7 bases found
+ * by Jim Sinclair, which together have no strong pseudoprime below 2^64.
+ */
+bool isPrime64 (uint64_t n) {
+    static const uint32_t small[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    static const uint64_t bases[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+
+    if (n <= primeTableLimit ())
+        return primeTableIsPrime (n);
+    for (unsigned int i=0; i < sizeof (small) / sizeof (*small); i++) {
+        if (n == small[i])
+            return true;
+        if (n % small[i] == 0)
+            return false;
+    }
+    if (n < 37 * 37)
+        return true;
+
+    Mont64 m;
+    mont64Init (&m, n);
+    uint64_t d = n - 1;
+    int s = __builtin_ctzll (d);
+    d >>= s;
+    uint64_t minusOne = n - m.one;
+
+    for (unsigned int i=0; i < sizeof (bases) / sizeof (*bases); i++) {
+        uint64_t a = bases[i] % n;
+        if (a == 0)
+            continue;
+        uint64_t x = m.one, b = mont64To (&m, a);
+        for (uint64_t e=d; e != 0; e >>= 1) {
+            if (e & 1)
+                x = mont64Mul (&m, x, b);
+            b = mont64Mul (&m, b, b);
+        }
+        if (x == m.one || x == minusOne)
+            continue;
+        int j;
+        for (j=1; j < s; j++) {
+            x = mont64Mul (&m, x, x);
+            if (x == minusOne)
+                break;
+        }
+        if (j == s)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * A nontrivial factor of the odd composite n, by Pollard rho with Brent's
+ * cycle detection.
+ */
+static uint64_t rho64 (uint64_t n) {
+    Mont64 m;
+    mont64Init (&m, n);
+
+    for (uint64_t c=1; ; c++) {
+        uint64_t x, y = 2, ys = 2, q = m.one, g = 1;
+        for (uint64_t r=1; g == 1; r *= 2) {
+            x = y;
+            for (uint64_t i=0; i < r; i++)
+                y = mont64Add (&m, mont64Mul (&m, y, y), c);
+            for (uint64_t k=0; k < r && g == 1; k += RHO_BATCH) {
+                ys = y;
+                uint64_t steps = r - k < RHO_BATCH ? r - k : RHO_BATCH;
+                for (uint64_t i=0; i < steps; i++) {
+                    y = mont64Add (&m, mont64Mul (&m, y, y), c);
+                    q = mont64Mul (&m, q, x > y ? x - y : y - x);
+                }
+                g = gcd64 (q, n);
+            }
+        }
+        if (g == n) {
+            // the batch overshot, redo it one step at a time
+            do {
+                ys = mont64Add (&m, mont64Mul (&m, ys, ys), c);
+                g = gcd64 (x > ys ? x - ys : ys - x, n);
+            } while (g == 1);
+        }
+        if (g != n)
+            return g;
+    }
+}
+
+/*
+ * Factor n < 2^64 completely.
+ */
+static bool factor64 (FactorList *list, mpz_t cofactor, uint64_t n,
+                      unsigned int factorBitLimit) {
+    // at most 64 factors are pending at once
+    uint64_t stack[64];
+    int top = 0;
+    mpz_t p;
+    mpz_init (p);
+    bool ok = true;
+
+    if (n > 1)
+        stack[top++] = n;
+    while (ok && top > 0) {
+        uint64_t m = stack[--top];
+        if ((m & 1) == 0) {
+            int twos = __builtin_ctzll (m);
+            mpz_set_ui (p, 2);
+            for (int i=0; ok && i < twos; i++)
+                ok = keepFactor (list, cofactor, p, factorBitLimit);
+            m >>= twos;
+            if (m > 1)
+                stack[top++] = m;
+        } else if (isPrime64 (m)) {
+            mpzSetUint64 (p, m);
+            ok = keepFactor (list, cofactor, p, factorBitLimit);
+        } else {
+            uint64_t d = rho64 (m);
+            stack[top++] = d;
+            stack[top++] = m / d;
+        }
+    }
+
+    mpz_clear (p);
+    return ok;
+}
+
+#endif
+
+//*********************** PRIMALITY *******************************
+
+// The local Baillie-PSW test is only needed where there is neither the 128
+// bit Miller-Rabin above nor the Baillie-PSW test of GMP 6.2.
+#if !defined (__SIZEOF_INT128__) || __GNU_MP_RELEASE < 60200
+#define FACTOR_LOCAL_BPSW 1
+#endif
+
+#ifdef FACTOR_LOCAL_BPSW
+static bool isProbablePrimeBPSW (const mpz_t n);
+#endif
+
+#ifndef __SIZEOF_INT128__
+// BPSW has been checked to have no pseudoprimes below 2^64.
+bool isPrime64 (uint64_t n) {
+    if (n <= primeTableLimit ())
+        return primeTableIsPrime (n);
+    if (n % 2 == 0)
+        return false;
+    mpz_t m;
+    mpz_init (m);
+    mpzSetUint64 (m, n);
+    bool prime = isProbablePrimeBPSW (m);
+    mpz_clear (m);
+    return prime;
+}
+#endif
+
+/*
+ * Products of the odd primes below FACTOR_PREFILTER_LIMIT, each as large as
+ * fits in an unsigned long, so a candidate is checked against all of them
+ * with one mpz_fdiv_ui per group.
+ */
+typedef struct PrefilterGroups {
+    unsigned long products[FACTOR_PREFILTER_LIMIT / 4];
+    unsigned long primes[FACTOR_PREFILTER_LIMIT / 2];
+    unsigned int ends[FACTOR_PREFILTER_LIMIT / 4];   // one past the last prime of each group
+    unsigned int count;
+
+    PrefilterGroups () {
+        PrimeIterator it;
+        primeIteratorInit (&it, 3);
+        unsigned int k = 0;
+        unsigned long product = 1;
+        count = 0;
+        for (unsigned long p=primeIteratorNext (&it); p != 0 && p < FACTOR_PREFILTER_LIMIT;
+             p=primeIteratorNext (&it)) {
+            if (product > ~0ul / p) {
+                products[count] = product;
+                ends[count++] = k;
+                product = 1;
+            }
+            primes[k++] = p;
+            product *= p;
+        }
+        if (product > 1) {
+            products[count] = product;
+            ends[count++] = k;
+        }
+    }
+} PrefilterGroups;
+
+// n has to be larger than every prime in the groups
+static bool hasSmallFactor (const mpz_t n) {
+    static PrefilterGroups groups;
+    if (mpz_even_p (n))
+        return true;
+    for (unsigned int g=0, k=0; g < groups.count; g++) {
+        unsigned long r = mpz_fdiv_ui (n, groups.products[g]);
+        for (; k < groups.ends[g]; k++)
+            if (r % groups.primes[k] == 0)
+                return true;
+    }
+    return false;
+}
+
+#ifdef FACTOR_LOCAL_BPSW
+// r = r / 2 mod n, for odd n
+static void halveMod (mpz_t r, const mpz_t n) {
+    if (mpz_odd_p (r))
+        mpz_add (r, r, n);
+    mpz_fdiv_q_2exp (r, r, 1);
+}
+
+/*
+ * Baillie-PSW: a strong probable prime test to base 2 followed by a strong
+ * Lucas test with Selfridge's parameters P = 1, Q = (1 - D) / 4, for the
+ * first D in 5, -7, 9, -11, ... with (D / n) = -1. No composite is known
+ * to pass both. n has to be odd and larger than 3.
+ */
+static bool isProbablePrimeBPSW (const mpz_t n) {
+    mpz_t d, x, u, v, qk, t, q;
+    mpz_init (d); mpz_init (x); mpz_init (u); mpz_init (v);
+    mpz_init (qk); mpz_init (t); mpz_init (q);
+    bool prime = false;
+
+    // strong test to base 2, n - 1 = d 2^s
+    mpz_sub_ui (d, n, 1);
+    mp_bitcnt_t s = mpz_scan1 (d, 0);
+    mpz_fdiv_q_2exp (d, d, s);
+    mpz_set_ui (t, 2);
+    mpz_powm (x, t, d, n);
+    mpz_sub_ui (t, n, 1);
+    bool strong = mpz_cmp_ui (x, 1) == 0 || mpz_cmp (x, t) == 0;
+    for (mp_bitcnt_t r=1; !strong && r < s; r++) {
+        mpz_mul (x, x, x);
+        mpz_mod (x, x, n);
+        strong = mpz_cmp (x, t) == 0;
+    }
+    if (!strong || mpz_perfect_square_p (n))
+        goto done;
+
+    {
+        // D would never be found for a square
+        long D = 5;
+        for (;;) {
+            mpz_set_si (t, D);
+            int j = mpz_jacobi (t, n);
+            if (j == -1)
+                break;
+            if (j == 0 && mpz_cmpabs_ui (n, D < 0 ? -D : D) != 0)
+                goto done;
+            D = D < 0 ? -D + 2 : -D - 2;
+        }
+        mpz_set_si (q, (1 - D) / 4);
+        mpz_mod (q, q, n);
+
+        // n + 1 = d 2^s
+        mpz_add_ui (d, n, 1);
+        s = mpz_scan1 (d, 0);
+        mpz_fdiv_q_2exp (d, d, s);
+
+        // U_1 = 1, V_1 = P = 1, Q^1, then left to right over the bits of d
+        mpz_set_ui (u, 1);
+        mpz_set_ui (v, 1);
+        mpz_set (qk, q);
+        for (mp_bitcnt_t b=mpz_sizeinbase (d, 2) - 1; b-- > 0; ) {
+            // U_2k = U_k V_k, V_2k = V_k^2 - 2 Q^k
+            mpz_mul (u, u, v);
+            mpz_mod (u, u, n);
+            mpz_mul (v, v, v);
+            mpz_submul_ui (v, qk, 2);
+            mpz_mod (v, v, n);
+            mpz_mul (qk, qk, qk);
+            mpz_mod (qk, qk, n);
+            if (mpz_tstbit (d, b)) {
+                // U_k+1 = (P U_k + V_k) / 2, V_k+1 = (D U_k + P V_k) / 2
+                mpz_add (t, u, v);
+                mpz_mul_si (v, u, D);
+                mpz_add (v, v, t);
+                mpz_sub (v, v, u);
+                mpz_mod (v, v, n);
+                halveMod (v, n);
+                mpz_mod (u, t, n);
+                halveMod (u, n);
+                mpz_mul (qk, qk, q);
+                mpz_mod (qk, qk, n);
+            }
+        }
+
+        prime = mpz_sgn (u) == 0 || mpz_sgn (v) == 0;
+        for (mp_bitcnt_t r=1; !prime && r < s; r++) {
+            mpz_mul (v, v, v);
+            mpz_submul_ui (v, qk, 2);
+            mpz_mod (v, v, n);
+            mpz_mul (qk, qk, qk);
+            mpz_mod (qk, qk, n);
+            prime = mpz_sgn (v) == 0;
+        }
+    }
+
+done:
+    mpz_clear (d); mpz_clear (x); mpz_clear (u); mpz_clear (v);
+    mpz_clear (qk); mpz_clear (t); mpz_clear (q);
+    return prime;
+}
+
+#endif
+
+bool isProbablePrime (const mpz_t n) {
+    if (mpz_sgn (n) <= 0)
+        return false;
+    if (mpz_sizeinbase (n, 2) <= 64) {
+        uint64_t m = mpz_getlimbn (n, 0);
+#if GMP_NUMB_BITS < 64
+        m |= (uint64_t) mpz_getlimbn (n, 1) << GMP_NUMB_BITS;
+#endif
+        return isPrime64 (m);
+    }
+    if (hasSmallFactor (n))
+        return false;
+#if __GNU_MP_RELEASE >= 60200
+    // from 6.2 on this is Baillie-PSW as well, with a faster Lucas step
+    return mpz_probab_prime_p (n, 1) != 0;
+#else
+    return isProbablePrimeBPSW (n);
+#endif
+}
+
+//*********************** MULTIPLE WORDS *******************************
+
+static inline void rhoStep (MontgomeryContext &mont, mp_limb_t *y, const mp_limb_t *c) {
+    mont.sqr (y, y);
+    mont.add (y, y, c);
+}
+
+/*
+ * Pollard rho with Brent's cycle detection, on Montgomery residues modulo
+ * the odd composite m. Sets d to a nontrivial factor, or to 1 after
+ * maxIterations steps. work holds 6 residues.
+ */
+static void rhoMont (mpz_t d, MontgomeryContext &mont, const mpz_t m,
+                     unsigned long maxIterations, mp_limb_t *work) {
+    mp_size_t n = mont.n;
+    mp_limb_t *x = work, *y = x + n, *ys = y + n, *q = ys + n, *c = q + n, *diff = c + n;
+    mpz_t view;
+    unsigned long iterations = 0;
+
+    for (unsigned long constant=1; iterations < maxIterations; constant++) {
+        mpz_set_ui (d, constant);
+        mont.toMont (c, d);
+        mpz_set_ui (d, 2);
+        mont.toMont (y, d);
+        mont.set (ys, y);
+        mont.set (q, mont.one);
+        mpz_set_ui (d, 1);
+
+        for (unsigned long r=1; mpz_cmp_ui (d, 1) == 0; r *= 2) {
+            if (iterations >= maxIterations)
+                return;
+            mont.set (x, y);
+            for (unsigned long i=0; i < r; i++)
+                rhoStep (mont, y, c);
+            for (unsigned long k=0; k < r && mpz_cmp_ui (d, 1) == 0; k += RHO_BATCH) {
+                mont.set (ys, y);
+                unsigned long steps = r - k < RHO_BATCH ? r - k : RHO_BATCH;
+                for (unsigned long i=0; i < steps; i++) {
+                    rhoStep (mont, y, c);
+                    mont.sub (diff, x, y);
+                    mont.mul (q, q, diff);
+                }
+                mpz_gcd (d, mpz_roinit_n (view, q, n), m);
+            }
+            iterations += 2 * r;
+        }
+        if (mpz_cmp (d, m) == 0) {
+            do {
+                rhoStep (mont, ys, c);
+                mont.sub (diff, x, ys);
+                mpz_gcd (d, mpz_roinit_n (view, diff, n), m);
+            } while (mpz_cmp_ui (d, 1) == 0);
+        }
+        if (mpz_cmp (d, m) != 0)
+            return;
+        mpz_set_ui (d, 1);
+    }
+}
+
+/*
+ * x-only arithmetic on the Montgomery curve B y^2 = x^3 + A x^2 + x, with
+ * points in projective (X : Z) form and a24 = (A + 2) / 4.
+ */
+typedef struct {
+    MontgomeryContext *mont;
+    mp_limb_t *a24;
+    mp_limb_t *t1, *t2, *t3, *t4;
+    mp_limb_t *x0, *z0, *x1, *z1, *px, *pz;   // ladder state
+} EcmCurve;
+
+// (x2 : z2) = 2 (x : z), in place is fine
+static void ecmDouble (EcmCurve *e, mp_limb_t *x2, mp_limb_t *z2, const mp_limb_t *x, const mp_limb_t *z) {
+    MontgomeryContext *m = e->mont;
+    m->add (e->t1, x, z);
+    m->sqr (e->t1, e->t1);
+    m->sub (e->t2, x, z);
+    m->sqr (e->t2, e->t2);
+    m->mul (x2, e->t1, e->t2);
+    m->sub (e->t3, e->t1, e->t2);          // 4 x z
+    m->mul (e->t4, e->a24, e->t3);
+    m->add (e->t4, e->t4, e->t2);
+    m->mul (z2, e->t3, e->t4);
+}
+
+// (x3 : z3) = P + Q given P - Q = (xd : zd), which must not alias the result
+static void ecmAdd (EcmCurve *e, mp_limb_t *x3, mp_limb_t *z3,
+                    const mp_limb_t *xp, const mp_limb_t *zp,
+                    const mp_limb_t *xq, const mp_limb_t *zq,
+                    const mp_limb_t *xd, const mp_limb_t *zd) {
+    MontgomeryContext *m = e->mont;
+    m->sub (e->t1, xp, zp);
+    m->add (e->t2, xq, zq);
+    m->mul (e->t1, e->t1, e->t2);
+    m->add (e->t2, xp, zp);
+    m->sub (e->t3, xq, zq);
+    m->mul (e->t2, e->t2, e->t3);
+    m->add (e->t3, e->t1, e->t2);
+    m->sqr (e->t3, e->t3);
+    m->sub (e->t4, e->t1, e->t2);
+    m->sqr (e->t4, e->t4);
+    m->mul (x3, zd, e->t3);
+    m->mul (z3, xd, e->t4);
+}
+
+// (x : z) = k (x : z) by the Montgomery ladder, k >= 1
+static void ecmMultiply (EcmCurve *e, mp_limb_t *x, mp_limb_t *z, unsigned long k) {
+    MontgomeryContext *m = e->mont;
+    if (k == 1)
+        return;
+    m->set (e->px, x);
+    m->set (e->pz, z);
+    m->set (e->x0, x);
+    m->set (e->z0, z);
+    ecmDouble (e, e->x1, e->z1, x, z);
+
+    int bit = 8 * sizeof (k) - 1 - __builtin_clzl (k);
+    while (bit-- > 0) {
+        if ((k >> bit) & 1) {
+            ecmAdd (e, e->x0, e->z0, e->x0, e->z0, e->x1, e->z1, e->px, e->pz);
+            ecmDouble (e, e->x1, e->z1, e->x1, e->z1);
+        } else {
+            ecmAdd (e, e->x1, e->z1, e->x0, e->z0, e->x1, e->z1, e->px, e->pz);
+            ecmDouble (e, e->x0, e->z0, e->x0, e->z0);
+        }
+    }
+    m->set (x, e->x0);
+    m->set (z, e->z0);
+}
+
+static bool coprimeToD (unsigned int j) {
+    return j % 2 != 0 && j % 3 != 0 && j % 5 != 0 && j % 7 != 0;
+}
+
+/*
+ * One ECM curve modulo m, from Suyama's parametrization with the given
+ * sigma. Stage 1 multiplies by every prime power up to B1, stage 2 looks
+ * for one more prime up to B2 by comparing giant steps k D Q with baby steps
+ * j Q, since x (k D Q) = x (j Q) exactly when k D = +-j modulo the order of
+ * Q. Sets d to the gcd found, which may be 1 or m.
+ *
+ * work holds ECM_WORK_RESIDUES residues.
+ */
+static void ecmCurve (mpz_t d, MontgomeryContext &mont, const mpz_t m, unsigned long sigma,
+                      unsigned long B1, mp_limb_t *work) {
+    mp_size_t n = mont.n;
+    EcmCurve e;
+    e.mont = &mont;
+    e.a24 = work;
+    e.t1 = e.a24 + n; e.t2 = e.t1 + n; e.t3 = e.t2 + n; e.t4 = e.t3 + n;
+    e.x0 = e.t4 + n;  e.z0 = e.x0 + n; e.x1 = e.z0 + n; e.z1 = e.x1 + n;
+    e.px = e.z1 + n;  e.pz = e.px + n;
+    mp_limb_t *x = e.pz + n, *z = x + n, *acc = z + n, *diff = acc + n;
+    mp_limb_t *gx = diff + n, *gz = gx + n;          // D Q
+    mp_limb_t *cx = gz + n, *cz = cx + n;            // k D Q
+    mp_limb_t *lx = cz + n, *lz = lx + n;            // (k - 1) D Q
+    mp_limb_t *nx = lz + n, *nz = nx + n;            // (k + 1) D Q
+    mp_limb_t *bx = nz + n, *bz = bx + ECM_BABY_STEPS * n;
+    mpz_t u, v, t, view;
+
+    // u = sigma^2 - 5, v = 4 sigma, Q = (u^3 : v^3),
+    // a24 = (v - u)^3 (3u + v) / (16 u^3 v)
+    mpz_init (u); mpz_init (v); mpz_init (t);
+    mpz_set_ui (u, sigma);
+    mpz_mul (u, u, u);
+    mpz_sub_ui (u, u, 5);
+    mpz_set_ui (v, sigma);
+    mpz_mul_2exp (v, v, 2);
+
+    mpz_pow_ui (t, u, 3);
+    mont.toMont (x, t);
+    mpz_mul (t, t, v);
+    mpz_mul_2exp (t, t, 4);
+    if (!mpz_invert (d, t, m)) {
+        mpz_gcd (d, t, m);
+        mpz_clear (u); mpz_clear (v); mpz_clear (t);
+        return;
+    }
+    mpz_pow_ui (t, v, 3);
+    mont.toMont (z, t);
+    mpz_sub (t, v, u);
+    mpz_pow_ui (t, t, 3);
+    mpz_mul (t, t, d);
+    mpz_mul_ui (u, u, 3);
+    mpz_add (u, u, v);
+    mpz_mul (t, t, u);
+    mont.toMont (e.a24, t);
+    mpz_clear (u); mpz_clear (v); mpz_clear (t);
+
+    // stage 1
+    PrimeIterator it;
+    primeIteratorInit (&it, 2);
+    for (unsigned long prime=primeIteratorNext (&it); prime != 0 && prime <= B1;
+         prime=primeIteratorNext (&it)) {
+        unsigned long q = prime;
+        while (q <= B1 / prime)
+            q *= prime;
+        ecmMultiply (&e, x, z, q);
+    }
+    mpz_gcd (d, mpz_roinit_n (view, z, n), m);
+    if (mpz_cmp_ui (d, 1) != 0)
+        return;
+
+    // stage 2, baby steps j Q for odd j < D / 2
+    mont.set (bx, x);
+    mont.set (bz, z);
+    ecmDouble (&e, gx, gz, x, z);                  // 2 Q
+    ecmAdd (&e, bx + n, bz + n, bx, bz, gx, gz, x, z);
+    for (unsigned int i=2; i < ECM_BABY_STEPS; i++)
+        ecmAdd (&e, bx + i * n, bz + i * n, bx + (i - 1) * n, bz + (i - 1) * n,
+                gx, gz, bx + (i - 2) * n, bz + (i - 2) * n);
+
+    // giant steps k D Q for B1 / D <= k <= B2 / D
+    unsigned long kStart = B1 / ECM_D < 2 ? 2 : B1 / ECM_D;
+    unsigned long kEnd = ECM_B2_FACTOR * B1 / ECM_D + 1;
+    mont.set (gx, x);
+    mont.set (gz, z);
+    ecmMultiply (&e, gx, gz, ECM_D);
+    mont.set (cx, x);
+    mont.set (cz, z);
+    ecmMultiply (&e, cx, cz, kStart * ECM_D);
+    mont.set (lx, x);
+    mont.set (lz, z);
+    ecmMultiply (&e, lx, lz, (kStart - 1) * ECM_D);
+    mont.set (acc, mont.one);
+
+    uint64_t tableLimit = primeTableLimit ();
+    for (unsigned long k=kStart; k <= kEnd; k++) {
+        uint64_t kD = (uint64_t) k * ECM_D;
+        for (unsigned int i=0; i < ECM_BABY_STEPS; i++) {
+            unsigned int j = 2 * i + 1;
+            if (!coprimeToD (j))
+                continue;
+            // the pair only helps if k D - j or k D + j is prime
+            if (kD + j <= tableLimit && !primeTableIsPrime (kD - j) && !primeTableIsPrime (kD + j))
+                continue;
+            mont.mul (e.t1, cx, bz + i * n);
+            mont.mul (e.t2, bx + i * n, cz);
+            mont.sub (diff, e.t1, e.t2);
+            mont.mul (acc, acc, diff);
+        }
+        // (k + 1) D Q = k D Q + D Q, with difference (k - 1) D Q
+        ecmAdd (&e, nx, nz, cx, cz, gx, gz, lx, lz);
+        mont.set (lx, cx);
+        mont.set (lz, cz);
+        mont.set (cx, nx);
+        mont.set (cz, nz);
+    }
+    mpz_gcd (d, mpz_roinit_n (view, acc, n), m);
+}
+
+/*
+ * Find a nontrivial factor d of the odd composite m, which is not a perfect
+ * power, with rho and then ECM. With factorBitLimit set d is left at 1 once
+ * the effort for factors of that size is spent. sigma is the next ECM curve.
+ * Returns false if memory allocation fails.
+ */
+static bool findFactor (mpz_t d, const mpz_t m, unsigned int factorBitLimit, unsigned long *sigma) {
+    MontgomeryContext mont (m);
+    mp_limb_t *work = mont.allocResidues (ECM_WORK_RESIDUES);
+    if (mont.hasMallocError () || work == NULL) {
+        free (work);
+        return false;
+    }
+
+    rhoMont (d, mont, m, FACTOR_RHO_MAX_ITERATIONS, work);
+
+    for (unsigned int level=0; mpz_cmp_ui (d, 1) == 0; level++) {
+        unsigned int l = level < ECM_LEVELS ? level : ECM_LEVELS - 1;
+        if (factorBitLimit > 0 && level > 0) {
+            // the previous level was sized for factors this large
+            unsigned int previous = level - 1 < ECM_LEVELS ? level - 1 : ECM_LEVELS - 1;
+            if (ecmLevels[previous].bits >= factorBitLimit)
+                break;
+        }
+        for (unsigned int c=0; c < ecmLevels[l].curves; c++) {
+            ecmCurve (d, mont, m, (*sigma)++, ecmLevels[l].B1, work);
+            if (mpz_cmp_ui (d, 1) != 0 && mpz_cmp (d, m) != 0)
+                break;
+            mpz_set_ui (d, 1);
+        }
+    }
+
+    free (work);
+    return true;
+}
+
+//*********************** PUBLIC *******************************
+
+/*
+ * Divide out the primes below FACTOR_TRIAL_LIMIT, several at a time: c is
+ * reduced modulo a product of primes which fits in an unsigned long, and
+ * only a zero remainder for one of them costs a division of c. Stops early
+ * once the rest is prime, exceeds factorBitLimit, or fits in a word.
+ */
+static bool trialDivide (FactorList *list, mpz_t cofactor, mpz_t c, unsigned int factorBitLimit) {
+    const unsigned int group = 8 * sizeof (unsigned long) / 16;
+    unsigned long primes[8 * sizeof (unsigned long) / 16];
+    PrimeIterator it;
+    mpz_t p;
+    mpz_init (p);
+    bool ok = true;
+
+    primeIteratorInit (&it, 3);
+    while (ok) {
+        unsigned int count = 0;
+        unsigned long product = 1;
+        while (count < group) {
+            uint64_t prime = primeIteratorNext (&it);
+            if (prime == 0 || prime >= FACTOR_TRIAL_LIMIT)
+                break;
+            primes[count++] = prime;
+            product *= prime;
+        }
+        if (count == 0)
+            break;
+        if (factorBitLimit > 0 && factorBitLimit < 32 && primes[0] >> factorBitLimit != 0)
+            break;
+        if (mpz_cmp_ui (c, primes[0] * primes[0]) < 0)
+            break;
+#ifdef __SIZEOF_INT128__
+        if (mpz_sizeinbase (c, 2) <= 64)
+            break;
+#endif
+
+        unsigned long r = mpz_fdiv_ui (c, product);
+        for (unsigned int k=0; ok && k < count; k++) {
+            if (r % primes[k] != 0)
+                continue;
+            if (factorBitLimit > 0 && factorBitLimit < 32 && primes[k] >> factorBitLimit != 0)
+                break;
+            mpz_set_ui (p, primes[k]);
+            do {
+                mpz_divexact_ui (c, c, primes[k]);
+                ok = factorListPush (list, p);
+            } while (ok && mpz_divisible_ui_p (c, primes[k]));
+        }
+    }
+
+    mpz_clear (p);
+    return ok;
+}
+
+bool factorInteger (FactorList *list, mpz_t cofactor, const mpz_t n, unsigned int factorBitLimit) {
+    mpz_set_ui (cofactor, 1);
+    if (mpz_cmp_ui (n, 1) <= 0)
+        return true;
+    // trial division and ECM stage 1 take their primes from the table
+    if (primeTableLimit () < ecmLevels[ECM_LEVELS - 1].B1)
+        return false;
+
+    FactorList pending;
+    factorListInit (&pending);
+    mpz_t c, d;
+    mpz_init_set (c, n);
+    mpz_init (d);
+    unsigned long sigma = 6;
+    bool ok = true;
+
+    mp_bitcnt_t twos = mpz_scan1 (c, 0);
+    mpz_fdiv_q_2exp (c, c, twos);
+    mpz_set_ui (d, 2);
+    for (mp_bitcnt_t i=0; ok && i < twos; i++)
+        ok = keepFactor (list, cofactor, d, factorBitLimit);
+
+    ok = ok && trialDivide (list, cofactor, c, factorBitLimit);
+    if (ok && mpz_cmp_ui (c, 1) > 0)
+        ok = factorListPush (&pending, c);
+
+    while (ok && pending.length > 0) {
+        mpz_set (c, pending.primes[--pending.length]);
+
+#ifdef __SIZEOF_INT128__
+        if (mpz_sizeinbase (c, 2) <= 64) {
+            uint64_t m = mpz_getlimbn (c, 0);
+#if GMP_NUMB_BITS < 64
+            m |= (uint64_t) mpz_getlimbn (c, 1) << GMP_NUMB_BITS;
+#endif
+            ok = factor64 (list, cofactor, m, factorBitLimit);
+            continue;
+        }
+#endif
+        if (isProbablePrime (c)) {
+            ok = keepFactor (list, cofactor, c, factorBitLimit);
+            continue;
+        }
+        if (factorBitLimit > 0 && factorBitLimit <= 16) {
+            // trial division already found everything that small
+            mpz_mul (cofactor, cofactor, c);
+            continue;
+        }
+
+        if (mpz_perfect_power_p (c)) {
+            for (unsigned long k=mpz_sizeinbase (c, 2); k >= 2; k--) {
+                if (mpz_root (d, c, k)) {
+                    for (unsigned long i=0; ok && i < k; i++)
+                        ok = factorListPush (&pending, d);
+                    break;
+                }
+            }
+            continue;
+        }
+
+        ok = findFactor (d, c, factorBitLimit, &sigma);
+        if (!ok)
+            break;
+        if (mpz_cmp_ui (d, 1) == 0) {
+            // no factor within factorBitLimit
+            mpz_mul (cofactor, cofactor, c);
+            continue;
+        }
+        mpz_divexact (c, c, d);
+        ok = factorListPush (&pending, d) && factorListPush (&pending, c);
+    }
+
+    factorListClear (&pending);
+    mpz_clear (c);
+    mpz_clear (d);
+    return ok;
+}
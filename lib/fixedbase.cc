@@ -0,0 +1,106 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  fixedbase.cc
+ *
+ *    Description:  Fixed base exponentiation with a table of precomputed
+ *                  powers, see Handbook of Applied Cryptography 14.6.3.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <gmp.h>
+
+#include "../include/montgomery.h"
+#include "../include/fixedbase.h"
+
+FixedBasePowm::FixedBasePowm (const mpz_t base, const mpz_t p, size_t exponentBits,
+                              unsigned int windowBits) {
+    mpz_init_set (this->base, base);
+    mpz_init_set (modulus, p);
+    this->windowBits = windowBits;
+    this->exponentBits = exponentBits;
+    rows = (exponentBits + windowBits - 1) / windowBits;
+    table = NULL;
+
+    mont = new MontgomeryContext (p);
+    mallocError = mont->hasMallocError ();
+    if (mallocError)
+        return;
+
+    size_t columns = ((size_t) 1 << windowBits) - 1;
+    table = mont->allocResidues (rows * columns);
+    if (table == NULL) {
+        mallocError = true;
+        return;
+    }
+
+    // row i starts with g^(2^(w i)), the rest are its multiples
+    mp_size_t n = mont->n;
+    mp_limb_t *rowBase = table;
+    mont->toMont (rowBase, base);
+    for (size_t i=0; i < rows; i++) {
+        rowBase = table + i * columns * n;
+        if (i > 0) {
+            mont->mul (rowBase, table + ((i - 1) * columns + columns - 1) * n,
+                       table + (i - 1) * columns * n);
+        }
+        for (size_t d=1; d < columns; d++)
+            mont->mul (rowBase + d * n, rowBase + (d - 1) * n, rowBase);
+    }
+}
+
+FixedBasePowm::~FixedBasePowm () {
+    if (table != NULL)
+        free (table);
+    delete mont;
+    mpz_clear (base);
+    mpz_clear (modulus);
+}
+
+void FixedBasePowm::powm (mpz_t r, const mpz_t e) {
+    if (mallocError || mpz_sizeinbase (e, 2) > exponentBits) {
+        mpz_powm (r, base, e, modulus);
+        return;
+    }
+
+    mp_size_t n = mont->n;
+    mp_limb_t *acc = (mp_limb_t *) malloc ((3 * n + 2) * sizeof (mp_limb_t));
+    if (acc == NULL) {
+        mpz_powm (r, base, e, modulus);
+        return;
+    }
+    mp_limb_t *scratch = acc + n;
+
+    size_t columns = ((size_t) 1 << windowBits) - 1;
+    bool first = true;
+    for (size_t i=0; i < rows; i++) {
+        // digit i, which may straddle two limbs
+        size_t bit = i * windowBits;
+        unsigned long d = mpz_getlimbn (e, bit / GMP_NUMB_BITS) >> (bit % GMP_NUMB_BITS);
+        if (bit % GMP_NUMB_BITS + windowBits > GMP_NUMB_BITS)
+            d |= mpz_getlimbn (e, bit / GMP_NUMB_BITS + 1) << (GMP_NUMB_BITS - bit % GMP_NUMB_BITS);
+        d &= columns;
+        if (d == 0)
+            continue;
+
+        const mp_limb_t *entry = table + (i * columns + d - 1) * n;
+        if (first) {
+            mpn_copyi (acc, entry, n);
+            first = false;
+        } else {
+            mont->mul (acc, acc, entry, scratch);
+        }
+    }
+
+    if (first)
+        mpz_set_ui (r, 1);
+    else
+        mont->fromMont (r, acc, scratch);
+    free (acc);
+}
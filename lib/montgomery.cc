@@ -0,0 +1,269 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  montgomery.cc
+ *
+ *    Description:  Montgomery arithmetic on the GMP mpn layer.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <gmp.h>
+
+#include "../include/montgomery.h"
+
+/*
+ * Copy x, which must have at most n limbs, into r and pad with zeros.
+ */
+static void mpzToLimbs (mp_limb_t *r, const mpz_t x, mp_size_t n) {
+    mp_size_t size = mpz_size (x);
+    if (size > 0)
+        mpn_copyi (r, mpz_limbs_read (x), size);
+    if (size < n)
+        mpn_zero (r + size, n - size);
+}
+
+MontgomeryContext::MontgomeryContext (const mpz_t p) {
+    mallocError = false;
+    n = mpz_size (p);
+
+    mpz_init_set (modulus, p);
+    mpz_init (tmp);
+
+    this->p = (mp_limb_t *) malloc ((4 + (1 << MONT_WINDOW_BITS)) * n * sizeof (mp_limb_t));
+    scratch = (mp_limb_t *) malloc ((2 * n + 2) * sizeof (mp_limb_t));
+    if (this->p == NULL || scratch == NULL) {
+        mallocError = true;
+        return;
+    }
+    one = this->p + n;
+    r2 = one + n;
+    conv = r2 + n;
+    window = conv + n;
+
+    mpzToLimbs (this->p, p, n);
+
+    // Newton iteration for p^-1 mod 2^GMP_NUMB_BITS, each step doubles the
+    // number of correct bits and p0 is its own inverse mod 8.
+    mp_limb_t p0 = this->p[0], inv = p0;
+    for (unsigned int bits=3; bits < GMP_NUMB_BITS; bits *= 2)
+        inv *= 2 - p0 * inv;
+    pInv = -inv;
+
+    // R mod p and R^2 mod p
+    mpz_setbit (tmp, n * GMP_NUMB_BITS);
+    mpz_mod (tmp, tmp, p);
+    mpzToLimbs (one, tmp, n);
+    mpz_mul (tmp, tmp, tmp);
+    mpz_mod (tmp, tmp, p);
+    mpzToLimbs (r2, tmp, n);
+}
+
+MontgomeryContext::~MontgomeryContext () {
+    if (p != NULL)
+        free (p);
+    if (scratch != NULL)
+        free (scratch);
+    mpz_clear (modulus);
+    mpz_clear (tmp);
+}
+
+mp_limb_t *MontgomeryContext::allocResidues (size_t count) {
+    return (mp_limb_t *) malloc (count * n * sizeof (mp_limb_t));
+}
+
+/*
+ * r = t / R mod p, for t < p R held in 2n limbs, which are overwritten.
+ * The carry out of each row is kept in the limb it cleared and added to the
+ * high half at the end, as in GMP's redc_1.
+ */
+void MontgomeryContext::redc (mp_limb_t *r, mp_limb_t *t) {
+    for (mp_size_t i=0; i < n; i++) {
+        mp_limb_t q = t[i] * pInv;
+        t[i] = mpn_addmul_1 (t + i, p, n, q);
+    }
+    mp_limb_t cy = mpn_add_n (r, t + n, t, n);
+    if (cy != 0 || mpn_cmp (r, p, n) >= 0)
+        mpn_sub_n (r, r, p, n);
+}
+
+#if defined (__SIZEOF_INT128__) && GMP_NUMB_BITS == 64
+#define MONT_SMALL_MODULI 1
+typedef unsigned __int128 mont_dlimb_t;
+
+/*
+ * Products for one and two limb moduli, which are common in the factoring
+ * and rho code and for which the mpn calls cost more than the arithmetic.
+ * Same results as redc.
+ */
+static inline void mulRedc1 (mp_limb_t *r, mp_limb_t a, mp_limb_t b, mp_limb_t p, mp_limb_t pInv) {
+    mont_dlimb_t t = (mont_dlimb_t) a * b;
+    mp_limb_t lo = (mp_limb_t) t;
+    mp_limb_t q = lo * pInv;
+    // t + q p is divisible by 2^64, and its low word carries iff lo != 0
+    mont_dlimb_t s = (t >> 64) + (((mont_dlimb_t) q * p) >> 64) + (lo != 0);
+    if (s >= p)
+        s -= p;
+    r[0] = (mp_limb_t) s;
+}
+
+// coarsely integrated operand scanning, one row of a b[i] then one of q p
+static inline void mulRedc2 (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b,
+                             const mp_limb_t *p, mp_limb_t pInv) {
+    mp_limb_t t0 = 0, t1 = 0, t2 = 0, t3;
+    for (int i=0; i < 2; i++) {
+        mont_dlimb_t c = (mont_dlimb_t) a[0] * b[i] + t0;
+        t0 = (mp_limb_t) c;
+        c = (mont_dlimb_t) a[1] * b[i] + t1 + (mp_limb_t) (c >> 64);
+        t1 = (mp_limb_t) c;
+        c = (mont_dlimb_t) t2 + (mp_limb_t) (c >> 64);
+        t2 = (mp_limb_t) c;
+        t3 = (mp_limb_t) (c >> 64);
+
+        mp_limb_t q = t0 * pInv;
+        c = (mont_dlimb_t) q * p[0] + t0;
+        c = (mont_dlimb_t) q * p[1] + t1 + (mp_limb_t) (c >> 64);
+        t0 = (mp_limb_t) c;
+        c = (mont_dlimb_t) t2 + (mp_limb_t) (c >> 64);
+        t1 = (mp_limb_t) c;
+        t2 = t3 + (mp_limb_t) (c >> 64);
+    }
+    if (t2 != 0 || t1 > p[1] || (t1 == p[1] && t0 >= p[0])) {
+        mont_dlimb_t c = (mont_dlimb_t) t0 - p[0];
+        t0 = (mp_limb_t) c;
+        t1 = t1 - p[1] - (mp_limb_t) ((c >> 64) != 0);
+    }
+    r[0] = t0;
+    r[1] = t1;
+}
+#endif
+
+void MontgomeryContext::mul (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b) {
+    mul (r, a, b, scratch);
+}
+
+void MontgomeryContext::mul (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b,
+                             mp_limb_t *scratch) {
+#ifdef MONT_SMALL_MODULI
+    if (n == 1) {
+        mulRedc1 (r, a[0], b[0], p[0], pInv);
+        return;
+    }
+    if (n == 2) {
+        mulRedc2 (r, a, b, p, pInv);
+        return;
+    }
+#endif
+    mpn_mul_n (scratch, a, b, n);
+    redc (r, scratch);
+}
+
+void MontgomeryContext::sqr (mp_limb_t *r, const mp_limb_t *a) {
+#ifdef MONT_SMALL_MODULI
+    if (n <= 2) {
+        mul (r, a, a);
+        return;
+    }
+#endif
+    mpn_sqr (scratch, a, n);
+    redc (r, scratch);
+}
+
+void MontgomeryContext::add (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b) {
+    mp_limb_t cy = mpn_add_n (r, a, b, n);
+    if (cy != 0 || mpn_cmp (r, p, n) >= 0)
+        mpn_sub_n (r, r, p, n);
+}
+
+void MontgomeryContext::sub (mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b) {
+    if (mpn_sub_n (r, a, b, n) != 0)
+        mpn_add_n (r, r, p, n);
+}
+
+void MontgomeryContext::toMont (mp_limb_t *r, const mpz_t x) {
+    if (mpz_sgn (x) < 0 || mpz_cmp (x, modulus) >= 0) {
+        mpz_mod (tmp, x, modulus);
+        mpzToLimbs (conv, tmp, n);
+    } else {
+        mpzToLimbs (conv, x, n);
+    }
+    mul (r, conv, r2);
+}
+
+void MontgomeryContext::fromMont (mpz_t r, const mp_limb_t *a) {
+    fromMont (r, a, scratch);
+}
+
+void MontgomeryContext::fromMont (mpz_t r, const mp_limb_t *a, mp_limb_t *scratch) {
+    mpn_copyi (scratch, a, n);
+    mpn_zero (scratch + n, n);
+    mp_limb_t *rp = mpz_limbs_write (r, n);
+    redc (rp, scratch);
+    mpz_limbs_finish (r, n);
+}
+
+/*
+ * Left to right fixed window exponentiation.
+ */
+void MontgomeryContext::powm (mp_limb_t *r, const mp_limb_t *base, const mpz_t e) {
+    const unsigned int size = 1 << MONT_WINDOW_BITS;
+    mpn_copyi (window, one, n);
+    mpn_copyi (window + n, base, n);
+    for (unsigned int i=2; i < size; i++)
+        mul (window + i * n, window + (i - 1) * n, base);
+
+    size_t bits = mpz_sizeinbase (e, 2);
+    if (mpz_sgn (e) == 0) {
+        mpn_copyi (r, one, n);
+        return;
+    }
+
+    // number of windows, the top one may be partial
+    size_t windows = (bits + MONT_WINDOW_BITS - 1) / MONT_WINDOW_BITS;
+    bool first = true;
+    for (size_t w=windows; w-- > 0; ) {
+        unsigned int value = 0;
+        for (unsigned int b=MONT_WINDOW_BITS; b-- > 0; )
+            value = (value << 1) | mpz_tstbit (e, w * MONT_WINDOW_BITS + b);
+
+        if (first) {
+            mpn_copyi (r, window + value * n, n);
+            first = false;
+            continue;
+        }
+        for (unsigned int b=0; b < MONT_WINDOW_BITS; b++)
+            sqr (r, r);
+        if (value != 0)
+            mul (r, r, window + value * n);
+    }
+}
+
+void MontgomeryContext::invert (mp_limb_t *r, const mp_limb_t *a) {
+    fromMont (tmp, a);
+    mpz_invert (tmp, tmp, modulus);
+    toMont (r, tmp);
+}
+
+void MontgomeryContext::batchInvert (mp_limb_t *r, const mp_limb_t *a, size_t count,
+                                     mp_limb_t *prefix) {
+    if (count == 0)
+        return;
+
+    // prefix[k] = a[0] ... a[k]
+    mpn_copyi (prefix, a, n);
+    for (size_t k=1; k < count; k++)
+        mul (prefix + k * n, prefix + (k - 1) * n, a + k * n);
+
+    invert (r + (count - 1) * n, prefix + (count - 1) * n);
+
+    // r[k] holds (a[0] ... a[k])^-1 at the start of each step
+    for (size_t k=count-1; k > 0; k--) {
+        mul (r + (k - 1) * n, r + k * n, a + k * n);
+        mul (r + k * n, r + k * n, prefix + (k - 1) * n);
+    }
+}
@@ -0,0 +1,158 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  philox.cc
+ *
+ *    Description:  Philox4x32-10 random streams and the GMP random state
+ *                  on top of them.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "../include/philox.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void philox4x32 (uint32_t out[4], const uint32_t counter[4], const uint32_t key[2]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r=0; r < PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+        c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t) p1;
+        c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t) p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+void philoxStreamInit (PhiloxStream *s, uint64_t seed, uint64_t stream) {
+    s->key[0] = (uint32_t) seed;
+    s->key[1] = (uint32_t) (seed >> 32);
+    s->counter[0] = s->counter[1] = 0;
+    s->counter[2] = (uint32_t) stream;
+    s->counter[3] = (uint32_t) (stream >> 32);
+    s->used = 4;
+}
+
+uint32_t philoxStreamNext (PhiloxStream *s) {
+    if (s->used == 4) {
+        philox4x32 (s->buffer, s->counter, s->key);
+        if (++s->counter[0] == 0)
+            s->counter[1]++;
+        s->used = 0;
+    }
+    return s->buffer[s->used++];
+}
+
+/*
+ * GMP keeps a table of these functions behind _mp_algdata._mp_lc, as its
+ * own generators do (gmp-impl.h, gmp_randfnptr_t), and calls them from
+ * mpz_urandomb, gmp_randclear and the rest. The stream lives in the limbs
+ * of _mp_seed, allocated with GMP's allocator as its Mersenne Twister does,
+ * and only these functions look at it.
+ *
+ * gmp-impl.h is private, so the table below copies its layout, which is
+ * the same in GMP 6.0 to 6.3. Check it again before allowing another
+ * version: a different layout would have GMP call the wrong functions.
+ * elgamaltest -t goes through every entry.
+ */
+#if __GNU_MP_VERSION != 6 || __GNU_MP_VERSION_MINOR > 3
+#error "PhiloxRandFunctions has not been checked against gmp_randfnptr_t of this GMP"
+#endif
+
+#define PHILOX_STREAM_LIMBS ((sizeof (PhiloxStream) + sizeof (mp_limb_t) - 1) / sizeof (mp_limb_t))
+
+typedef struct {
+    void (*seed) (gmp_randstate_t, mpz_srcptr);
+    void (*get) (gmp_randstate_t, mp_ptr, unsigned long int);
+    void (*clear) (gmp_randstate_t);
+    void (*iset) (__gmp_randstate_struct *, const __gmp_randstate_struct *);
+} PhiloxRandFunctions;
+
+static PhiloxStream *streamOf (const __gmp_randstate_struct *state) {
+    return (PhiloxStream *) state->_mp_seed->_mp_d;
+}
+
+static void philoxRandSeed (gmp_randstate_t state, mpz_srcptr seed) {
+    PhiloxStream *s = streamOf (state);
+    uint64_t stream = ((uint64_t) s->counter[3] << 32) | s->counter[2];
+    uint64_t low = mpz_getlimbn (seed, 0);
+    if (GMP_NUMB_BITS < 64)
+        low |= (uint64_t) mpz_getlimbn (seed, 1) << 32;
+    philoxStreamInit (s, low, stream);
+}
+
+// nbits random bits into the limbs of rp, the rest of the top limb cleared
+static void philoxRandGet (gmp_randstate_t state, mp_ptr rp, unsigned long int nbits) {
+    PhiloxStream *s = streamOf (state);
+    mp_size_t n = (nbits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+    for (mp_size_t i=0; i < n; i++) {
+        mp_limb_t limb = 0;
+        for (int b=0; b < GMP_NUMB_BITS; b += 32)
+            limb |= (mp_limb_t) philoxStreamNext (s) << b;
+        rp[i] = limb;
+    }
+    if (nbits % GMP_NUMB_BITS != 0)
+        rp[n - 1] &= ((mp_limb_t) 1 << (nbits % GMP_NUMB_BITS)) - 1;
+}
+
+static void philoxRandClear (gmp_randstate_t state) {
+    void (*freeFunction) (void *, size_t);
+    mp_get_memory_functions (NULL, NULL, &freeFunction);
+    freeFunction (state->_mp_seed->_mp_d, PHILOX_STREAM_LIMBS * sizeof (mp_limb_t));
+    state->_mp_seed->_mp_d = NULL;
+    state->_mp_seed->_mp_alloc = 0;
+}
+
+static void philoxRandInitSet (__gmp_randstate_struct *dst, const __gmp_randstate_struct *src);
+
+static const PhiloxRandFunctions philoxRandFunctions = {
+    philoxRandSeed, philoxRandGet, philoxRandClear, philoxRandInitSet
+};
+
+// GMP's allocator aborts when memory runs out
+static PhiloxStream *attachStream (__gmp_randstate_struct *state) {
+    void *(*allocFunction) (size_t);
+    mp_get_memory_functions (&allocFunction, NULL, NULL);
+    mp_limb_t *limbs = (mp_limb_t *) allocFunction (PHILOX_STREAM_LIMBS * sizeof (mp_limb_t));
+    PhiloxStream *s = (PhiloxStream *) limbs;
+    state->_mp_seed->_mp_d = limbs;
+    state->_mp_seed->_mp_alloc = PHILOX_STREAM_LIMBS;
+    state->_mp_seed->_mp_size = 0;
+    state->_mp_alg = GMP_RAND_ALG_DEFAULT;
+    state->_mp_algdata._mp_lc = (void *) &philoxRandFunctions;
+    return s;
+}
+
+static void philoxRandInitSet (__gmp_randstate_struct *dst, const __gmp_randstate_struct *src) {
+    memcpy (attachStream (dst), streamOf (src), sizeof (PhiloxStream));
+}
+
+void randStateInitPhilox (gmp_randstate_t state, uint64_t seed, uint64_t stream) {
+    philoxStreamInit (attachStream (state), seed, stream);
+}
+
+void randStateSetStream (gmp_randstate_t state, uint64_t seed, uint64_t stream) {
+    philoxStreamInit (streamOf (state), seed, stream);
+}
+
+uint64_t randStateSeed (gmp_randstate_t state) {
+    uint64_t high = gmp_urandomb_ui (state, 32);
+    return (high << 32) | gmp_urandomb_ui (state, 32);
+}
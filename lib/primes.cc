@@ -0,0 +1,229 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  primes.cc
+ *
+ *    Description:  Segmented sieve of Eratosthenes over a 2 3 5 7 wheel.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../include/primes.h"
+
+#define WHEEL 210
+#define WHEEL_SPOKES 48
+
+static uint64_t requestedLimit = PRIME_TABLE_DEFAULT_LIMIT;
+
+/*
+ * Bit 48 t + i of the bitmap stands for 210 t + residues[i], and is set
+ * if that integer is prime. Each segment of PRIME_TABLE_SEGMENT_WORDS words
+ * is sieved on its own the first time a lookup lands in it.
+ */
+typedef struct PrimeTable {
+    uint64_t limit;
+    uint64_t *bits;
+    uint64_t words;
+    char *sieved;                      // per segment
+    unsigned char residues[WHEEL_SPOKES];
+    signed char spoke[WHEEL];          // index into residues, -1 if not coprime
+    uint32_t *sievingPrimes;           // 11 <= p <= sqrt (limit)
+    size_t sievingCount;
+    pthread_mutex_t lock;
+
+    PrimeTable ();
+    void sieve (uint64_t firstWord, uint64_t lastWord);
+    void ensure (uint64_t word);
+    uint64_t value (uint64_t bit) {
+        return (bit / WHEEL_SPOKES) * WHEEL + residues[bit % WHEEL_SPOKES];
+    }
+} PrimeTable;
+
+static bool tableBuilt = false;
+
+static PrimeTable *primeTable () {
+    static PrimeTable table;
+    return &table;
+}
+
+PrimeTable::PrimeTable () {
+    limit = requestedLimit;
+    sievingCount = 0;
+    pthread_mutex_init (&lock, NULL);
+
+    int k = 0;
+    for (int r=0; r < WHEEL; r++) {
+        if (r % 2 == 0 || r % 3 == 0 || r % 5 == 0 || r % 7 == 0) {
+            spoke[r] = -1;
+        } else {
+            spoke[r] = k;
+            residues[k++] = r;
+        }
+    }
+
+    // calloc leaves the pages untouched until they are sieved
+    words = (limit / WHEEL + 1) * WHEEL_SPOKES / 64 + 1;
+    bits = (uint64_t *) calloc (words, sizeof (uint64_t));
+    sieved = (char *) calloc (words / PRIME_TABLE_SEGMENT_WORDS + 1, 1);
+
+    // plain sieve for the primes up to sqrt (limit)
+    uint32_t root = 1;
+    while ((uint64_t) (root + 1) * (root + 1) <= limit)
+        root++;
+    char *composite = (char *) calloc (root + 1, 1);
+    sievingPrimes = (uint32_t *) malloc ((root / 2 + 1) * sizeof (uint32_t));
+    if (bits == NULL || sieved == NULL || composite == NULL || sievingPrimes == NULL) {
+        // with limit 0 no lookup is in range
+        free (bits); free (sieved); free (sievingPrimes);
+        bits = NULL;
+        sieved = NULL;
+        sievingPrimes = NULL;
+        words = 0;
+        limit = 0;
+    } else {
+        for (uint32_t p=2; p <= root; p++) {
+            if (composite[p])
+                continue;
+            if (p > 7)
+                sievingPrimes[sievingCount++] = p;
+            for (uint64_t j=(uint64_t) p * p; j <= root; j += p)
+                composite[j] = 1;
+        }
+    }
+    free (composite);
+    __atomic_store_n (&tableBuilt, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Sieve words [firstWord, lastWord). Each multiple p k of a sieving prime
+ * is only coprime to the wheel if k is, so k steps along the wheel too.
+ */
+void PrimeTable::sieve (uint64_t firstWord, uint64_t lastWord) {
+    for (uint64_t w=firstWord; w < lastWord; w++)
+        bits[w] = ~(uint64_t) 0;
+    if (firstWord == 0)
+        bits[0] &= ~(uint64_t) 1;   // 1 is not prime
+
+    uint64_t lo = value (firstWord * 64);
+    uint64_t hi = value (lastWord * 64 - 1);
+    for (size_t i=0; i < sievingCount; i++) {
+        uint64_t p = sievingPrimes[i];
+        if (p * p > hi)
+            break;
+        // first multiple in the segment, and never p itself
+        uint64_t k = (lo + p - 1) / p;
+        if (k < p)
+            k = p;
+        while (spoke[k % WHEEL] < 0)
+            k++;
+        uint64_t turn = k / WHEEL;
+        int s = spoke[k % WHEEL];
+
+        for (uint64_t n=p * k; n <= hi; ) {
+            uint64_t bit = (n / WHEEL) * WHEEL_SPOKES + spoke[n % WHEEL];
+            bits[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+            if (++s == WHEEL_SPOKES) {
+                s = 0;
+                turn++;
+            }
+            n = p * (turn * WHEEL + residues[s]);
+        }
+    }
+}
+
+void PrimeTable::ensure (uint64_t word) {
+    uint64_t segment = word / PRIME_TABLE_SEGMENT_WORDS;
+    if (__atomic_load_n (&sieved[segment], __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock (&lock);
+    if (!sieved[segment]) {
+        uint64_t first = segment * PRIME_TABLE_SEGMENT_WORDS;
+        uint64_t last = first + PRIME_TABLE_SEGMENT_WORDS;
+        if (last > words)
+            last = words;
+        sieve (first, last);
+        __atomic_store_n (&sieved[segment], 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock (&lock);
+}
+
+bool primeTableSetLimit (uint64_t limit) {
+    if (__atomic_load_n (&tableBuilt, __ATOMIC_ACQUIRE))
+        return limit <= primeTable ()->limit;
+    if (limit > requestedLimit)
+        requestedLimit = limit;
+    return true;
+}
+
+uint64_t primeTableLimit () {
+    return primeTable ()->limit;
+}
+
+bool primeTableIsPrime (uint64_t n) {
+    if (n < 11)
+        return n == 2 || n == 3 || n == 5 || n == 7;
+    PrimeTable *t = primeTable ();
+    int s = t->spoke[n % WHEEL];
+    if (s < 0)
+        return false;
+    uint64_t bit = (n / WHEEL) * WHEEL_SPOKES + s;
+    t->ensure (bit / 64);
+    return (t->bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+void primeIteratorInit (PrimeIterator *it, uint64_t start) {
+    PrimeTable *t = primeTable ();
+    static const unsigned int small[] = { 2, 3, 5, 7 };
+
+    it->small = 0;
+    for (int i=0; i < 4; i++) {
+        if (small[i] >= start) {
+            it->small = small[i];
+            break;
+        }
+    }
+    if (start < 11)
+        start = 11;
+    // first spoke at or after start
+    uint64_t turn = start / WHEEL;
+    uint64_t r = start % WHEEL;
+    while (r < WHEEL && t->spoke[r] < 0)
+        r++;
+    it->bit = (r == WHEEL) ? (turn + 1) * WHEEL_SPOKES : turn * WHEEL_SPOKES + t->spoke[r];
+}
+
+uint64_t primeIteratorNext (PrimeIterator *it) {
+    PrimeTable *t = primeTable ();
+
+    if (it->small != 0) {
+        uint64_t p = it->small;
+        it->small = (p == 2) ? 3 : (p == 3) ? 5 : (p == 5) ? 7 : 0;
+        return p <= t->limit ? p : 0;
+    }
+
+    uint64_t word = it->bit / 64;
+    while (word < t->words) {
+        t->ensure (word);
+        uint64_t w = t->bits[word] & (~(uint64_t) 0 << (it->bit % 64));
+        if (w != 0) {
+            uint64_t bit = word * 64 + __builtin_ctzll (w);
+            uint64_t p = t->value (bit);
+            if (p > t->limit)
+                break;
+            it->bit = bit + 1;
+            return p;
+        }
+        word++;
+        it->bit = word * 64;
+    }
+    it->bit = t->words * 64;
+    return 0;
+}
@@ -16,10 +16,14 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <gmp.h>
 
 #include "../include/types.h"
 #include "../include/randomhelpers.h"
+#include "../include/philox.h"
 
 #define MAX_SEQ_LEN 1000
 
@@ -44,13 +48,51 @@ bool randomULong (unsigned long *out) {
     return true;
 }
 
-bool seedRandState (gmp_randstate_t state) {
-    unsigned long seed;
-    if (randomULong (&seed)) {
-        gmp_randseed_ui (state, seed);
-        return true;
+bool initRandState (gmp_randstate_t state, const char *seed, unsigned long long *seedUsed) {
+    unsigned long long value;
+    if (seed != NULL) {
+        char *endptr;
+        value = strtoull (seed, &endptr, 0);
+        if (*seed == '\0' || *endptr != '\0') {
+            fprintf (stderr, "Seed '%s' is not a number\n", seed);
+            return false;
+        }
+    } else {
+        unsigned long random;
+        if (!randomULong (&random))
+            return false;
+        value = random;
+    }
+    randStateInitPhilox (state, value, 0);
+    if (seedUsed != NULL)
+        *seedUsed = value;
+    return true;
+}
+
+const char *takeSeedOption (int *argc, char **argv) {
+    const char *seed = NULL;
+    int kept = 1;
+    for (int i=1; i < *argc; i++) {
+        if (strcmp (argv[i], "--") == 0) {
+            while (i < *argc)
+                argv[kept++] = argv[i++];
+            break;
+        }
+        if (strncmp (argv[i], "--seed=", 7) == 0) {
+            seed = argv[i] + 7;
+        } else if (strcmp (argv[i], "--seed") == 0) {
+            if (i + 1 == *argc) {
+                fprintf (stderr, "%s: --seed needs a value\n", argv[0]);
+                exit (EXIT_FAILURE);
+            }
+            seed = argv[++i];
+        } else {
+            argv[kept++] = argv[i];
+        }
     }
-    return false;
+    argv[kept] = NULL;
+    *argc = kept;
+    return seed;
 }
 
 /*
@@ -0,0 +1,205 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  splitestimate.cc
+ *
+ *    Description:  Numerical estimate of the probability that a random
+ *                  integer splits into two factors of bounded size.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../include/primes.h"
+#include "../include/splitestimate.h"
+
+SplitEstimator::SplitEstimator (unsigned int bits) {
+    this->bits = bits;
+    stepsPerBit = SPLIT_ESTIMATE_STEPS_PER_BIT;
+    if (bits * stepsPerBit > SPLIT_ESTIMATE_MAX_STEPS)
+        stepsPerBit = (bits < SPLIT_ESTIMATE_MAX_STEPS) ? SPLIT_ESTIMATE_MAX_STEPS / bits : 1;
+    steps = bits * stepsPerBit;
+
+    mallocError = true;
+    weights = NULL;
+    smooth = NULL;
+    terminal = (double *) malloc ((steps + 1) * sizeof (double));
+    weightStart = (size_t *) malloc ((steps + 2) * sizeof (size_t));
+    if (terminal == NULL || weightStart == NULL)
+        return;
+
+    // bin i has room for steps / i primes
+    weightStart[0] = 0;
+    for (unsigned int i = 0; i <= steps; i++)
+        weightStart[i + 1] = weightStart[i] + ((i == 0) ? 1 : steps / i + 1);
+    weights = (double *) calloc (weightStart[steps + 1], sizeof (double));
+    double *powerSums = (double *) calloc (weightStart[steps + 1], sizeof (double));
+    smooth = (double *) malloc ((size_t) (steps + 1) * (steps + 2) * sizeof (double));
+    if (weights == NULL || powerSums == NULL || smooth == NULL) {
+        free (powerSums);
+        return;
+    }
+
+    for (unsigned int x = 0; x <= steps; x++)
+        terminal[x] = exp2 (-(double) x / stepsPerBit);
+
+    // sums of 1/p^r over the primes of each bin, exactly for small primes
+    PrimeIterator it;
+    primeIteratorInit (&it, 2);
+    for (uint64_t p; (p = primeIteratorNext (&it)) != 0 && p < (1ul << SPLIT_ESTIMATE_SIEVE_BITS); ) {
+        long bin = lround (log2 ((double) p) * stepsPerBit);
+        if (bin > (long) steps)
+            break;
+        double inverse = 1.0 / p, power = inverse;
+        for (unsigned int r = 1; r < weightCount (bin) && power > 0; r++) {
+            powerSums[weightStart[bin] + r] += power;
+            power *= inverse;
+        }
+    }
+    // and by Mertens' theorem beyond, where 1/p^2 no longer matters
+    for (unsigned int i = 1; i <= steps; i++) {
+        double low = (i - 0.5) / stepsPerBit, high = (i + 0.5) / stepsPerBit;
+        if (low < SPLIT_ESTIMATE_SIEVE_BITS)
+            low = SPLIT_ESTIMATE_SIEVE_BITS;
+        if (high > low)
+            powerSums[weightStart[i] + 1] += log (high / low);
+    }
+
+    // weight of k primes from one bin, from the power sums by Newton's
+    // identities
+    for (unsigned int i = 1; i <= steps; i++) {
+        double *w = weights + weightStart[i];
+        const double *ps = powerSums + weightStart[i];
+        w[0] = 1;
+        for (unsigned int k = 1; k < weightCount (i); k++) {
+            double s = 0;
+            for (unsigned int r = 1; r <= k; r++)
+                s += ps[r] * w[k - r];
+            w[k] = s / k;
+        }
+    }
+    free (powerSums);
+
+    // smooth (x, t + 1) adds the integers whose largest prime is in bin t
+    size_t row = steps + 2;
+    for (unsigned int x = 0; x <= steps; x++) {
+        smooth[x * row] = terminal[x];
+        smooth[x * row + 1] = terminal[x];
+    }
+    for (unsigned int t = 1; t <= steps; t++) {
+        for (unsigned int x = 0; x <= steps; x++) {
+            double s = smooth[x * row + t];
+            for (unsigned int k = 1; k * t <= x; k++)
+                s += weight (t, k) * smooth[(x - k * t) * row + t];
+            smooth[x * row + t + 1] = s;
+        }
+    }
+
+    mallocError = false;
+}
+
+SplitEstimator::~SplitEstimator () {
+    free (terminal);
+    free (weightStart);
+    free (weights);
+    free (smooth);
+}
+
+/*
+ * Share of the integers below 2^(tracked + x) which split, given that the
+ * primes placed so far sum to tracked, the rest of the integer is below
+ * 2^x with all its primes in bins below cap, and sums are the sizes of the
+ * subsets of the placed primes which may still become s1.
+ */
+double SplitEstimator::subtree (unsigned int tracked, unsigned int x, unsigned int cap,
+                                unsigned int placed, const unsigned int *sums,
+                                unsigned int nSums) {
+    unsigned int reach = 0;
+    for (unsigned int n = 0; n < nSums; n++) {
+        unsigned int a = sums[n];
+        // all of the rest fits in s2, or in s1
+        if (a + b2Steps >= top || a + x <= b1Steps)
+            return smoothShare (x, cap);
+        if (a + b2Steps - tracked > reach)
+            reach = a + b2Steps - tracked;
+        if (b1Steps - a > reach)
+            reach = b1Steps - a;
+    }
+
+    // The next prime is the last one placed, and the split survives it
+    // exactly when it is at most reach.
+    if (placed + 1 == factors)
+        return smoothShare (x, (reach + 1 < cap) ? reach + 1 : cap);
+
+    unsigned int buffer[2][1 << SPLIT_ESTIMATE_MAX_FACTORS];
+    double mass = terminal[x];
+    unsigned int last = cap - 1;
+    if (last > x)
+        last = x;
+    if (last > b2Steps)
+        last = b2Steps;
+    for (unsigned int i = 1; i <= last; i++) {
+        const unsigned int *current = sums;
+        unsigned int nCurrent = nSums, which = 0, sum = tracked;
+        for (unsigned int k = 1; k * i <= x && k < weightCount (i); k++) {
+            if (placed + k <= factors) {
+                // place copy k in s1 or s2
+                sum += i;
+                unsigned int low = (sum > b2Steps) ? sum - b2Steps : 0, n = 0;
+                unsigned int *next = buffer[which];
+                for (unsigned int m = 0; m < nCurrent; m++) {
+                    if (current[m] >= low)
+                        next[n++] = current[m];
+                    if (current[m] + i <= b1Steps)
+                        next[n++] = current[m] + i;
+                }
+                if (n == 0)
+                    break;
+                current = next;
+                nCurrent = n;
+                which ^= 1;
+            }
+            if (placed + k < factors)
+                mass += weight (i, k) * subtree (sum, x - k * i, i, placed + k, current, nCurrent);
+            else
+                mass += weight (i, k) * smoothShare (x - k * i, i);
+        }
+    }
+    return mass;
+}
+
+double SplitEstimator::probability (unsigned int b1, unsigned int b2, unsigned int factors) {
+    if (mallocError)
+        return -1;
+    if (b1 > b2) {
+        unsigned int t = b1;
+        b1 = b2;
+        b2 = t;
+    }
+    if (b2 >= bits)
+        return 1;
+    if (b1 + b2 < bits + SPLIT_ESTIMATE_MIN_SLACK)
+        return NAN;
+    if (factors < 1)
+        factors = 1;
+    if (factors > SPLIT_ESTIMATE_MAX_FACTORS)
+        factors = SPLIT_ESTIMATE_MAX_FACTORS;
+    this->factors = factors;
+    b1Steps = (b1 < bits ? b1 : bits) * stepsPerBit;
+    b2Steps = (b2 < bits ? b2 : bits) * stepsPerBit;
+
+    // integers above 2^(b1 + b2) never split, the rest are uniform below it
+    top = (b1Steps + b2Steps < steps) ? b1Steps + b2Steps : steps;
+    unsigned int sums[1] = { 0 };
+    double mass = subtree (0, top, top + 1, 0, sums, 1);
+
+    // the tables are normalized to count all integers below 2^top once
+    return mass / smoothShare (top, top + 1) * terminal[steps - top];
+}
@@ -13,6 +13,7 @@
 #include "include/randomhelpers.h"
 #include "include/elgamal.h"
 #include "include/dlog.h"
+#include "include/CipherTextContainer.h"
 
 #include "MpzList.h"
 #include "ElgamalAttack.h"
@@ -21,18 +22,204 @@
 #include "HashMimAttack2.h"
 #include "HashMimAttack3.h"
 #include "HashMimAttack4.h"
+#include "HashMimAttack5.h"
 #include "DiskMimAttack.h"
 #include "TwoTableAttack.h"
+#include "AttackContext.h"
+#include "AttackDaemon.h"
 
 //const char *BASEDIR = "cryptosystems/";
 
 void usage () {
-    printf ("mimattack -n attackName -t tableFilePath -b messageBits -c cryptosystemFilePath message1Path [message2Path...]\n");
+    printf ("mimattack -n attackName -t tableFilePath -b messageBits -c cryptosystemFilePath [-j threads] [-r first:count] [--seed N] message1Path [message2Path...]\n");
+    printf ("mimattack -x -c cryptosystemFilePath\n");
+    printf ("mimattack -d socketPath -n attackName -b messageBits -c cryptosystemFilePath [-c cryptosystemFilePath...] [-t tableFilePath] [-j threads] [--seed N]\n");
+    printf ("  message paths ending in .ctc are ciphertext containers, of which -r selects a slice\n");
+    printf ("  --seed N repeats the random choices of the run which printed seed = N\n");
+    printf ("  -x saves the values the attacks derive from the cryptosystem alone to\n");
+    printf ("     cryptosystemFilePath" ATTACK_CONTEXT_SUFFIX ", which later runs load when it is there\n");
+    printf ("  -d builds the tables once and serves crack requests on the Unix socket\n");
+    printf ("     socketPath until interrupted, see AttackDaemon.h for the protocol\n");
+}
+
+/*
+ * Crack one ciphertext with known message m and print the results, with
+ * label in place of the file name.
+ */
+void crackOne (ElgamalAttack *attack, ElgamalCryptosystem *e, const char *label,
+               mpz_t m, const ElgamalCipherText ct, gmp_randstate_t rstate,
+               MpzList *results, MpzList *resultsUnique) {
+    mpz_t uq, deltaq;
+    mpz_init (uq); mpz_init (deltaq);
+
+    mpz_powm (uq, ct.myk, e->baseOrder, e->prime);
+
+    printf ("message:\n");
+    gmp_printf ("\tm     = %Zd (%u bits)\n", m, mpz_sizeinbase (m, 2));
+    gmp_printf ("\tg^k   = %Zd (%u bits)\n", ct.gk, mpz_sizeinbase (ct.gk, 2));
+    gmp_printf ("\tm*y^k = %Zd (%u bits)\n", ct.myk, mpz_sizeinbase (ct.myk, 2));
+
+    time_t start = time (NULL);
+    size_t resultCount = attack->crackMessage (results, ct, rstate);
+    double diff = difftime (time (NULL), start);
+    printf ("TIME[crack,file=%s]: %dm %ds : %ld\n", label, (int) floor (diff / 60),
+                                                    ((int)diff) % 60, (long)diff);
+    printf ("RESULTS[file=%s]: %zu\n", label, resultCount);
+    // iterate through results, then clear
+    bool found = false;
+    gmp_printf ("actual message: %Zd\n", m);
+    for (size_t j = 0; j < resultCount; j++) {
+        if (!resultsUnique->find (NULL, (*results)[j])) {
+            resultsUnique->append ((*results)[j]);
+            // verify that this result really works
+            mpz_powm (deltaq, (*results)[j], e->baseOrder, e->prime);
+            if (mpz_cmp (deltaq, uq) != 0) {
+                gmp_printf ("!!results[%zu] = %Zd\n", j, (*results)[j]);
+                printf ("ERR: found result which doesn't work!\n");
+            } else if (mpz_cmp ((*results)[j], m) == 0) {
+                gmp_printf ("**results[%zu] = %Zd\n", j, (*results)[j]);
+                found = true;
+            } else {
+                gmp_printf ("  results[%zu] = %Zd\n", j, (*results)[j]);
+            }
+        }
+    }
+    printf ("URESULTS[file=%s]: %zu\n", label, resultsUnique->getSize());
+    results->clear ();
+    resultsUnique->clear();
+    if (!found) {
+        printf ("ERR: message not found\n");
+    }
+
+    mpz_clear (uq); mpz_clear (deltaq);
+}
+
+ElgamalAttack *newAttack (const char *attackName, ElgamalCryptosystem *e,
+                          unsigned int bits1, unsigned int bits2,
+                          char *tableFilePath, unsigned int threads) {
+    if (strcmp (attackName, "mim") == 0) {
+        return new MimAttack (e, bits1, bits2);
+    } else if (strcmp (attackName, "hashmim") == 0) {
+        return new HashMimAttack (e, bits1, bits2);
+    } else if (strcmp (attackName, "hashmim2") == 0) {
+        return new HashMimAttack2 (e, bits1, bits2, tableFilePath);
+    } else if (strcmp (attackName, "hashmim3") == 0) {
+        return new HashMimAttack3 (e, bits1, bits2, tableFilePath);
+    } else if (strcmp (attackName, "hashmim4") == 0) {
+        return new HashMimAttack4 (e, bits1, bits2, tableFilePath);
+    } else if (strcmp (attackName, "hashmim5") == 0) {
+        return new HashMimAttack5 (e, bits1, bits2);
+    } else if (strcmp (attackName, "diskmim") == 0) {
+        return new DiskMimAttack (e, tableFilePath, bits1, bits2);
+    } else if (strcmp (attackName, "2table") == 0) {
+        return new TwoTableAttack (e, bits1, bits2, threads);
+    }
+    return NULL;
+}
+
+// the attack context saved for csFilePath, if there is one, set on attack
+AttackContext *loadContext (const char *csFilePath, ElgamalCryptosystem *e,
+                            ElgamalAttack *attack) {
+    // a missing or stale context only means computing everything again
+    AttackContext *context = NULL;
+    char *contextFilePath = AttackContext::fileNameFor (csFilePath);
+    FILE *f = fopen (contextFilePath, "r");
+    if (f != NULL) {
+        fclose (f);
+        context = new AttackContext (contextFilePath, e);
+        if (context->hasError ()) {
+            printf ("WARN: ignoring attack context '%s'\n", contextFilePath);
+            delete context;
+            context = NULL;
+        } else {
+            printf ("INFO: using attack context '%s'\n", contextFilePath);
+            attack->setContext (context);
+        }
+    }
+    free (contextFilePath);
+    return context;
+}
+
+// false if the build failed
+bool buildTable (ElgamalAttack *attack, unsigned int bits1, gmp_randstate_t rstate) {
+    time_t start = time (NULL);
+    printf ("INFO: Building table...\n");
+    bool built = attack->buildTable (rstate);
+    double diff = difftime (time (NULL), start);
+    if (built && !attack->reusedTable ()) {
+        printf ("TIME[table,bits1=%u]: %dm %ds : %ld\n", bits1, (int) floor (diff / 60),
+                                                         ((int)diff) % 60, (long)diff);
+    }
+    return built;
+}
+
+/*
+ * Build a table for each cryptosystem once and serve crack requests for
+ * all of them on socketPath until interrupted.
+ */
+int serve (const char *socketPath, const char *attackName, char **csFilePaths,
+           unsigned int csCount, unsigned int bits1, unsigned int bits2,
+           char *tableFilePath, unsigned int threads, gmp_randstate_t rstate) {
+    AttackDaemon daemon (socketPath);
+    if (daemon.hasError ())
+        return EXIT_FAILURE;
+
+    ElgamalCryptosystem *es[ATTACK_DAEMON_MAX_SERVED];
+    ElgamalAttack *attacks[ATTACK_DAEMON_MAX_SERVED];
+    AttackContext *contexts[ATTACK_DAEMON_MAX_SERVED];
+    unsigned int served = 0;
+    int status = EXIT_SUCCESS;
+    for (; served < csCount; served++) {
+        FILE *f = fopen (csFilePaths[served], "r");
+        if (f == NULL) {
+            perror (csFilePaths[served]);
+            status = EXIT_FAILURE;
+            break;
+        }
+        ElgamalCryptosystem *e = new ElgamalCryptosystem ();
+        e->read (f);
+        fclose (f);
+
+        ElgamalAttack *attack = newAttack (attackName, e, bits1, bits2, tableFilePath, threads);
+        if (attack == NULL) {
+            printf ("Unknown attack '%s', exiting\n", attackName);
+            delete e;
+            status = EXIT_FAILURE;
+            break;
+        }
+        es[served] = e;
+        attacks[served] = attack;
+        printf ("INFO: serving cryptosystem '%s' with attack '%s'\n", csFilePaths[served],
+                attack->getAttackName ());
+        contexts[served] = loadContext (csFilePaths[served], e, attack);
+        if (!buildTable (attack, bits1, rstate)) {
+            // every request would look like a message without results
+            printf ("ERR: could not build the table for '%s', exiting\n", csFilePaths[served]);
+            served++;
+            status = EXIT_FAILURE;
+            break;
+        }
+        daemon.add (csFilePaths[served], e, attack);
+    }
+
+    if (status == EXIT_SUCCESS)
+        daemon.run (rstate);
+
+    for (unsigned int i=0; i < served; i++) {
+        delete attacks[i];
+        delete contexts[i];
+        delete es[i];
+    }
+    return status;
 }
 
 int main (int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
     
     char *csFilePath = NULL;
+    char *csFilePaths[ATTACK_DAEMON_MAX_SERVED];
+    unsigned int csCount = 0;
+    char *socketPath = NULL;
     char *attackName = NULL;
     char *tableFilePath = NULL;
     //char **messageFilePaths = NULL;
@@ -40,20 +227,28 @@ int main (int argc, char **argv) {
     unsigned int messageBits = 0;
     unsigned int bits1 = 0;
     unsigned int bits2 = 0;
+    unsigned int threads = 0; // one per online processor
+    unsigned long long sliceFirst = 0;
+    unsigned long long sliceCount = ~0ull; // of each container
+    bool writeContext = false;
 
     gmp_randstate_t rstate;
-    gmp_randinit_default (rstate);
-    if (!seedRandState (rstate)) {
+    unsigned long long seedUsed;
+    if (!initRandState (rstate, seed, &seedUsed)) {
         fprintf (stderr, "Failed to seed random state, exiting\n");
         exit (EXIT_FAILURE);
     }
 
     char *endptr = NULL;
     int opt;
-    while ((opt = getopt (argc, argv, "n:t:b:c:")) != -1) {
+    while ((opt = getopt (argc, argv, "n:t:b:c:j:r:xd:")) != -1) {
         switch (opt) {
         case 'c':
-            csFilePath = optarg;
+            if (csCount == ATTACK_DAEMON_MAX_SERVED) {
+                printf ("ERR: at most %d cryptosystems, exiting\n", ATTACK_DAEMON_MAX_SERVED);
+                exit (EXIT_FAILURE);
+            }
+            csFilePath = csFilePaths[csCount++] = optarg;
             break;
         case 'b':
             messageBits = strtoul (optarg, &endptr, 10);
@@ -70,6 +265,31 @@ int main (int argc, char **argv) {
         case 't':
             tableFilePath = optarg;
             break;
+        case 'j':
+            threads = strtoul (optarg, &endptr, 10);
+            if (*endptr != '\0') {
+                usage ();
+                exit (1);
+            }
+            break;
+        case 'r':
+            sliceFirst = strtoull (optarg, &endptr, 10);
+            if (*endptr != ':') {
+                usage ();
+                exit (1);
+            }
+            sliceCount = strtoull (endptr + 1, &endptr, 10);
+            if (*endptr != '\0') {
+                usage ();
+                exit (1);
+            }
+            break;
+        case 'x':
+            writeContext = true;
+            break;
+        case 'd':
+            socketPath = optarg;
+            break;
         case ':':
         case '?':
             usage ();
@@ -77,6 +297,53 @@ int main (int argc, char **argv) {
         }
     }
 
+    if (csFilePath == NULL) {
+        printf ("ERR: cryptosystem not specified with -c, exiting\n");
+        usage ();
+        exit (EXIT_FAILURE);
+    }
+    if (csCount > 1 && (socketPath == NULL || writeContext)) {
+        printf ("ERR: more than one cryptosystem is only served with -d, exiting\n");
+        usage ();
+        exit (EXIT_FAILURE);
+    }
+    if (socketPath != NULL && !writeContext) {
+        if (messageBits == 0 || attackName == NULL) {
+            printf ("ERR: attack or messageBits not specified, exiting\n");
+            usage ();
+            exit (EXIT_FAILURE);
+        }
+        printf ("INFO: seed = %llu\n", seedUsed);
+        printf ("INFO: bits1 = %u, bits2 = %u\n", bits1, bits2);
+        if (csCount > 1 && tableFilePath != NULL) {
+            printf ("ERR: a table file serves only one cryptosystem, exiting\n");
+            exit (EXIT_FAILURE);
+        }
+        int status = serve (socketPath, attackName, csFilePaths, csCount, bits1, bits2,
+                            tableFilePath, threads, rstate);
+        gmp_randclear (rstate);
+        exit (status);
+    }
+    FILE *f = fopen (csFilePath, "r");
+    if (f == NULL) {
+        perror (csFilePath);
+        exit (EXIT_FAILURE);
+    }
+    ElgamalCryptosystem e;
+    e.read (f);
+    fclose (f);
+
+    if (writeContext) {
+        char *contextFilePath = AttackContext::fileNameFor (csFilePath);
+        time_t start = time (NULL);
+        if (!AttackContext::write (contextFilePath, &e))
+            exit (EXIT_FAILURE);
+        printf ("INFO: wrote attack context '%s' in %lds\n", contextFilePath,
+                (long) difftime (time (NULL), start));
+        free (contextFilePath);
+        exit (EXIT_SUCCESS);
+    }
+
     if (messageBits == 0) {
         printf ("ERR: messageBits not specified with -b, exiting\n");
         usage ();
@@ -87,112 +354,80 @@ int main (int argc, char **argv) {
     //    *messageFilePaths = argv[optind];
     //}
 
-    FILE *f = fopen (csFilePath, "r");
-    ElgamalCryptosystem e;
-    e.read (f);
-    fclose (f);
-
-    ElgamalAttack *attack = NULL;
-    
-    if (strcmp (attackName, "mim") == 0) {
-        attack = new MimAttack (&e, bits1, bits2);
-    } else if (strcmp (attackName, "hashmim") == 0) {
-        attack = new HashMimAttack (&e, bits1, bits2);
-    } else if (strcmp (attackName, "hashmim2") == 0) {
-        attack = new HashMimAttack2 (&e, bits1, bits2, tableFilePath);
-    } else if (strcmp (attackName, "hashmim3") == 0) {
-        attack = new HashMimAttack3 (&e, bits1, bits2, tableFilePath);
-    } else if (strcmp (attackName, "hashmim4") == 0) {
-        attack = new HashMimAttack4 (&e, bits1, bits2, tableFilePath);
-    } else if (strcmp (attackName, "diskmim") == 0) {
-        attack = new DiskMimAttack (&e, tableFilePath, bits1, bits2);
-    } else if (strcmp (attackName, "2table") == 0) {
-        attack = new TwoTableAttack (&e, bits1, bits2);
-    } else {
+    if (attackName == NULL) {
+        printf ("ERR: attack not specified with -n, exiting\n");
+        usage ();
+        exit (EXIT_FAILURE);
+    }
+    ElgamalAttack *attack = newAttack (attackName, &e, bits1, bits2, tableFilePath, threads);
+    if (attack == NULL) {
         printf ("Unknown attack '%s', exiting\n", attackName);
         exit (EXIT_FAILURE);
     }
 
     printf ("INFO: using attack '%s'\n", attack->getAttackName());
+    printf ("INFO: seed = %llu\n", seedUsed);
+
+    AttackContext *context = loadContext (csFilePath, &e, attack);
     printf ("INFO: bits1 = %u, bits2 = %u\n", bits1, bits2);
 
-    mpz_t m, uq, deltaq;
+    mpz_t m;
     ElgamalCipherText ct;
-    mpz_init (m); mpz_init (uq); mpz_init (deltaq);
+    mpz_init (m);
     mpz_init (ct.gk); mpz_init (ct.myk);
 
     printf ("INFO: using the following cryptosystem, from file '%s'\n", csFilePath);
     e.print ();
 
-    time_t start = time (NULL);
-    printf ("INFO: Building table...\n");
-    bool builtNew = attack->buildTable (rstate);
-    double diff = difftime (time (NULL), start);
-    if (builtNew) {
-        printf ("TIME[table,bits1=%u]: %dm %ds : %ld\n", bits1, (int) floor (diff / 60),
-                                                         ((int)diff) % 60, (long)diff);
+    if (!buildTable (attack, bits1, rstate)) {
+        printf ("ERR: could not build the table\n");
+        exit (EXIT_FAILURE);
     }
 
     MpzList results (20, 20);
     MpzList resultsUnique (10, 10);
-    size_t resultCount;
+    uint64_t fingerprint = elgamalFingerprint (&e);
     for (int i = optind; i < argc; i++) {
+        if (CipherTextContainer::isContainerName (argv[i])) {
+            CipherTextContainer container (argv[i]);
+            if (container.hasError ()) {
+                printf ("ERR: could not read container '%s'\n", argv[i]);
+                continue;
+            }
+            if (container.fingerprint != fingerprint) {
+                printf ("ERR: container '%s' is for a different cryptosystem\n", argv[i]);
+                continue;
+            }
+            char *label = (char *) malloc (strlen (argv[i]) + 32);
+            uint64_t last = container.count;
+            if (sliceFirst < last && sliceCount < last - sliceFirst)
+                last = sliceFirst + sliceCount;
+            for (uint64_t k = sliceFirst; k < last; k++) {
+                container.get (k, m, &ct);
+                sprintf (label, "%s:%llu", argv[i], (unsigned long long) k);
+                crackOne (attack, &e, label, m, ct, rstate, &results, &resultsUnique);
+            }
+            free (label);
+            continue;
+        }
+
         f = fopen (argv[i], "r");
 
         mpz_inp_raw (m, f);
         mpz_inp_raw (ct.gk, f);
         mpz_inp_raw (ct.myk, f);
 
-        mpz_powm (uq, ct.myk, e.baseOrder, e.prime);
-
         fclose (f);
 
-        printf ("message:\n");
-        gmp_printf ("\tm     = %Zd (%u bits)\n", m, mpz_sizeinbase (m, 2));
-        gmp_printf ("\tg^k   = %Zd (%u bits)\n", ct.gk, mpz_sizeinbase (ct.gk, 2));
-        gmp_printf ("\tm*y^k = %Zd (%u bits)\n", ct.myk, mpz_sizeinbase (ct.myk, 2));
-
-        time_t start = time (NULL);
-        resultCount = attack->crackMessage (&results, ct, rstate);
-        diff = difftime (time (NULL), start);
-        printf ("TIME[crack,file=%s]: %dm %ds : %ld\n", argv[i], (int) floor (diff / 60),
-                                                        ((int)diff) % 60, (long)diff);
-        printf ("RESULTS[file=%s]: %zu\n", argv[i], resultCount);
-        // iterate through results, then clear
-        bool found = false;
-        gmp_printf ("actual message: %Zd\n", m);
-        for (size_t j = 0; j < resultCount; j++) {
-            if (!resultsUnique.find (NULL, results[j])) {
-                resultsUnique.append (results[j]);
-                // verify that this result really works
-                mpz_powm (deltaq, results[j], e.baseOrder, e.prime);
-                if (mpz_cmp (deltaq, uq) != 0) {
-                    gmp_printf ("!!results[%zu] = %Zd\n", j, results[j]);
-                    printf ("ERR: found result which doesn't work!\n");
-                } else if (mpz_cmp (results[j], m) == 0) {
-                    gmp_printf ("**results[%zu] = %Zd\n", j, results[j]);
-                    found = true;
-                } else {
-                    gmp_printf ("  results[%zu] = %Zd\n", j, results[j]);
-                }
-            }
-        }
-        printf ("URESULTS[file=%s]: %zu\n", argv[i], resultsUnique.getSize());
-        results.clear ();
-        resultsUnique.clear();
-        //gmp_printf ("crack result   : %Zd\n", result);
-        //gmp_printf ("expected result: %Zd\n", m);
-        if (!found) {
-            printf ("ERR: message not found\n");
-        }
-
+        crackOne (attack, &e, argv[i], m, ct, rstate, &results, &resultsUnique);
     }
 
-    mpz_clear (m); mpz_clear (uq); mpz_clear (deltaq);
+    mpz_clear (m);
     mpz_clear (ct.gk); mpz_clear (ct.myk);
     gmp_randclear (rstate);
 
     delete attack;
+    delete context;
 
 
 /*
@@ -2,6 +2,9 @@
  * Program to time how long it takes to do just the modular
  * exponentiations associtiated with the meet-in-the-middle attacks,
  * without actually storing or sorting the results.
+ *
+ * With -k the exponentiations are done in batches with the given BatchPowm
+ * kernel (auto, scalar, avx2 or ifma), to compare the kernels.
  */
 
 #include <stdlib.h>
@@ -13,28 +16,46 @@
 #include "include/types.h"
 #include "include/randomhelpers.h"
 #include "include/elgamal.h"
+#include "include/batchpowm.h"
+
+// bases per BatchPowm call with -k
+#define MODEXP_BATCH 1024
 
 void usage (char *argv0) {
-    printf ("Usage: %s [-nr] bits cryptosystemFilePath\n", argv0);
+    printf ("Usage: %s [-nr] [-k kernel] bits cryptosystemFilePath\n", argv0);
 }
 
 int main (int argc, char **argv) {
 
     int firstArg = 1;
     bool nr = false;
-    if (argc == 4) {
-        if (strcmp (argv[1], "-nr") == 0) {
-            firstArg = 2;
+    const char *kernelName = NULL;
+    while (firstArg < argc && argv[firstArg][0] == '-') {
+        if (strcmp (argv[firstArg], "-nr") == 0) {
             nr = true;
+            firstArg++;
+        } else if (strcmp (argv[firstArg], "-k") == 0 && firstArg + 1 < argc) {
+            kernelName = argv[firstArg + 1];
+            firstArg += 2;
         } else {
             usage (argv[0]);
             exit (EXIT_FAILURE);
         }
-    } else if (argc != 3) {
+    }
+    if (argc - firstArg != 2) {
         usage (argv[0]);
         exit (EXIT_FAILURE);
     }
 
+    unsigned int kernel = BATCH_POWM_AUTO;
+    if (kernelName != NULL) {
+        kernel = batchPowmKernelFromName (kernelName);
+        if (kernel == BATCH_POWM_AUTO && strcmp (kernelName, "auto") != 0) {
+            fprintf (stderr, "Unknown kernel '%s'\n", kernelName);
+            exit (EXIT_FAILURE);
+        }
+    }
+
     // process bits argument
     char *endptr;
     unsigned long bits = strtoul (argv[firstArg], &endptr, 10);
@@ -68,14 +89,39 @@ int main (int argc, char **argv) {
         mpz_init_set (exp, e->baseOrder); 
     }
 
+    BatchPowm *batch = NULL;
+    unsigned long *bases = NULL;
+    mpz_t *results = NULL;
+    if (kernelName != NULL) {
+        batch = new BatchPowm (e->prime, exp, kernel);
+        bases = (unsigned long *) malloc (MODEXP_BATCH * sizeof (*bases));
+        results = (mpz_t *) malloc (MODEXP_BATCH * sizeof (*results));
+        if (batch->hasMallocError () || bases == NULL || results == NULL) {
+            fprintf (stderr, "Out of memory\n");
+            exit (EXIT_FAILURE);
+        }
+        for (size_t k = 0; k < MODEXP_BATCH; k++)
+            mpz_init (results[k]);
+        printf ("INFO: using kernel '%s'\n", batchPowmKernelName (batch->getKernel ()));
+    }
+
     timeval start, end;
     gettimeofday (&start, NULL);
 
     //printf ("Generating table...\n");
-    for (unsigned long i = 0; i < max; i++) {
-        mpz_add_ui (delta1, delta1, 1);
+    if (batch != NULL) {
+        for (unsigned long i = 0; i < max; i += MODEXP_BATCH) {
+            size_t count = (max - i < MODEXP_BATCH) ? max - i : MODEXP_BATCH;
+            for (size_t k = 0; k < count; k++)
+                bases[k] = i + k + 1;
+            batch->powm (results, bases, count);
+        }
+    } else {
+        for (unsigned long i = 0; i < max; i++) {
+            mpz_add_ui (delta1, delta1, 1);
 
-        mpz_powm (tmp, delta1, exp, e->prime);
+            mpz_powm (tmp, delta1, exp, e->prime);
+        }
     }
     
     gettimeofday (&end, NULL);
@@ -98,6 +144,13 @@ int main (int argc, char **argv) {
     mpz_clear (delta1);
     mpz_clear (tmp);
     mpz_clear (exp);
+    if (batch != NULL) {
+        for (size_t k = 0; k < MODEXP_BATCH; k++)
+            mpz_clear (results[k]);
+        free (results);
+        free (bases);
+        delete batch;
+    }
 
     delete e;
  
@@ -15,10 +15,11 @@
 #include "include/elgamal.h"
 
 void usage (char *argv0) {
-    printf ("Usage: %s [-o] bits cryptosystemFilePath\n", argv0);
+    printf ("Usage: %s [-o] [--seed N] bits cryptosystemFilePath\n", argv0);
 }
 
 int main (int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
 
     int firstArg = 1;
     bool optimize = false;
@@ -55,8 +56,7 @@ int main (int argc, char **argv) {
     fclose (f);
 
     gmp_randstate_t rstate;
-    gmp_randinit_default (rstate);
-    if (!seedRandState (rstate)) {
+    if (!initRandState (rstate, seed)) {
         fprintf (stderr, "Failed to seed random state, exiting\n");
         exit (EXIT_FAILURE);
     }
@@ -15,10 +15,11 @@
 #include "include/randomhelpers.h"
 
 void usage () {
-    printf ("randomfac [-t targetBits] [-e exactBits] [-l smoothBitLimit]\n");
+    printf ("randomfac [-t targetBits] [-e exactBits] [-l smoothBitLimit] [--seed N]\n");
 }
 
 int main(int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
 
     int targetBits = 256;
     int exactBits = 0;
@@ -60,8 +61,10 @@ int main(int argc, char **argv) {
 
     gmp_randstate_t rstate;
 
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+    if (!initRandState (rstate, seed)) {
+        fprintf (stderr, "Failed to seed random state, exiting\n");
+        exit (EXIT_FAILURE);
+    }
 
     
     CFactoredInteger fi;
@@ -19,13 +19,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <gmp.h>
 
 #include "include/types.h"
 #include "include/randomhelpers.h"
+#include "include/philox.h"
+#include "include/splitestimate.h"
 
 void usage (char *argv0) {
-    printf ("Usage: %s [-f] bits b1 b2 count\n", argv0);
+    printf ("Usage: %s [-f] [-j threads] [--seed N] bits b1 b2 count\n", argv0);
+    printf ("       %s -a [-k factors] bits b1 b2\n", argv0);
+    printf ("  bits, b1 and b2 may each be a range from:to[:step], every point of\n");
+    printf ("  the grid is run with count trials\n");
+    printf ("  -a computes the probabilities numerically instead, placing the\n");
+    printf ("  largest factors (default %d) exactly; it refuses points with\n", SPLIT_ESTIMATE_DEFAULT_FACTORS);
+    printf ("  b1 + b2 < bits + %d, which must be sampled\n", SPLIT_ESTIMATE_MIN_SLACK);
 }
 
 void printArray (unsigned int a[], int n) {
@@ -35,253 +46,505 @@ void printArray (unsigned int a[], int n) {
     printf ("\n");
 }
 
-void generateRandomPreFactoredIntegers (unsigned long bits, unsigned long b1,
-                                        unsigned long b2, unsigned long count) {
+typedef struct {
+    unsigned long bits, b1, b2;
+    bool factorRandom;   // factor uniform random integers instead of generating factored ones
+} SplitPoint;
 
-    unsigned long b12max = (b1 > b2) ? b1 : b2;
-    unsigned long b12min = (b1 < b2) ? b1 : b2;
+// Sums of logs closer than this to a bound are checked exactly.
+#define SPLIT_LOG_EPSILON 1e-6
 
-    CFactoredInteger f;
-    gmp_randstate_t rstate;
-    mpz_t max, splitMax, splitMin;
-    mpz_t s1, s2, tmp;
-    
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+// Most divisors isSplittable keeps for the enumerated half.
+#define SPLIT_MAX_TABLE (1ul << 20)
 
-    mpz_init (s1); mpz_init (s2); mpz_init (tmp);
-    mpz_init_set_ui (max, 1);
-    mpz_init_set_ui (splitMax, 1);
-    mpz_init_set_ui (splitMin, 1);
+typedef struct {
+    double log;              // log2 of the divisor
+    unsigned long code;      // its exponents in mixed radix power + 1
+} HalfDivisor;
 
-    mpz_mul_2exp (max, max, bits);
-    mpz_sub_ui (max, max, 1);
-    mpz_mul_2exp (splitMax, splitMax, b12max);
-    mpz_mul_2exp (splitMin, splitMin, b12min);
+/*
+ * Scratch space for isSplittable, kept per thread so the trials do not
+ * allocate.
+ */
+typedef struct {
+    size_t factorsSize;
+    double *logs;            // log2 of each prime
+    unsigned int *order;     // factor indices, the table half first
+    unsigned int *exponents; // odometer for the other half
+    size_t tableSize;
+    HalfDivisor *table;
+} SplitSearch;
+
+void splitSearchInit (SplitSearch *search) {
+    memset (search, 0, sizeof (*search));
+}
 
-    unsigned int powers[bits];
-
-    unsigned long splitCount = 0;
-    unsigned long noSplitCount = 0;
-    unsigned int i;
-    bool end;
-    for (unsigned int k = count; k > 0; k--) {
-        f.random (max, rstate);
-        //f.print ();
-        if (mpz_cmp (f.factors[0].prime, splitMax) > 0) {
-            noSplitCount++;
-        } else if (mpz_cmp (f.value, splitMax) <= 0) {
-            splitCount++;
-        } else {
-            mpz_set_ui (s1, 1);
-            mpz_set (s2, f.value);
-            for (i = 0; i < f.nFactors; i++) {
-                powers[i] = 0;
-            }
-            
-            end = false;
-            while (1) {
-                i = f.nFactors-1;
-                while (powers[i] == f.factors[i].power) {
-                    if (i > 0) {
-                        powers[i] = 0;
-                        mpz_fdiv_q (s1, s1, f.factors[i].value);
-                        mpz_mul (s2, s2, f.factors[i].value);
-                        i--;
-                    } else {
-                        noSplitCount++;
-                        end = true;
-                        break;
-                    }
-                }
-                if (end) { break; }
-
-                powers[i]++;
-                //printArray (powers, f.nFactors);
-                mpz_mul (s1, s1, f.factors[i].prime);
-                //if (mpz_cmp (s1, splitMin) > 0)
-                //    break;
-                mpz_fdiv_q (s2, s2, f.factors[i].prime);
-                if (mpz_cmp (s2, splitMax) <= 0 && mpz_cmp (s1, splitMin) <= 0) {
-                    mpz_mul (tmp, s1, s2);
-                    if (mpz_cmp (tmp, f.value) != 0) {
-                        gmp_printf ("ERROR: bad split value = %Zd != %Zd = prod\n", f.value, tmp);
-                        exit (EXIT_FAILURE);
-                    }
-                    splitCount++;
-                    break;
-                    //gmp_printf ("Split found: %Zd * %Zd = %Zd\n", s1, s2, tmp);
-                    //printArray (powers, f.nFactors);
-                }
-                //if (carry)
-                //    i = f.nFactors - 1;
-            }
+void splitSearchClear (SplitSearch *search) {
+    free (search->logs); free (search->order); free (search->exponents);
+    free (search->table);
+}
+
+bool splitSearchReserve (SplitSearch *search, size_t factors, size_t tableSize) {
+    if (factors > search->factorsSize) {
+        free (search->logs); free (search->order); free (search->exponents);
+        search->logs = (double *) malloc (factors * sizeof (double));
+        search->order = (unsigned int *) malloc (factors * sizeof (unsigned int));
+        search->exponents = (unsigned int *) malloc (factors * sizeof (unsigned int));
+        search->factorsSize = factors;
+        if (search->logs == NULL || search->order == NULL || search->exponents == NULL) {
+            search->factorsSize = 0;
+            return false;
         }
     }
+    if (tableSize > search->tableSize) {
+        free (search->table);
+        search->table = (HalfDivisor *) malloc (tableSize * sizeof (HalfDivisor));
+        search->tableSize = (search->table != NULL) ? tableSize : 0;
+        return search->table != NULL;
+    }
+    return true;
+}
 
-    printf ("   split: %lu\n", splitCount);
-    printf ("no split: %lu\n", noSplitCount);
+int halfDivisorCompare (const void *a, const void *b) {
+    double x = ((const HalfDivisor *) a)->log, y = ((const HalfDivisor *) b)->log;
+    return (x > y) - (x < y);
+}
 
-    printf ("[%lu %lu %lu] ", bits, b1, b2);
-    printf ("%0.1f\n", (splitCount * 100.00)/count);
+// s1 = product of the primes order[first ... last) to the exponents in code
+void decodeDivisor (mpz_t s1, CFactoredInteger &f, const unsigned int *order,
+                    unsigned int first, unsigned int last, unsigned long code, mpz_t tmp) {
+    for (unsigned int k = first; k < last; k++) {
+        unsigned int j = order[k];
+        unsigned long radix = f.factors[j].power + 1;
+        mpz_pow_ui (tmp, f.factors[j].prime, code % radix);
+        mpz_mul (s1, s1, tmp);
+        code /= radix;
+    }
+}
 
-    mpz_clear (s1); mpz_clear (s2); mpz_clear (tmp);
-    mpz_clear (max);
-    mpz_clear (splitMax);
-    mpz_clear (splitMin);
-    gmp_randclear (rstate);
+/*
+ * True if f = s1 s2 with s1 <= splitMin and s2 <= splitMax, that is if f
+ * has a divisor s1 with f / splitMax <= s1 <= splitMin.
+ *
+ * This is a subset sum over the logs of the prime powers, solved by meeting
+ * in the middle: the divisors of one half of the factors are tabulated and
+ * sorted by log, and for each divisor x of the other half the table is
+ * binary searched for a y with x y in range. Only sums within
+ * SPLIT_LOG_EPSILON of a bound are checked with exact arithmetic. The
+ * table half is kept to about the square root of the divisor count, so
+ * even heavily composite values take about sqrt (d (f)) log d (f) steps
+ * instead of d (f).
+ */
+bool isSplittable (CFactoredInteger &f, mpz_t splitMax, mpz_t splitMin,
+                   unsigned long maxBits, unsigned long minBits,
+                   SplitSearch *search, mpz_t s1, mpz_t tmp) {
+    if (f.nFactors == 0 || mpz_cmp (f.value, splitMax) <= 0)
+        return true;
+
+    unsigned int n = f.nFactors;
+    if (!splitSearchReserve (search, n, 0)) {
+        printf ("ERROR: out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+
+    double divisorCount = 1;
+    for (unsigned int i = 0; i < n; i++) {
+        // a prime above splitMax can go in neither part
+        if (mpz_cmp (f.factors[i].prime, splitMax) > 0)
+            return false;
+        long e;
+        double d = mpz_get_d_2exp (&e, f.factors[i].prime);
+        search->logs[i] = e + log2 (d);
+        divisorCount *= f.factors[i].power + 1;
+    }
+
+    long e;
+    double d = mpz_get_d_2exp (&e, f.value);
+    double lower = e + log2 (d) - maxBits;
+    double upper = minBits;
+    if (lower > upper + SPLIT_LOG_EPSILON)
+        return false;
+
+    // First fit from the largest prime down usually finds a split at once,
+    // which saves building the table.
+    double greedy = 0;
+    for (unsigned int i = n; i-- > 0; ) {
+        for (unsigned int p = 0; p < f.factors[i].power
+                && greedy + search->logs[i] <= upper - SPLIT_LOG_EPSILON; p++)
+            greedy += search->logs[i];
+    }
+    if (greedy >= lower + SPLIT_LOG_EPSILON)
+        return true;
+
+    // Fill the table half with the factors with most exponents first, up to
+    // the square root of the divisor count, and leave the rest to the
+    // odometer.
+    unsigned int tableFactors = 0, otherFactors = n;
+    for (unsigned int i = 0; i < n; i++)
+        search->order[i] = i;
+    for (unsigned int i = 1; i < n; i++) {
+        unsigned int j = search->order[i], k = i;
+        for (; k > 0 && f.factors[search->order[k-1]].power < f.factors[j].power; k--)
+            search->order[k] = search->order[k-1];
+        search->order[k] = j;
+    }
+    double target = sqrt (divisorCount);
+    if (target > SPLIT_MAX_TABLE)
+        target = SPLIT_MAX_TABLE;
+    size_t tableLength = 1;
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int j = search->order[i];
+        if (tableLength * (f.factors[j].power + 1) <= target || tableFactors == 0) {
+            tableLength *= f.factors[j].power + 1;
+            // keep the table factors in front
+            search->order[i] = search->order[tableFactors];
+            search->order[tableFactors++] = j;
+        }
+    }
+    otherFactors = n - tableFactors;
 
+    if (!splitSearchReserve (search, n, tableLength)) {
+        printf ("ERROR: out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+    HalfDivisor *table = search->table;
+    table[0].log = 0;
+    table[0].code = 0;
+    size_t length = 1;
+    unsigned long radix = 1;
+    for (unsigned int k = 0; k < tableFactors; k++) {
+        unsigned int j = search->order[k];
+        size_t previous = length;
+        for (unsigned int p = 1; p <= f.factors[j].power; p++) {
+            for (size_t t = 0; t < previous; t++) {
+                table[length].log = table[t].log + p * search->logs[j];
+                table[length].code = table[t].code + p * radix;
+                length++;
+            }
+        }
+        radix *= f.factors[j].power + 1;
+    }
+    qsort (table, length, sizeof (HalfDivisor), halfDivisorCompare);
+
+    // odometer over the exponents of the other factors
+    unsigned int *exponents = search->exponents;
+    for (unsigned int k = 0; k < otherFactors; k++)
+        exponents[k] = 0;
+    double x = 0;
+    while (1) {
+        // first y with x + y >= lower - epsilon
+        size_t lo = 0, hi = length;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (x + table[mid].log < lower - SPLIT_LOG_EPSILON)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (size_t t = lo; t < length && x + table[t].log <= upper + SPLIT_LOG_EPSILON; t++) {
+            double sum = x + table[t].log;
+            if (sum >= lower + SPLIT_LOG_EPSILON && sum <= upper - SPLIT_LOG_EPSILON)
+                return true;
+
+            // near a bound, so build s1 and compare exactly
+            mpz_set_ui (s1, 1);
+            decodeDivisor (s1, f, search->order, 0, tableFactors, table[t].code, tmp);
+            for (unsigned int k = 0; k < otherFactors; k++) {
+                mpz_pow_ui (tmp, f.factors[search->order[tableFactors + k]].prime, exponents[k]);
+                mpz_mul (s1, s1, tmp);
+            }
+            if (mpz_cmp (s1, splitMin) <= 0) {
+                mpz_mul (tmp, s1, splitMax);
+                if (mpz_cmp (tmp, f.value) >= 0)
+                    return true;
+            }
+        }
+
+        unsigned int k = 0;
+        for (; k < otherFactors; k++) {
+            unsigned int j = search->order[tableFactors + k];
+            if (exponents[k] < f.factors[j].power) {
+                exponents[k]++;
+                x += search->logs[j];
+                break;
+            }
+            x -= exponents[k] * search->logs[j];
+            exponents[k] = 0;
+        }
+        if (k == otherFactors)
+            return false;
+    }
 }
 
-void factorRandomIntegers (unsigned long bits, unsigned long b1, unsigned long b2,
-                           unsigned long count) {
+typedef struct {
+    const SplitPoint *point;
+    unsigned long first, count;  // trials first to first + count - 1
+    uint64_t seed;               // trial i draws from stream i of it
+    unsigned long splitCount;
+    pthread_t thread;
+} SplitTrials;
 
-    unsigned long b12max = (b1 > b2) ? b1 : b2;
-    unsigned long b12min = (b1 < b2) ? b1 : b2;
+/*
+ * Run t->count trials for one point and count the integers which split.
+ * Each trial has a stream of its own, so the count does not depend on how
+ * the trials are spread over the threads.
+ */
+void *runTrials (void *arg) {
+    SplitTrials *t = (SplitTrials *) arg;
+    const SplitPoint *point = t->point;
+
+    unsigned long b12max = (point->b1 > point->b2) ? point->b1 : point->b2;
+    unsigned long b12min = (point->b1 < point->b2) ? point->b1 : point->b2;
 
     CFactoredInteger f;
     gmp_randstate_t rstate;
     mpz_t max, splitMax, splitMin;
-    mpz_t s1, s2, tmp;
-    
-    gmp_randinit_default (rstate);
-    seedRandState (rstate);
+    mpz_t s1, tmp;
+
+    randStateInitPhilox (rstate, t->seed, 0);
 
-    mpz_init (s1); mpz_init (s2); mpz_init (tmp);
+    mpz_init (s1); mpz_init (tmp);
     mpz_init_set_ui (max, 1);
     mpz_init_set_ui (splitMax, 1);
     mpz_init_set_ui (splitMin, 1);
 
-    mpz_mul_2exp (max, max, bits);
+    mpz_mul_2exp (max, max, point->bits);
     mpz_sub_ui (max, max, 1);
     mpz_mul_2exp (splitMax, splitMax, b12max);
     mpz_mul_2exp (splitMin, splitMin, b12min);
 
-    unsigned int powers[bits];
-
-    unsigned long splitCount = 0;
-    unsigned long noSplitCount = 0;
-    unsigned int i;
-    bool end;
-    for (unsigned int k = count; k > 0; k--) {
-        mpz_urandomm (tmp, rstate, max); // 0 to max - 1
-        mpz_add_ui (tmp, tmp, 1); // 1 to max
-        f.factorValue (tmp);
-        //f.print ();
-        if (mpz_cmp (f.factors[0].prime, splitMax) > 0) {
-            noSplitCount++;
-        } else if (mpz_cmp (f.value, splitMax) <= 0) {
-            splitCount++;
+    SplitSearch search;
+    splitSearchInit (&search);
+
+    t->splitCount = 0;
+    for (unsigned long i = t->first; i < t->first + t->count; i++) {
+        randStateSetStream (rstate, t->seed, i);
+        if (point->factorRandom) {
+            mpz_urandomm (tmp, rstate, max); // 0 to max - 1
+            mpz_add_ui (tmp, tmp, 1); // 1 to max
+            f.factorValue (tmp);
         } else {
-            mpz_set_ui (s1, 1);
-            mpz_set (s2, f.value);
-            for (i = 0; i < f.nFactors; i++) {
-                powers[i] = 0;
-            }
-            
-            end = false;
-            while (1) {
-                i = 0;
-                while (powers[i] == f.factors[i].power) {
-                    if (i + 1 < f.nFactors) {
-                        powers[i] = 0;
-                        mpz_fdiv_q (s1, s1, f.factors[i].value);
-                        mpz_mul (s2, s2, f.factors[i].value);
-                        i++;
-                    } else {
-                        noSplitCount++;
-                        end = true;
-                        break;
-                    }
-                }
-                if (end) { break; }
-
-                powers[i]++;
-                //printArray (powers, f.nFactors);
-                mpz_mul (s1, s1, f.factors[i].prime);
-                //if (mpz_cmp (s1, splitMin) > 0)
-                //    break;
-                mpz_fdiv_q (s2, s2, f.factors[i].prime);
-                if (mpz_cmp (s2, splitMax) <= 0 && mpz_cmp (s1, splitMin) <= 0) {
-                    mpz_mul (tmp, s1, s2);
-                    if (mpz_cmp (tmp, f.value) != 0) {
-                        gmp_printf ("ERROR: bad split value = %Zd != %Zd = prod\n", f.value, tmp);
-                        exit (EXIT_FAILURE);
-                    }
-                    splitCount++;
-                    break;
-                    //gmp_printf ("Split found: %Zd * %Zd = %Zd\n", s1, s2, tmp);
-                    //printArray (powers, f.nFactors);
-                }
-                //if (carry)
-                //    i = f.nFactors - 1;
-            }
+            f.random (max, rstate);
         }
+        if (isSplittable (f, splitMax, splitMin, b12max, b12min, &search, s1, tmp))
+            t->splitCount++;
     }
 
-    printf ("   split: %lu\n", splitCount);
-    printf ("no split: %lu\n", noSplitCount);
-
-    printf ("[%lu %lu %lu] ", bits, b1, b2);
-    printf ("%0.1f\n", (splitCount * 100.00)/count);
-
-    mpz_clear (s1); mpz_clear (s2); mpz_clear (tmp);
+    splitSearchClear (&search);
+    mpz_clear (s1); mpz_clear (tmp);
     mpz_clear (max);
     mpz_clear (splitMax);
     mpz_clear (splitMin);
     gmp_randclear (rstate);
 
+    return NULL;
+}
+
+/*
+ * Wilson score interval for a proportion, at 95%. Unlike the normal
+ * approximation it stays inside [0, 1] when few or almost all trials split.
+ */
+void wilsonInterval (unsigned long successes, unsigned long n, double *low, double *high) {
+    const double z = 1.959964;
+    double p = (double) successes / n;
+    double denominator = 1 + z * z / n;
+    double center = (p + z * z / (2.0 * n)) / denominator;
+    double halfWidth = z * sqrt (p * (1 - p) / n + z * z / (4.0 * n * n)) / denominator;
+    *low = center - halfWidth;
+    *high = center + halfWidth;
+}
+
+/*
+ * Spread count trials for one point over threads workers and print the
+ * split percentage with its confidence interval.
+ */
+bool estimatePoint (const SplitPoint *point, unsigned long count, unsigned int threads,
+                    gmp_randstate_t rstate) {
+    if (threads > count)
+        threads = count;
+
+    SplitTrials *t = (SplitTrials *) malloc (threads * sizeof (SplitTrials));
+    if (t == NULL)
+        return false;
+
+    unsigned int started = 0;
+    unsigned long first = 0;
+    uint64_t seed = randStateSeed (rstate);
+    for (unsigned int i = 0; i < threads; i++) {
+        t[i].point = point;
+        t[i].first = first;
+        t[i].count = count / threads + (i < count % threads ? 1 : 0);
+        first += t[i].count;
+        t[i].seed = seed;
+        if (pthread_create (&t[i].thread, NULL, runTrials, &t[i]) != 0)
+            break;
+        started++;
+    }
+
+    unsigned long splitCount = 0, trials = 0;
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join (t[i].thread, NULL);
+        splitCount += t[i].splitCount;
+        trials += t[i].count;
+    }
+    free (t);
+
+    if (trials == 0)
+        return false;
+
+    double low, high;
+    wilsonInterval (splitCount, trials, &low, &high);
+
+    printf ("   split: %lu\n", splitCount);
+    printf ("no split: %lu\n", trials - splitCount);
+
+    printf ("[%lu %lu %lu] ", point->bits, point->b1, point->b2);
+    printf ("%0.1f (95%% CI %0.2f - %0.2f, %lu trials)\n", (splitCount * 100.00)/trials,
+            low * 100, high * 100, trials);
+
+    return true;
+}
+
+typedef struct {
+    unsigned long from, to, step;
+} Range;
+
+/*
+ * Print the numerical estimate for every point of the grid, with one
+ * estimator per message size, counting the points it refuses in refused.
+ */
+bool estimateGrid (const Range *bitsRange, const Range *b1Range, const Range *b2Range,
+                   unsigned int factors, unsigned long *refused) {
+    *refused = 0;
+    for (unsigned long bits = bitsRange->from; bits <= bitsRange->to; bits += bitsRange->step) {
+        SplitEstimator e (bits);
+        if (e.hasMallocError ())
+            return false;
+        for (unsigned long b1 = b1Range->from; b1 <= b1Range->to; b1 += b1Range->step) {
+            for (unsigned long b2 = b2Range->from; b2 <= b2Range->to; b2 += b2Range->step) {
+                double p = e.probability (b1, b2, factors);
+                if (isnan (p)) {
+                    printf ("ERR: [%lu %lu %lu] b1 + b2 < bits + %d, where the estimate"
+                            " is far too high; sample it with splitProb %lu %lu %lu count\n",
+                            bits, b1, b2, SPLIT_ESTIMATE_MIN_SLACK, bits, b1, b2);
+                    (*refused)++;
+                    continue;
+                }
+                printf ("[%lu %lu %lu] ", bits, b1, b2);
+                printf ("%0.1f (analytic, %u largest factors placed)\n", p * 100, factors);
+            }
+        }
+    }
+    return true;
+}
+
+// "n" or "from:to" or "from:to:step"
+bool parseRange (const char *s, Range *r) {
+    char *endptr;
+    r->from = r->to = strtoul (s, &endptr, 10);
+    r->step = 1;
+    if (*endptr == ':') {
+        r->to = strtoul (endptr + 1, &endptr, 10);
+        if (*endptr == ':')
+            r->step = strtoul (endptr + 1, &endptr, 10);
+    }
+    return *endptr == '\0' && r->step > 0 && r->from <= r->to;
 }
 
 int main (int argc, char **argv) {
+    const char *seed = takeSeedOption (&argc, argv);
     
     char *argv0 = argv[0];
     bool useFactoredRandom = false;
+    bool analytic = false;
+    unsigned int factors = SPLIT_ESTIMATE_DEFAULT_FACTORS;
+    unsigned int threads = 0; // one per online processor
 
-    if (argc == 6) {
-        if (strcmp (argv[1], "-f") == 0) {
+    char *endptr;
+    int opt;
+    while ((opt = getopt (argc, argv, "afj:k:")) != -1) {
+        switch (opt) {
+        case 'a':
+            analytic = true;
+            break;
+        case 'f':
             useFactoredRandom = true;
-            argv++;
-        } else {
+            break;
+        case 'k':
+            factors = strtoul (optarg, &endptr, 10);
+            if (*endptr != '\0' || factors < 1 || factors > SPLIT_ESTIMATE_MAX_FACTORS) {
+                printf ("factors must be 1 to %d\n", SPLIT_ESTIMATE_MAX_FACTORS);
+                exit (EXIT_FAILURE);
+            }
+            break;
+        case 'j':
+            threads = strtoul (optarg, &endptr, 10);
+            if (*endptr != '\0') {
+                usage (argv0);
+                exit (EXIT_FAILURE);
+            }
+            break;
+        case ':':
+        case '?':
             usage (argv0);
             exit (EXIT_FAILURE);
         }
-    } else if (argc != 5) {
-        usage (argv0);
-        exit (EXIT_FAILURE);
     }
 
-
-    unsigned long bits, b1, b2, count;
-    char *endptr;
-    bits = strtoul (argv[1], &endptr, 10);
-    if (*endptr != '\0') {
+    if (argc - optind != (analytic ? 3 : 4)) {
         usage (argv0);
         exit (EXIT_FAILURE);
     }
+    argv += optind - 1;
 
-    b1 = strtoul (argv[2], &endptr, 10);
-    if (*endptr != '\0') {
+    Range bits, b1, b2;
+    if (!parseRange (argv[1], &bits) || !parseRange (argv[2], &b1) || !parseRange (argv[3], &b2)) {
         usage (argv0);
         exit (EXIT_FAILURE);
     }
 
-    b2 = strtoul (argv[3], &endptr, 10);
-    if (*endptr != '\0') {
+    if (analytic) {
+        if (bits.from == 0) {
+            usage (argv0);
+            exit (EXIT_FAILURE);
+        }
+        unsigned long refused;
+        if (!estimateGrid (&bits, &b1, &b2, factors, &refused)) {
+            printf ("ERROR: out of memory\n");
+            exit (EXIT_FAILURE);
+        }
+        return (refused == 0) ? 0 : EXIT_FAILURE;
+    }
+
+    unsigned long count = strtoul (argv[4], &endptr, 10);
+    if (*endptr != '\0' || count == 0) {
         usage (argv0);
         exit (EXIT_FAILURE);
     }
 
-    count = strtoul (argv[4], &endptr, 10);
-    if (*endptr != '\0') {
-        usage (argv0);
+    if (threads == 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? online : 1;
+    }
+
+    gmp_randstate_t rstate;
+    if (!initRandState (rstate, seed)) {
+        fprintf (stderr, "Failed to seed random state, exiting\n");
         exit (EXIT_FAILURE);
     }
 
-    if (useFactoredRandom) {
-        factorRandomIntegers (bits, b1, b2, count);
-    } else {
-        generateRandomPreFactoredIntegers (bits, b1, b2, count);
+    SplitPoint point;
+    point.factorRandom = useFactoredRandom;
+    for (point.bits = bits.from; point.bits <= bits.to; point.bits += bits.step) {
+        for (point.b1 = b1.from; point.b1 <= b1.to; point.b1 += b1.step) {
+            for (point.b2 = b2.from; point.b2 <= b2.to; point.b2 += b2.step) {
+                if (!estimatePoint (&point, count, threads, rstate)) {
+                    printf ("ERROR: could not start trials\n");
+                    exit (EXIT_FAILURE);
+                }
+            }
+        }
     }
 
+    gmp_randclear (rstate);
 }